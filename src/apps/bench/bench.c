@@ -0,0 +1,32 @@
+#include <libc/string.h>
+#include <libc/stdlib.h>
+#include <libc/gui/layout.h>
+#include "bench.h"
+
+char *format_result(char *name, uint32_t value, char *unit)
+{
+  char number[16] = {0};
+  itoa(value, 10, number);
+
+  char *text = calloc(strlen(name) + strlen(number) + strlen(unit) + 1, sizeof(char));
+  strcat(text, name);
+  strcat(text, number);
+  strcat(text, unit);
+  return text;
+}
+
+// one label per result, window stays open until it is closed
+void show_results(struct bench_result *results, uint32_t count)
+{
+  struct window *win = init_window(272, 196, 256, 16 + 32 * count);
+
+  struct ui_style *style = calloc(1, sizeof(struct ui_style));
+  style->padding_top = 8;
+  style->padding_left = 10;
+
+  struct ui_label *labels = calloc(count, sizeof(struct ui_label));
+  for (uint32_t i = 0; i < count; ++i)
+    gui_create_label(win, &labels[i], 0, 16 + 32 * i, 256, 32, format_result(results[i].name, results[i].value, results[i].unit), style);
+
+  enter_event_loop(win);
+}
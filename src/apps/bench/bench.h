@@ -0,0 +1,24 @@
+#ifndef APPS_BENCH_H
+#define APPS_BENCH_H
+
+#include <stdint.h>
+
+struct bench_result
+{
+  char *name;
+  uint32_t value;
+  char *unit;
+};
+
+static inline uint64_t rdtsc()
+{
+  uint64_t ret;
+  __asm__ __volatile__("rdtsc"
+                       : "=A"(ret));
+  return ret;
+}
+
+char *format_result(char *name, uint32_t value, char *unit);
+void show_results(struct bench_result *results, uint32_t count);
+
+#endif
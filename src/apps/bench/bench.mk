@@ -0,0 +1,28 @@
+# Shared build of the benchmark apps, an app's Makefile sets APP (name of its directory and main source) and includes this
+# bench.c (rdtsc, result window) is linked into every app
+TOPDIR  := $(shell if [ "$$PWD" != "" ] ; then echo $$PWD ; else pwd ; fi)
+INCLUDE = $(TOPDIR)/../../
+BENCHDIR = $(TOPDIR)/../bench
+
+C_SOURCES = $(wildcard $(APP).c $(BENCHDIR)/bench.c src/*.c ../../include/*.c ../../libc/*.c ../../libc/**/*.c)
+HEADERS = $(wildcard *.h $(BENCHDIR)/*.h src/*.h ../../include/*.h ../../libc/*.h ../../libc/**/*.h)
+
+# Nice syntax for file extension replacement
+OBJ = ${C_SOURCES:.c=.o}
+
+CC = /usr/local/bin/i386-elf-gcc
+LD = /usr/local/bin/i386-elf-ld
+GDB = /usr/local/bin/i386-elf-gdb
+
+# -g: Use debugging symbols in gcc
+CFLAGS = -g -std=gnu99 -ffreestanding -Wall -Wextra -Wno-sequence-point -I$(INCLUDE)
+
+$(APP): ${OBJ}
+	${CC} -o $@ -T $(BENCHDIR)/linker.ld $^ -ffreestanding -nostdlib -lgcc -g
+
+%.o: %.c ${HEADERS}
+	${CC} ${CFLAGS} -c $< -o $@
+
+clean:
+	rm -rf *.bin *.o *.elf
+	rm -rf *.o **/*.o
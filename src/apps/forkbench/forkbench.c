@@ -0,0 +1,76 @@
+#include <stdint.h>
+#include <include/cdefs.h>
+#include <libc/unistd.h>
+#include <libc/stdlib.h>
+#include <apps/bench/bench.h>
+
+/*
+  Fork latency benchmark
+  + fork: cycles spent in fork() (parent side) with small and large dirty heap, copy-on-write fork should not depend on heap size
+  + cow write: cycles per page when the parent writes to its heap after fork (first write to a shared page)
+*/
+
+#define FORK_ITERATIONS 32
+#define PAGE_SIZE 4096
+#define SMALL_HEAP_PAGES 1
+#define LARGE_HEAP_PAGES 256
+
+static char *alloc_dirty_heap(uint32_t pages)
+{
+  char *buf = calloc(pages, PAGE_SIZE);
+  for (uint32_t i = 0; i < pages; ++i)
+    buf[i * PAGE_SIZE] = i;
+  return buf;
+}
+
+static uint32_t bench_fork(uint32_t pages)
+{
+  char *buf = alloc_dirty_heap(pages);
+  uint64_t total = 0;
+
+  for (uint32_t i = 0; i < FORK_ITERATIONS; ++i)
+  {
+    uint64_t start = rdtsc();
+    int32_t pid = fork();
+    if (pid == 0)
+      exit(0);
+    total += rdtsc() - start;
+  }
+
+  while (waitpid(-1, NULL, 0) > 0)
+    ;
+  free(buf);
+  return total / FORK_ITERATIONS;
+}
+
+static uint32_t bench_cow_write(uint32_t pages)
+{
+  char *buf = alloc_dirty_heap(pages);
+  if (fork() == 0)
+    exit(0);
+
+  uint64_t start = rdtsc();
+  for (uint32_t i = 0; i < pages; ++i)
+    buf[i * PAGE_SIZE] = 0;
+  uint64_t total = rdtsc() - start;
+
+  waitpid(-1, NULL, 0);
+  free(buf);
+  return total / pages;
+}
+
+int main()
+{
+  uint32_t fork_small = bench_fork(SMALL_HEAP_PAGES);
+  uint32_t fork_large = bench_fork(LARGE_HEAP_PAGES);
+  uint32_t cow_write = bench_cow_write(LARGE_HEAP_PAGES);
+
+  struct bench_result results[] = {
+      {"fork 4KB: ", fork_small, " cycles"},
+      {"fork 1MB: ", fork_large, " cycles"},
+      {"cow write: ", cow_write, " cycles/page"},
+  };
+  show_results(results, 3);
+
+  return 0;
+}
@@ -0,0 +1,118 @@
+#include <stdint.h>
+#include <include/cdefs.h>
+#include <libc/unistd.h>
+#include <libc/stdlib.h>
+#include <apps/bench/bench.h>
+
+/*
+  Userspace malloc benchmark, every result is in cycles per call
+  + event churn: calloc/free of a small struct per event (what gui apps do in handle_mouse_event)
+  + mixed sizes: random 16 -> 1024 bytes blocks in a working set of live blocks
+  + realloc grow: a buffer growing by small steps (in-place growth should avoid copying)
+  + large block: malloc/free above mmap threshold
+*/
+
+#define EVENT_ITERATIONS 10000
+#define MIXED_SLOTS 256
+#define MIXED_ITERATIONS 20000
+#define REALLOC_STEP 64
+#define REALLOC_MAX (64 * 1024)
+#define LARGE_ITERATIONS 64
+#define LARGE_SIZE (256 * 1024)
+
+static uint32_t seed = 1;
+static uint32_t next_random()
+{
+  seed = seed * 1103515245 + 12345;
+  return seed >> 16;
+}
+
+static uint32_t bench_event_churn()
+{
+  // a few long-lived blocks in between, like window/ui structs
+  void *keep[16];
+  uint64_t start = rdtsc();
+  for (uint32_t i = 0; i < EVENT_ITERATIONS; ++i)
+  {
+    char *event = calloc(1, 32);
+    if (i % (EVENT_ITERATIONS / 16) == 0)
+      keep[i / (EVENT_ITERATIONS / 16)] = malloc(64);
+    free(event);
+  }
+  uint64_t total = rdtsc() - start;
+
+  for (uint32_t i = 0; i < 16; ++i)
+    free(keep[i]);
+  return total / EVENT_ITERATIONS;
+}
+
+static uint32_t bench_mixed_sizes()
+{
+  void **slots = calloc(MIXED_SLOTS, sizeof(void *));
+  uint64_t start = rdtsc();
+  for (uint32_t i = 0; i < MIXED_ITERATIONS; ++i)
+  {
+    uint32_t slot = next_random() % MIXED_SLOTS;
+    if (slots[slot])
+    {
+      free(slots[slot]);
+      slots[slot] = NULL;
+    }
+    else
+      slots[slot] = malloc(16 + next_random() % 1008);
+  }
+  uint64_t total = rdtsc() - start;
+
+  for (uint32_t i = 0; i < MIXED_SLOTS; ++i)
+    free(slots[i]);
+  free(slots);
+  return total / MIXED_ITERATIONS;
+}
+
+static uint32_t bench_realloc_grow()
+{
+  char *buf = NULL;
+  uint32_t calls = 0;
+  uint64_t start = rdtsc();
+  for (uint32_t size = REALLOC_STEP; size <= REALLOC_MAX; size += REALLOC_STEP, ++calls)
+  {
+    buf = realloc(buf, size);
+    buf[size - 1] = 0;
+  }
+  uint64_t total = rdtsc() - start;
+
+  free(buf);
+  return total / calls;
+}
+
+static uint32_t bench_large_block()
+{
+  uint64_t start = rdtsc();
+  for (uint32_t i = 0; i < LARGE_ITERATIONS; ++i)
+  {
+    char *buf = malloc(LARGE_SIZE);
+    buf[0] = 1;
+    free(buf);
+  }
+  uint64_t total = rdtsc() - start;
+
+  return total / LARGE_ITERATIONS;
+}
+
+int main()
+{
+  uint32_t event_churn = bench_event_churn();
+  uint32_t mixed_sizes = bench_mixed_sizes();
+  uint32_t realloc_grow = bench_realloc_grow();
+  uint32_t large_block = bench_large_block();
+
+  struct bench_result results[] = {
+      {"event churn: ", event_churn, " cycles"},
+      {"mixed sizes: ", mixed_sizes, " cycles"},
+      {"realloc grow: ", realloc_grow, " cycles"},
+      {"large block: ", large_block, " cycles"},
+  };
+  show_results(results, 4);
+
+  return 0;
+}
@@ -0,0 +1,87 @@
+#include <stdint.h>
+#include <include/cdefs.h>
+#include <libc/unistd.h>
+#include <libc/stdlib.h>
+#include <apps/bench/bench.h>
+
+/*
+  Parallel cpu-bound benchmark, the same amount of work is split between 1, 2 and 4 processes
+  + workers are forked, each one runs its share of chunks and reports back to parent by message queue
+  + speedup is time with 1 process / time with 4 processes (in %), close to 400% with 4 idle cpus
+  Run with qemu-system-i386 -smp 4, with one cpu every row takes about the same time
+*/
+
+#define WORK_CHUNKS 16
+#define CHUNK_ITERATIONS 4000000
+#define SMPBENCH_MQ "smpbench"
+#define SMPBENCH_MTYPE 1
+
+static volatile uint32_t checksum;
+
+// registers only, no shared memory traffic between cpus
+static uint32_t run_chunk(uint32_t seed)
+{
+  uint32_t x = seed;
+  for (uint32_t i = 0; i < CHUNK_ITERATIONS; ++i)
+    x = (x * 1103515245 + 12345) ^ (x >> 16);
+  return x;
+}
+
+static uint32_t run_share(uint32_t worker, uint32_t workers)
+{
+  uint32_t sum = 0;
+  for (uint32_t chunk = worker; chunk < WORK_CHUNKS; chunk += workers)
+    sum += run_chunk(chunk);
+  return sum;
+}
+
+static uint32_t bench_parallel(uint32_t workers)
+{
+  uint64_t start = rdtsc();
+
+  for (uint32_t i = 1; i < workers; ++i)
+  {
+    if (fork() == 0)
+    {
+      uint32_t sum = run_share(i, workers);
+      msgsnd(SMPBENCH_MQ, (char *)&sum, SMPBENCH_MTYPE, sizeof(sum));
+      exit(0);
+    }
+  }
+
+  uint32_t sum = run_share(0, workers);
+  for (uint32_t i = 1; i < workers; ++i)
+  {
+    uint32_t worker_sum = 0;
+    msgrcv(SMPBENCH_MQ, (char *)&worker_sum, SMPBENCH_MTYPE, sizeof(worker_sum));
+    sum += worker_sum;
+  }
+  checksum = sum;
+  uint64_t cycles = rdtsc() - start;
+
+  while (waitpid(-1, NULL, 0) > 0)
+    ;
+
+  // in millions of cycles
+  return cycles / 1000000;
+}
+
+int main()
+{
+  msgopen(SMPBENCH_MQ, 0);
+
+  uint32_t one = bench_parallel(1);
+  uint32_t two = bench_parallel(2);
+  uint32_t four = bench_parallel(4);
+  uint32_t speedup = four ? one * 100 / four : 0;
+
+  struct bench_result results[] = {
+      {"1 process: ", one, " Mcycles"},
+      {"2 processes: ", two, " Mcycles"},
+      {"4 processes: ", four, " Mcycles"},
+      {"speedup: ", speedup, "%"},
+  };
+  show_results(results, 4);
+
+  return 0;
+}
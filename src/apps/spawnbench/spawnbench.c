@@ -0,0 +1,101 @@
+#include <stdint.h>
+#include <include/cdefs.h>
+#include <include/fcntl.h>
+#include <include/mman.h>
+#include <libc/unistd.h>
+#include <libc/stdlib.h>
+#include <libc/sync.h>
+#include <apps/bench/bench.h>
+
+/*
+  Spawn latency benchmark, cycles from posix_spawn() in the parent until the child reaches main()
+  + the program spawns itself, parent and child find each other through a shared memory page
+  + ballast makes the binary as large as window server (fonts, images)
+  + demand: child never touches ballast -> with demand-loaded elf, latency doesn't grow with the size of the binary
+  + eager (baseline): child reads every ballast page before it reports, the whole binary is loaded like
+    the loader did before segments were demand-loaded
+*/
+
+#define SPAWN_ITERATIONS 16
+#define PAGE_SIZE 4096
+#define BALLAST_SIZE (512 * 1024)
+#define SPAWNBENCH_SHM "spawnbench"
+
+enum spawnbench_state
+{
+  SPAWNBENCH_IDLE,
+  SPAWNBENCH_DEMAND,
+  SPAWNBENCH_EAGER,
+};
+
+struct spawnbench_shared
+{
+  int32_t state;
+  uint64_t start;
+  uint64_t total;
+  struct semaphore done;
+};
+
+// initialized data is stored in the elf file
+static char ballast[BALLAST_SIZE] = {1};
+
+static struct spawnbench_shared *map_shared()
+{
+  int32_t fd = shm_open(SPAWNBENCH_SHM, O_RDWR | O_CREAT, 0);
+  // new shm page is zero-filled (idle), same size keeps the page of a running benchmark
+  ftruncate(fd, PAGE_SIZE);
+  return (struct spawnbench_shared *)mmap(NULL, PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd);
+}
+
+static void load_ballast()
+{
+  volatile char sum = 0;
+  for (uint32_t i = 0; i < BALLAST_SIZE; i += PAGE_SIZE)
+    sum += ballast[i];
+}
+
+static uint32_t bench_spawn(struct spawnbench_shared *shared, enum spawnbench_state mode)
+{
+  sem_init(&shared->done, 0);
+  shared->total = 0;
+  shared->state = mode;
+
+  for (uint32_t i = 0; i < SPAWN_ITERATIONS; ++i)
+  {
+    shared->start = rdtsc();
+    posix_spawn("/bin/spawnbench");
+    sem_wait(&shared->done);
+  }
+
+  shared->state = SPAWNBENCH_IDLE;
+  while (waitpid(-1, NULL, 0) > 0)
+    ;
+  return shared->total / SPAWN_ITERATIONS;
+}
+
+int main()
+{
+  struct spawnbench_shared *shared = map_shared();
+
+  // spawned by the benchmark, report and leave
+  if (shared->state != SPAWNBENCH_IDLE)
+  {
+    if (shared->state == SPAWNBENCH_EAGER)
+      load_ballast();
+    shared->total += rdtsc() - shared->start;
+    sem_post(&shared->done);
+    return 0;
+  }
+
+  uint32_t demand_cycles = bench_spawn(shared, SPAWNBENCH_DEMAND);
+  uint32_t eager_cycles = bench_spawn(shared, SPAWNBENCH_EAGER);
+
+  struct bench_result results[] = {
+      {"ballast: ", sizeof(ballast) / 1024, " KB"},
+      {"spawn demand: ", demand_cycles, " cycles"},
+      {"spawn eager: ", eager_cycles, " cycles"},
+  };
+  show_results(results, 3);
+
+  return 0;
+}
@@ -0,0 +1,49 @@
+#include <stdint.h>
+#include <include/cdefs.h>
+#include <libc/unistd.h>
+#include <libc/stdlib.h>
+#include <apps/bench/bench.h>
+
+/*
+  Null system call latency (getpid), every result is in cycles per call
+  + int 0x7F: generic interrupt path (isr_common_stub, iret)
+  + sysenter: fast path (sysenter_entry, sysexit), 0 when cpu doesn't support it
+*/
+
+#define SYSCALL_ITERATIONS 100000
+
+static uint32_t bench_int()
+{
+  uint64_t start = rdtsc();
+  for (uint32_t i = 0; i < SYSCALL_ITERATIONS; ++i)
+    __syscall_int(__NR_getpid, 0, 0, 0, 0, 0);
+  return (rdtsc() - start) / SYSCALL_ITERATIONS;
+}
+
+static uint32_t bench_sysenter()
+{
+  if (!__sysenter_probe())
+    return 0;
+
+  uint64_t start = rdtsc();
+  for (uint32_t i = 0; i < SYSCALL_ITERATIONS; ++i)
+    __syscall_sysenter(__NR_getpid, 0, 0, 0, 0);
+  return (rdtsc() - start) / SYSCALL_ITERATIONS;
+}
+
+int main()
+{
+  // warm up (page faults, caches)
+  syscall_getpid();
+
+  uint32_t int_cycles = bench_int();
+  uint32_t sysenter_cycles = bench_sysenter();
+
+  struct bench_result results[] = {
+      {"int 0x7F: ", int_cycles, " cycles"},
+      {"sysenter: ", sysenter_cycles, " cycles"},
+  };
+  show_results(results, 2);
+
+  return 0;
+}
@@ -357,6 +357,23 @@ struct icon *find_icon_from_mouse_position(int32_t px, int32_t py)
   return NULL;
 }
 
+// GUI apps are forked from zygote (warmed up), before zygote is up or for a too long path they are spawned from disk
+static void launch_program(char *path)
+{
+  uint32_t length = strlen(path);
+  if (length < ZYGOTE_PATH_LENGTH)
+  {
+    char *msg = calloc(ZYGOTE_PATH_LENGTH, sizeof(char));
+    memcpy(msg, path, length);
+    int32_t ret = msgsnd(ZYGOTE_MQ, msg, 0, ZYGOTE_PATH_LENGTH);
+    free(msg);
+    if (ret >= 0)
+      return;
+  }
+
+  posix_spawn(path);
+}
+
 void handle_mouse_event(struct msgui_event *event)
 {
   mouse_change(event);
@@ -381,7 +398,7 @@ void handle_mouse_event(struct msgui_event *event)
       if (icon)
       {
         if (icon->active)
-          posix_spawn(icon->exec_path);
+          launch_program(icon->exec_path);
         else
           icon->active = true;
       }
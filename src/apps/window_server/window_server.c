@@ -11,6 +11,9 @@ int main(struct framebuffer fb)
   init_layout(&fb);
   draw_layout();
 
+  // resident process which gui apps are forked from
+  posix_spawn(ZYGOTE_PATH);
+
   struct msgui *buf = calloc(1, sizeof(struct msgui));
   while (true)
   {
@@ -37,6 +40,10 @@ int main(struct framebuffer fb)
       handle_focus_event(focus);
       draw_layout();
     }
+
+    // spawned programs which have exited
+    while (waitpid(-1, NULL, WNOHANG) > 0)
+      ;
   }
 
   return 0;
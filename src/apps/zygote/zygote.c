@@ -0,0 +1,61 @@
+#include <stdint.h>
+#include <include/msgui.h>
+#include <libc/unistd.h>
+#include <libc/string.h>
+#include <libc/stdlib.h>
+#include <libc/gui/layout.h>
+
+/*
+  Zygote, resident process which launches GUI apps by fork instead of loading them from disk
+  + fonts are read and decoded once here, every child inherits them (copy-on-write)
+  + GUI apps are linked in (see Makefile), forked child calls app's main directly
+  + window server sends the path of double-clicked icon, program which is not linked in is spawned as usual
+  + children are never waited for, kernel releases them when they exit (nocldwait)
+  Child still creates its own window (window name comes from its pid), only that handshake is left at launch
+*/
+
+struct zygote_app
+{
+  const char *path;
+  int (*main)();
+};
+
+int calculator_main();
+int terminal_main();
+
+static struct zygote_app apps[] = {
+    {"/bin/calculator", calculator_main},
+    {"/bin/terminal", terminal_main},
+};
+
+static struct zygote_app *find_app(const char *path)
+{
+  for (uint32_t i = 0; i < sizeof(apps) / sizeof(apps[0]); ++i)
+  {
+    if (strcmp(apps[i].path, path) == 0)
+      return &apps[i];
+  }
+  return NULL;
+}
+
+int main()
+{
+  init_fonts();
+  nocldwait(true);
+  msgopen(ZYGOTE_MQ, 0);
+
+  char *path = calloc(ZYGOTE_PATH_LENGTH, sizeof(char));
+  while (true)
+  {
+    memset(path, 0, ZYGOTE_PATH_LENGTH);
+    msgrcv(ZYGOTE_MQ, path, 0, ZYGOTE_PATH_LENGTH);
+
+    struct zygote_app *app = find_app(path);
+    if (!app)
+      posix_spawn(path);
+    else if (fork() == 0)
+      exit(app->main());
+  }
+
+  return 0;
+}
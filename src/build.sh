@@ -66,8 +66,8 @@ then
 else
   if [ "$2" == "iso" ]
   then
-    sudo qemu-system-i386 -s -S -boot c -cdrom mos.iso -hda hdd.img -netdev tap,id=mynet0,ifname=tap0,script=no,downscript=no -device rtl8139,netdev=mynet0,mac=52:55:00:d1:55:01
+    sudo qemu-system-i386 -s -S -smp 4 -boot c -cdrom mos.iso -hda hdd.img -netdev tap,id=mynet0,ifname=tap0,script=no,downscript=no -device rtl8139,netdev=mynet0,mac=52:55:00:d1:55:01
   else
-    qemu-system-i386 -s -drive format=raw,file=mos.img,index=0,media=disk -d guest_errors,int
+    qemu-system-i386 -s -smp 4 -drive format=raw,file=mos.img,index=0,media=disk -d guest_errors,int
   fi
 fi
\ No newline at end of file
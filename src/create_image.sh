@@ -20,11 +20,29 @@ cd apps/terminal && make clean && make
 cd ../..
 cd apps/calculator && make clean && make
 cd ../..
+cd apps/forkbench && make clean && make
+cd ../..
+cd apps/mallocbench && make clean && make
+cd ../..
+cd apps/smpbench && make clean && make
+cd ../..
+cd apps/syscallbench && make clean && make
+cd ../..
+cd apps/spawnbench && make clean && make
+cd ../..
+cd apps/zygote && make clean && make
+cd ../..
 
 mkdir "/Volumes/${VOLUME_NAME}/bin"
 cp apps/window_server/window_server "/Volumes/${VOLUME_NAME}/bin"
 cp apps/terminal/terminal "/Volumes/${VOLUME_NAME}/bin"
 cp apps/calculator/calculator "/Volumes/${VOLUME_NAME}/bin"
+cp apps/forkbench/forkbench "/Volumes/${VOLUME_NAME}/bin"
+cp apps/mallocbench/mallocbench "/Volumes/${VOLUME_NAME}/bin"
+cp apps/smpbench/smpbench "/Volumes/${VOLUME_NAME}/bin"
+cp apps/syscallbench/syscallbench "/Volumes/${VOLUME_NAME}/bin"
+cp apps/spawnbench/spawnbench "/Volumes/${VOLUME_NAME}/bin"
+cp apps/zygote/zygote "/Volumes/${VOLUME_NAME}/bin"
 
 mkdir "/Volumes/${VOLUME_NAME}/etc"
 cp apps/window_server/desktop.ini "/Volumes/${VOLUME_NAME}/etc"
@@ -17,6 +17,8 @@ typedef unsigned int pid_t;
 typedef unsigned int tid_t;
 typedef unsigned int uid_t;
 typedef unsigned int gid_t;
+typedef long time_t;
+typedef int clockid_t;
 
 #define isspace(c) ((c) == ' ' || ((c) >= '\t' && (c) <= '\r'))
 #define isupper(c) ((c) >= 'A' && (c) <= 'Z')
@@ -0,0 +1,7 @@
+#ifndef INCLUDE_FUTEX_H
+#define INCLUDE_FUTEX_H
+
+#define FUTEX_WAIT 0 /* sleep if *addr == val */
+#define FUTEX_WAKE 1 /* wake up to val threads sleeping on addr */
+
+#endif
@@ -6,6 +6,10 @@
 // NOTE: MQ 2020-03-21 window name's length is 6, plus the null-terminated '\0'
 #define WINDOW_NAME_LENGTH 7
 #define WINDOW_SERVER_SHM "/dev/shm/window_server"
+// window server sends the path of a program to launch (fixed size message) to zygote
+#define ZYGOTE_MQ "zygote"
+#define ZYGOTE_PATH "/bin/zygote"
+#define ZYGOTE_PATH_LENGTH 64
 
 #define MOUSE_LEFT_CLICK 0x01
 #define MOUSE_RIGHT_CLICK 0x02
@@ -0,0 +1,28 @@
+#ifndef INCLUDE_VDSO_H
+#define INCLUDE_VDSO_H
+
+#include <stdint.h>
+
+/*
+  Kernel maintained pages which are mapped read-only into every process, userspace reads them without trapping
+    VDSO_TIME_ADDRESS: one frame shared by all processes, updated on every pit tick
+    VDSO_PROCESS_ADDRESS: one frame per process
+  Both are right below the page for page faults, mmap never hands out addresses from VDSO_TIME_ADDRESS up
+*/
+#define VDSO_TIME_ADDRESS 0xBFFFD000
+#define VDSO_PROCESS_ADDRESS 0xBFFFE000
+
+// seq is odd while the kernel is writing, readers retry if it is odd or has changed
+struct vdso_time
+{
+  volatile uint32_t seq;
+  uint32_t monotonic_ms;
+  uint32_t realtime_seconds;
+};
+
+struct vdso_process
+{
+  int32_t pid;
+};
+
+#endif
@@ -0,0 +1,8 @@
+#ifndef INCLUDE_WAIT_H
+#define INCLUDE_WAIT_H
+
+#define WNOHANG 0x1 /* return 0 instead of blocking when no child has exited yet */
+
+#define WEXITSTATUS(status) (((status)&0xff00) >> 8)
+
+#endif
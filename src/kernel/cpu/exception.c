@@ -2,6 +2,7 @@
 #include <kernel/utils/printf.h>
 #include <kernel/cpu/hal.h>
 #include <kernel/cpu/idt.h>
+#include "fpu.h"
 #include "exception.h"
 
 int32_t divide_by_zero_fault(struct interrupt_registers *regs)
@@ -46,16 +47,20 @@ int32_t invalid_opcode_fault(struct interrupt_registers *regs)
 	return IRQ_HANDLER_STOP;
 }
 
+// cr0.TS is set -> fpu registers belong to another thread (lazy fpu switching)
 int32_t no_device_fault(struct interrupt_registers *regs)
 {
-	kernel_panic("Device not found");
+	if (!RETURNS_TO_USER(regs))
+		kernel_panic("FPU used in kernel outside kernel_fpu_begin");
+
+	fpu_restore_current();
 	return IRQ_HANDLER_STOP;
 }
 
-int32_t double_fault_abort(struct interrupt_registers *regs)
+// entered by task switch (vector 8 is a task gate), there is no frame to return to
+void double_fault_task()
 {
-	kernel_panic("Double fault");
-	return IRQ_HANDLER_STOP;
+	kernel_panic("Double fault (kernel stack overflow?)");
 }
 
 int32_t invalid_tss_fault(struct interrupt_registers *regs)
@@ -177,7 +182,6 @@ void exception_init()
 	register_interrupt_handler(5, (I86_IRQ_HANDLER)bounds_check_fault);
 	register_interrupt_handler(6, (I86_IRQ_HANDLER)invalid_opcode_fault);
 	register_interrupt_handler(7, (I86_IRQ_HANDLER)no_device_fault);
-	register_interrupt_handler(8, (I86_IRQ_HANDLER)double_fault_abort);
 	register_interrupt_handler(10, (I86_IRQ_HANDLER)invalid_tss_fault);
 	register_interrupt_handler(11, (I86_IRQ_HANDLER)no_segment_fault);
 	register_interrupt_handler(12, (I86_IRQ_HANDLER)stack_fault);
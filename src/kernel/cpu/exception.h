@@ -13,7 +13,7 @@ int32_t overflow_trap(struct interrupt_registers *regs);
 int32_t bounds_check_fault(struct interrupt_registers *regs);
 int32_t invalid_opcode_fault(struct interrupt_registers *regs);
 int32_t no_device_fault(struct interrupt_registers *regs);
-int32_t double_fault_abort(struct interrupt_registers *regs);
+void double_fault_task();
 int32_t invalid_tss_fault(struct interrupt_registers *regs);
 int32_t no_segment_fault(struct interrupt_registers *regs);
 int32_t stack_fault(struct interrupt_registers *regs);
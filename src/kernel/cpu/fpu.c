@@ -0,0 +1,212 @@
+#include <include/errno.h>
+#include <kernel/locking/kernel_lock.h>
+#include <kernel/memory/vmm.h>
+#include <kernel/proc/task.h>
+#include <kernel/utils/string.h>
+#include "exception.h"
+#include "hal.h"
+#include "smp.h"
+#include "fpu.h"
+
+/*
+  Lazy fpu/sse context, a thread which never touches fpu doesn't pay anything on context switch
+  + cr0.TS is set while registers don't belong to the running thread -> first fpu/sse instruction traps (#NM)
+  + #NM allocates the thread's fxsave area (first use) or restores it, the thread owns registers of the cpu
+    until it is switched out, only then its state is saved (thread can continue on another cpu)
+  + when the thread comes back to the same cpu and nobody used fpu there in between, restore is skipped
+  Kernel code only uses fpu/sse between kernel_fpu_begin/kernel_fpu_end, never in irq handlers
+*/
+
+#define CR0_MP 0x2
+#define CR0_EM 0x4
+#define CR0_TS 0x8
+#define CR0_NE 0x20
+#define CR4_OSFXSR 0x200
+#define CR4_OSXMMEXCPT 0x400
+#define CPUID_FXSR (1 << 24)
+#define CPUID_SSE (1 << 25)
+#define MXCSR_DEFAULT 0x1F80 /* every exception masked, round to nearest */
+
+static struct kmem_cache *fpu_cache;
+static bool has_fxsr, has_sse;
+
+static _inline uint32_t read_cr0()
+{
+  uint32_t cr0;
+  __asm__ __volatile__("mov %%cr0, %0"
+                       : "=r"(cr0));
+  return cr0;
+}
+
+static _inline void write_cr0(uint32_t cr0)
+{
+  __asm__ __volatile__("mov %0, %%cr0" ::"r"(cr0));
+}
+
+static _inline void clts()
+{
+  __asm__ __volatile__("clts");
+}
+
+static _inline void stts()
+{
+  write_cr0(read_cr0() | CR0_TS);
+}
+
+static void fpu_save(struct fpu_state *state)
+{
+  if (has_fxsr)
+    __asm__ __volatile__("fxsave (%0)" ::"r"(state)
+                         : "memory");
+  else
+    __asm__ __volatile__("fnsave (%0)" ::"r"(state)
+                         : "memory");
+}
+
+static void fpu_load(struct fpu_state *state)
+{
+  if (has_fxsr)
+    __asm__ __volatile__("fxrstor (%0)" ::"r"(state)
+                         : "memory");
+  else
+    __asm__ __volatile__("frstor (%0)" ::"r"(state)
+                         : "memory");
+}
+
+static void fpu_reset()
+{
+  __asm__ __volatile__("fninit");
+  if (has_sse)
+  {
+    uint32_t mxcsr = MXCSR_DEFAULT;
+    __asm__ __volatile__("ldmxcsr %0" ::"m"(mxcsr));
+  }
+}
+
+// #NM, cr0.TS is set and current thread uses fpu/sse
+void fpu_restore_current()
+{
+  struct cpu *cpu = this_cpu();
+  struct thread *t = cpu->thread;
+
+  clts();
+  if (!t->fpu)
+  {
+    // user thread traps without kernel lock
+    lock_kernel();
+    t->fpu = kmem_cache_alloc(fpu_cache);
+    // no memory for the fpu state, thread can't continue (do_exit doesn't return)
+    if (!t->fpu)
+    {
+      stts();
+      do_exit(-ENOMEM);
+    }
+    unlock_kernel();
+    fpu_reset();
+  }
+  else if (cpu->fpu_last != t || t->fpu_cpu != cpu->id)
+    fpu_load(t->fpu);
+
+  cpu->fpu_owner = t;
+}
+
+// sched_lock is held
+void fpu_switch_out(struct thread *pt)
+{
+  struct cpu *cpu = this_cpu();
+  if (cpu->fpu_owner != pt)
+    return;
+
+  fpu_save(pt->fpu);
+  // fnsave resets registers, they don't hold the state anymore
+  cpu->fpu_last = has_fxsr ? pt : NULL;
+  pt->fpu_cpu = cpu->id;
+  cpu->fpu_owner = NULL;
+  stts();
+}
+
+// -ENOMEM when there is no memory for the child's copy
+int32_t fpu_fork(struct thread *parent, struct thread *child)
+{
+  if (!parent->fpu)
+    return 0;
+
+  struct cpu *cpu = this_cpu();
+  if (cpu->fpu_owner == parent)
+  {
+    fpu_save(parent->fpu);
+    if (!has_fxsr)
+      fpu_load(parent->fpu);
+  }
+
+  child->fpu = kmem_cache_alloc(fpu_cache);
+  if (!child->fpu)
+    return -ENOMEM;
+  memcpy(child->fpu, parent->fpu, sizeof(struct fpu_state));
+  return 0;
+}
+
+// Reaped thread doesn't run anywhere, a cpu can still remember it as the last state it saved
+// (a new thread at the same address would skip its restore), clearing it only costs that cpu one restore
+void fpu_release(struct thread *t)
+{
+  for (uint32_t i = 0; i < nr_cpus; ++i)
+  {
+    if (cpus[i].fpu_last == t)
+      cpus[i].fpu_last = NULL;
+  }
+
+  if (t->fpu)
+    kmem_cache_free(fpu_cache, t->fpu);
+  t->fpu = NULL;
+}
+
+void kernel_fpu_begin()
+{
+  struct cpu *cpu = this_cpu();
+
+  if (cpu->fpu_owner)
+  {
+    fpu_save(cpu->fpu_owner->fpu);
+    cpu->fpu_owner = NULL;
+  }
+  cpu->fpu_last = NULL;
+  clts();
+  fpu_reset();
+}
+
+void kernel_fpu_end()
+{
+  stts();
+}
+
+void fpu_init_cpu()
+{
+  uint32_t cr0 = read_cr0();
+  cr0 &= ~CR0_EM;
+  cr0 |= CR0_MP | CR0_NE;
+  write_cr0(cr0);
+
+  if (has_fxsr)
+  {
+    uint32_t cr4;
+    __asm__ __volatile__("mov %%cr4, %0"
+                         : "=r"(cr4));
+    cr4 |= CR4_OSFXSR | (has_sse ? CR4_OSXMMEXCPT : 0);
+    __asm__ __volatile__("mov %0, %%cr4" ::"r"(cr4));
+  }
+
+  fpu_reset();
+  stts();
+}
+
+void fpu_init()
+{
+  uint32_t eax, edx;
+  cpuid(1, &eax, &edx);
+  has_fxsr = edx & CPUID_FXSR;
+  has_sse = has_fxsr && (edx & CPUID_SSE);
+
+  fpu_cache = kmem_cache_create("fpu_state", sizeof(struct fpu_state), 16);
+  fpu_init_cpu();
+}
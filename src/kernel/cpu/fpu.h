@@ -0,0 +1,25 @@
+#ifndef CPU_FPU_H
+#define CPU_FPU_H
+
+#include <stdint.h>
+
+#define FPU_STATE_SIZE 512
+
+struct thread;
+
+// fxsave area, old fnsave format (108 bytes) fits in it too
+struct fpu_state
+{
+  uint8_t data[FPU_STATE_SIZE];
+} __attribute__((aligned(16)));
+
+void fpu_init();
+void fpu_init_cpu();
+void fpu_restore_current();
+void fpu_switch_out(struct thread *pt);
+int32_t fpu_fork(struct thread *parent, struct thread *child);
+void fpu_release(struct thread *t);
+void kernel_fpu_begin();
+void kernel_fpu_end();
+
+#endif
@@ -1,12 +1,10 @@
 #include <kernel/utils/string.h>
 #include "gdt.h"
+#include "smp.h"
 
 extern void gdt_flush(uint32_t);
 
-static struct gdt_descriptor _gdt[MAX_DESCRIPTORS];
-static struct gdtr _gdtr;
-
-void gdt_set_descriptor(uint32_t i, uint64_t base, uint64_t limit, uint8_t access, uint8_t grand)
+static void gdt_set_entry(struct gdt_descriptor *_gdt, uint32_t i, uint64_t base, uint64_t limit, uint8_t access, uint8_t grand)
 {
   if (i > MAX_DESCRIPTORS)
     return;
@@ -26,35 +24,57 @@ void gdt_set_descriptor(uint32_t i, uint64_t base, uint64_t limit, uint8_t acces
   _gdt[i].grand |= grand & 0xf0;
 }
 
-void gdt_init()
+// Each cpu has its own gdt (only tss and per-cpu descriptors are different)
+void gdt_set_descriptor(uint32_t i, uint64_t base, uint64_t limit, uint8_t access, uint8_t grand)
+{
+  gdt_set_entry(this_cpu()->gdt, i, base, limit, access, grand);
+}
+
+void gdt_init_cpu(struct cpu *cpu)
 {
-  _gdtr.limit = (sizeof(struct gdt_descriptor) * MAX_DESCRIPTORS) - 1;
-  _gdtr.base = (uint32_t)&_gdt[0];
+  struct gdt_descriptor *_gdt = cpu->gdt;
+  struct gdtr *_gdtr = &cpu->gdtr;
+
+  cpu->self = cpu;
+  _gdtr->limit = (sizeof(struct gdt_descriptor) * MAX_DESCRIPTORS) - 1;
+  _gdtr->base = (uint32_t)&_gdt[0];
 
   //! set null descriptor
-  gdt_set_descriptor(0, 0, 0, 0, 0);
+  gdt_set_entry(_gdt, 0, 0, 0, 0, 0);
 
   //! set default code descriptor
-  gdt_set_descriptor(1, 0, 0xffffffff,
-                     I86_GDT_DESC_READWRITE | I86_GDT_DESC_EXEC_CODE | I86_GDT_DESC_CODEDATA | I86_GDT_DESC_MEMORY,
-                     I86_GDT_GRAND_4K | I86_GDT_GRAND_32BIT | I86_GDT_GRAND_LIMITHI_MASK);
+  gdt_set_entry(_gdt, 1, 0, 0xffffffff,
+                I86_GDT_DESC_READWRITE | I86_GDT_DESC_EXEC_CODE | I86_GDT_DESC_CODEDATA | I86_GDT_DESC_MEMORY,
+                I86_GDT_GRAND_4K | I86_GDT_GRAND_32BIT | I86_GDT_GRAND_LIMITHI_MASK);
 
   //! set default data descriptor
-  gdt_set_descriptor(2, 0, 0xffffffff,
-                     I86_GDT_DESC_READWRITE | I86_GDT_DESC_CODEDATA | I86_GDT_DESC_MEMORY,
-                     I86_GDT_GRAND_4K | I86_GDT_GRAND_32BIT | I86_GDT_GRAND_LIMITHI_MASK);
+  gdt_set_entry(_gdt, 2, 0, 0xffffffff,
+                I86_GDT_DESC_READWRITE | I86_GDT_DESC_CODEDATA | I86_GDT_DESC_MEMORY,
+                I86_GDT_GRAND_4K | I86_GDT_GRAND_32BIT | I86_GDT_GRAND_LIMITHI_MASK);
 
   //! set default user mode code descriptor
-  gdt_set_descriptor(3, 0, 0xffffffff,
-                     I86_GDT_DESC_READWRITE | I86_GDT_DESC_EXEC_CODE | I86_GDT_DESC_CODEDATA |
-                         I86_GDT_DESC_MEMORY | I86_GDT_DESC_DPL,
-                     I86_GDT_GRAND_4K | I86_GDT_GRAND_32BIT | I86_GDT_GRAND_LIMITHI_MASK);
+  gdt_set_entry(_gdt, 3, 0, 0xffffffff,
+                I86_GDT_DESC_READWRITE | I86_GDT_DESC_EXEC_CODE | I86_GDT_DESC_CODEDATA |
+                    I86_GDT_DESC_MEMORY | I86_GDT_DESC_DPL,
+                I86_GDT_GRAND_4K | I86_GDT_GRAND_32BIT | I86_GDT_GRAND_LIMITHI_MASK);
 
   //! set default user mode data descriptor
-  gdt_set_descriptor(4, 0, 0xffffffff,
-                     I86_GDT_DESC_READWRITE | I86_GDT_DESC_CODEDATA | I86_GDT_DESC_MEMORY |
-                         I86_GDT_DESC_DPL,
-                     I86_GDT_GRAND_4K | I86_GDT_GRAND_32BIT | I86_GDT_GRAND_LIMITHI_MASK);
+  gdt_set_entry(_gdt, 4, 0, 0xffffffff,
+                I86_GDT_DESC_READWRITE | I86_GDT_DESC_CODEDATA | I86_GDT_DESC_MEMORY |
+                    I86_GDT_DESC_DPL,
+                I86_GDT_GRAND_4K | I86_GDT_GRAND_32BIT | I86_GDT_GRAND_LIMITHI_MASK);
+
+  //! set per-cpu data descriptor (gs)
+  gdt_set_entry(_gdt, 6, (uint32_t)cpu, sizeof(struct cpu) - 1,
+                I86_GDT_DESC_READWRITE | I86_GDT_DESC_CODEDATA | I86_GDT_DESC_MEMORY,
+                I86_GDT_GRAND_32BIT);
 
-  gdt_flush((uint32_t)&_gdtr);
+  gdt_flush((uint32_t)_gdtr);
+
+  __asm__ __volatile__("mov %0, %%gs" ::"r"(PERCPU_SELECTOR));
+}
+
+void gdt_init()
+{
+  gdt_init_cpu(&cpus[0]);
 }
\ No newline at end of file
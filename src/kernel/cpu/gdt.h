@@ -4,7 +4,7 @@
 #include <stdint.h>
 
 //! maximum amount of descriptors allowed
-#define MAX_DESCRIPTORS 6
+#define MAX_DESCRIPTORS 8
 
 /***	 gdt descriptor access bit flags.	***/
 
@@ -68,7 +68,10 @@ struct __attribute__((packed)) gdtr
   uint32_t base;
 };
 
+struct cpu;
+
 void gdt_init();
+void gdt_init_cpu(struct cpu *cpu);
 void gdt_set_descriptor(uint32_t i, uint64_t base, uint64_t limit, uint8_t access, uint8_t grand);
 
 #endif
\ No newline at end of file
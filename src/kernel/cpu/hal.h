@@ -27,11 +27,48 @@ static _inline void disable_interrupts()
   __asm__ __volatile__("cli");
 }
 
+//! disable interrupts and return previous eflags (for nested critical sections)
+static _inline uint32_t irq_save()
+{
+  uint32_t flags;
+  __asm__ __volatile__("pushf   \n"
+                       "pop %0  \n"
+                       "cli     \n"
+                       : "=r"(flags)::"memory");
+  return flags;
+}
+
+//! enable interrupts only if they were enabled before irq_save
+static _inline void irq_restore(uint32_t flags)
+{
+  if (flags & 0x200)
+    enable_interrupts();
+}
+
 static _inline void halt()
 {
   __asm__ __volatile__("hlt");
 }
 
+// drops every non-global tlb entry (user space) of the local cpu
+static _inline void flush_tlb_local()
+{
+  uint32_t cr3;
+  __asm__ __volatile__("mov %%cr3, %0\n"
+                       "mov %0, %%cr3"
+                       : "=r"(cr3)
+                       :
+                       : "memory");
+}
+
+static _inline uint64_t rdtsc()
+{
+  uint32_t lo, hi;
+  __asm__ __volatile__("rdtsc"
+                       : "=a"(lo), "=d"(hi));
+  return ((uint64_t)hi << 32) | lo;
+}
+
 static _inline unsigned char inportb(unsigned short _port)
 {
   unsigned char rv;
@@ -111,6 +148,20 @@ static _inline void outportsw(uint16_t portid, const void *addr, size_t count)
                        : "d"(portid));
 }
 
+static _inline uint64_t rdmsr(uint32_t msr)
+{
+  uint32_t lo, hi;
+  __asm__ __volatile__("rdmsr"
+                       : "=a"(lo), "=d"(hi)
+                       : "c"(msr));
+  return ((uint64_t)hi << 32) | lo;
+}
+
+static _inline void wrmsr(uint32_t msr, uint64_t value)
+{
+  __asm__ __volatile__("wrmsr" ::"c"(msr), "a"((uint32_t)value), "d"((uint32_t)(value >> 32)));
+}
+
 void cpuid(int code, uint32_t *a, uint32_t *d);
 const char *get_cpu_vender();
 
@@ -2,7 +2,11 @@
 #include <kernel/utils/printf.h>
 #include <kernel/utils/string.h>
 #include <kernel/memory/vmm.h>
+#include <kernel/locking/kernel_lock.h>
+#include <kernel/proc/softirq.h>
+#include <kernel/proc/task.h>
 #include "idt.h"
+#include "lapic.h"
 #include "pic.h"
 
 extern void idt_flush(uint32_t);
@@ -75,7 +79,8 @@ void idt_init()
   setvect(5, (I86_IVT)isr5);
   setvect(6, (I86_IVT)isr6);
   setvect(7, (I86_IVT)isr7);
-  setvect(8, (I86_IVT)isr8);
+  // task gate, cpu switches to the double fault TSS of this cpu (own stack, see install_double_fault_tss)
+  idt_install_ir(8, I86_IDT_DESC_PRESENT | I86_IDT_DESC_TASK, DOUBLE_FAULT_TSS_SELECTOR, 0);
   setvect(9, (I86_IVT)isr9);
   setvect(10, (I86_IVT)isr10);
   setvect(11, (I86_IVT)isr11);
@@ -117,6 +122,10 @@ void idt_init()
   setvect(45, (I86_IVT)irq13);
   setvect(46, (I86_IVT)irq14);
   setvect(47, (I86_IVT)irq15);
+  setvect(48, (I86_IVT)irq16);
+  setvect(49, (I86_IVT)irq17);
+  setvect(50, (I86_IVT)irq18);
+  setvect(LAPIC_SPURIOUS_VECTOR, (I86_IVT)irq_spurious);
 
   setvect_flags(DISPATCHER_ISR, (I86_IVT)isr127, I86_IDT_DESC_RING3);
 
@@ -152,16 +161,39 @@ void handle_interrupt(struct interrupt_registers *regs)
   }
 }
 
+// Thread which used its slice is switched out only when it goes back to user mode
 void isr_handler(struct interrupt_registers *reg)
 {
   handle_interrupt(reg);
+
+  if (RETURNS_TO_USER(reg))
+    preempt_schedule();
 }
 
 void irq_handler(struct interrupt_registers *reg)
 {
+  // Local apic irqs (timer, ipis) don't touch single-cpu code, device irqs run under kernel lock
+  if (reg->int_no >= IRQ16)
+  {
+    handle_interrupt(reg);
+    lapic_eoi();
+    do_softirq();
+
+    if (RETURNS_TO_USER(reg))
+      preempt_schedule();
+    return;
+  }
+
+  lock_kernel();
   handle_interrupt(reg);
+  unlock_kernel();
 
   if (reg->int_no >= 40)
     outportb(PIC2_COMMAND, PIC_EOI);
   outportb(PIC1_COMMAND, PIC_EOI);
+  // Bottom halves run after eoi with interrupts enabled, next irqs are not held back
+  do_softirq();
+
+  if (RETURNS_TO_USER(reg))
+    preempt_schedule();
 }
\ No newline at end of file
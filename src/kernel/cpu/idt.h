@@ -10,12 +10,14 @@
 //! must be in the format 0D110, where D is descriptor type
 #define I86_IDT_DESC_BIT16 0x06   //00000110
 #define I86_IDT_DESC_BIT32 0x0E   //00001110
+#define I86_IDT_DESC_TASK 0x05    //00000101
 #define I86_IDT_DESC_RING1 0x40   //01000000
 #define I86_IDT_DESC_RING2 0x20   //00100000
 #define I86_IDT_DESC_RING3 0x60   //01100000
 #define I86_IDT_DESC_PRESENT 0x80 //10000000
 
 #define DISPATCHER_ISR 0x7F
+#define DOUBLE_FAULT_TSS_SELECTOR 0x38
 
 struct __attribute__((packed)) idt_descriptor
 {
@@ -44,12 +46,16 @@ struct __attribute__((packed)) interrupt_registers
   uint32_t eip, cs, eflags, useresp, ss;           // Pushed by the processor automatically.
 };
 
+// interrupted code runs in ring 3 (user code segment)
+#define RETURNS_TO_USER(reg) ((reg)->cs == 0x1B)
+
 #define IRQ_HANDLER_CONTINUE 0
 #define IRQ_HANDLER_STOP 1
 typedef void (*I86_IVT)(struct interrupt_registers *regs);
 typedef int32_t (*I86_IRQ_HANDLER)(struct interrupt_registers *registers);
 
 void idt_init();
+void idt_load();
 void setvect(uint32_t i, I86_IVT irq);
 void setvect_flags(uint32_t i, I86_IVT irq, uint32_t flags);
 void register_interrupt_handler(uint32_t n, I86_IRQ_HANDLER handler);
@@ -106,6 +112,10 @@ extern void irq12();
 extern void irq13();
 extern void irq14();
 extern void irq15();
+extern void irq16();
+extern void irq17();
+extern void irq18();
+extern void irq_spurious();
 
 #define IRQ0 32
 #define IRQ1 33
@@ -123,6 +133,9 @@ extern void irq15();
 #define IRQ13 45
 #define IRQ14 46
 #define IRQ15 47
+#define IRQ16 48
+#define IRQ17 49
+#define IRQ18 50
 
 void isr_handler(struct interrupt_registers *);
 void irq_handler(struct interrupt_registers *);
@@ -1,5 +1,6 @@
 [extern isr_handler]
 [extern irq_handler]
+[extern sysenter_handler]
 
 ; Common ISR code
 isr_common_stub:
@@ -15,6 +16,7 @@ isr_common_stub:
     mov ds, ax
     mov es, ax
     mov fs, ax
+    mov ax, 0x30  ; per-cpu data segment descriptor (struct cpu)
     mov gs, ax
     ; 2. Call C handler
     cld ; C code following the sysV ABI requires DF to be clear on function entry
@@ -33,6 +35,50 @@ isr_common_stub:
     sti
     iret ; pops 5 things at once: CS, EIP, EFLAGS, SS, and ESP
 
+; sysenter fast path, interrupts are disabled, cs/ss are kernel's (msr), esp is SYSENTER_ESP
+[global sysenter_entry]
+sysenter_entry:
+    mov esp, [esp] ; SYSENTER_ESP points at tss.esp0 of this cpu -> current thread's kernel stack
+
+    ; same frame as int 0x7F (interrupt_registers), user memory is never touched
+    push dword 0x23 ; ss
+    push ecx        ; user esp
+    push dword 0x202 ; eflags, sysenter cleared IF
+    push dword 0x1B ; cs
+    push edx        ; eip, libc passes its return address
+    push dword 0    ; error code
+    push dword 0x7F ; DISPATCHER_ISR
+
+    ; arg2/arg3 come in ebp/edi, move them where int 0x7F has them (at most four arguments)
+    mov ecx, ebp
+    mov edx, edi
+    xor edi, edi
+    pusha
+
+    ; user ds/es/fs are flat as kernel's, only gs (per-cpu data) is reloaded
+    push ds
+    push es
+    push fs
+    push gs
+    mov ax, 0x30
+    mov gs, ax
+
+    cld
+    push esp
+    call sysenter_handler
+    add esp, 4
+
+    pop gs
+    add esp, 12
+    popa
+    add esp, 8
+
+    ; sysexit jumps to edx with esp = ecx in ring 3
+    mov edx, [esp]
+    mov ecx, [esp + 12]
+    sti
+    sysexit
+
 ; Common IRQ code. Identical to ISR code except for the 'call' 
 ; and the 'pop ebx'
 irq_common_stub:
@@ -47,6 +93,7 @@ irq_common_stub:
     mov ds, ax
     mov es, ax
     mov fs, ax
+    mov ax, 0x30
     mov gs, ax
 
     cld
@@ -122,6 +169,10 @@ irq_common_stub:
 [global irq13]
 [global irq14]
 [global irq15]
+[global irq16]
+[global irq17]
+[global irq18]
+[global irq_spurious]
 
 ; 0: Divide By Zero Exception
 isr0:
@@ -394,3 +445,24 @@ irq15:
     push byte 15
     push byte 47
     jmp irq_common_stub
+
+; Local apic timer, eoi goes to local apic instead of pic
+irq16:
+    push byte 16
+    push byte 48
+    jmp irq_common_stub
+
+; Inter-processor interrupts (reschedule, tlb shootdown)
+irq17:
+    push byte 17
+    push byte 49
+    jmp irq_common_stub
+
+irq18:
+    push byte 18
+    push byte 50
+    jmp irq_common_stub
+
+; Spurious interrupt from local apic doesn't need eoi
+irq_spurious:
+    iret
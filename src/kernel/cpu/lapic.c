@@ -0,0 +1,174 @@
+#include <kernel/memory/vmm.h>
+#include "hal.h"
+#include "idt.h"
+#include "pit.h"
+#include "lapic.h"
+
+/*
+  Local apic timer, only used in one-shot mode (pit is still the periodic tick)
+  + bus frequency is unknown -> count how many lapic ticks pass in LAPIC_CALIBRATE_MS pit ticks
+  + one-shot fires once when current count reaches 0, reading current count tells how long cpu has been idle
+  Registers are memory mapped (4KB), uncached at LAPIC_VADDR in device drivers area
+*/
+
+#define LAPIC_VADDR 0xE8000000
+#define IA32_APIC_BASE_MSR 0x1B
+#define IA32_APIC_BASE_ENABLE 0x800
+#define CPUID_FEAT_EDX_APIC (1 << 9)
+
+#define LAPIC_REG_ID 0x020
+#define LAPIC_REG_TPR 0x080
+#define LAPIC_REG_EOI 0x0B0
+#define LAPIC_REG_SVR 0x0F0
+#define LAPIC_REG_ICR_LOW 0x300
+#define LAPIC_REG_ICR_HIGH 0x310
+#define LAPIC_REG_LVT_TIMER 0x320
+#define LAPIC_REG_TIMER_INITIAL 0x380
+#define LAPIC_REG_TIMER_CURRENT 0x390
+#define LAPIC_REG_TIMER_DIVIDE 0x3E0
+
+#define LAPIC_SVR_ENABLE 0x100
+#define LAPIC_LVT_MASKED 0x10000
+#define LAPIC_TIMER_DIVIDE_16 0x3
+#define LAPIC_CALIBRATE_MS 10
+
+#define LAPIC_ICR_INIT 0x500
+#define LAPIC_ICR_STARTUP 0x600
+#define LAPIC_ICR_DELIVERY_PENDING 0x1000
+#define LAPIC_ICR_ASSERT 0x4000
+#define LAPIC_ICR_LEVEL 0x8000
+
+static bool lapic_enabled = false;
+static uint32_t ticks_per_ms = 0;
+static uint32_t timer_initial = 0;
+
+static inline uint32_t lapic_read(uint32_t reg)
+{
+  return *(volatile uint32_t *)(LAPIC_VADDR + reg);
+}
+
+static inline void lapic_write(uint32_t reg, uint32_t value)
+{
+  *(volatile uint32_t *)(LAPIC_VADDR + reg) = value;
+}
+
+void lapic_eoi()
+{
+  lapic_write(LAPIC_REG_EOI, 0);
+}
+
+uint32_t lapic_id()
+{
+  return lapic_read(LAPIC_REG_ID) >> 24;
+}
+
+// Inter-processor interrupt, destination is a local apic id
+static void lapic_send_icr(uint32_t apic_id, uint32_t icr)
+{
+  lapic_write(LAPIC_REG_ICR_HIGH, apic_id << 24);
+  lapic_write(LAPIC_REG_ICR_LOW, icr);
+
+  while (lapic_read(LAPIC_REG_ICR_LOW) & LAPIC_ICR_DELIVERY_PENDING)
+    ;
+}
+
+void lapic_send_ipi(uint32_t apic_id, uint32_t vector)
+{
+  lapic_send_icr(apic_id, vector);
+}
+
+void lapic_send_init(uint32_t apic_id)
+{
+  lapic_send_icr(apic_id, LAPIC_ICR_INIT | LAPIC_ICR_ASSERT | LAPIC_ICR_LEVEL);
+}
+
+// ap starts in real mode at page << 12
+void lapic_send_startup(uint32_t apic_id, uint32_t page)
+{
+  lapic_send_icr(apic_id, LAPIC_ICR_STARTUP | LAPIC_ICR_ASSERT | (page & 0xff));
+}
+
+bool lapic_available()
+{
+  return lapic_enabled;
+}
+
+bool lapic_timer_available()
+{
+  return ticks_per_ms != 0;
+}
+
+void lapic_timer_oneshot(uint32_t us)
+{
+  uint64_t count = (uint64_t)us * ticks_per_ms / 1000;
+  if (count > UINT32_MAX)
+    count = UINT32_MAX;
+  else if (count == 0)
+    count = 1;
+
+  timer_initial = count;
+  lapic_write(LAPIC_REG_LVT_TIMER, LAPIC_TIMER_VECTOR);
+  lapic_write(LAPIC_REG_TIMER_INITIAL, timer_initial);
+}
+
+// disarm timer and return microseconds since it was armed
+uint32_t lapic_timer_stop()
+{
+  uint32_t elapsed = timer_initial - lapic_read(LAPIC_REG_TIMER_CURRENT);
+
+  lapic_write(LAPIC_REG_TIMER_INITIAL, 0);
+  lapic_write(LAPIC_REG_LVT_TIMER, LAPIC_LVT_MASKED);
+  timer_initial = 0;
+
+  return (uint64_t)elapsed * 1000 / ticks_per_ms;
+}
+
+static int32_t lapic_timer_handler(struct interrupt_registers *regs)
+{
+  // nothing to do, only wakes cpu up from idle halt
+  return IRQ_HANDLER_CONTINUE;
+}
+
+// pit has to be ticking (interrupts are enabled)
+static void lapic_timer_calibrate()
+{
+  lapic_write(LAPIC_REG_TIMER_DIVIDE, LAPIC_TIMER_DIVIDE_16);
+  lapic_write(LAPIC_REG_LVT_TIMER, LAPIC_LVT_MASKED);
+
+  // start right after a tick so a whole number of ticks are measured
+  uint32_t start = pit_wait_next_tick();
+  lapic_write(LAPIC_REG_TIMER_INITIAL, UINT32_MAX);
+  while (get_milliseconds_from_boot() - start < LAPIC_CALIBRATE_MS)
+    ;
+  uint32_t current = lapic_read(LAPIC_REG_TIMER_CURRENT);
+  lapic_write(LAPIC_REG_TIMER_INITIAL, 0);
+
+  ticks_per_ms = (UINT32_MAX - current) / LAPIC_CALIBRATE_MS;
+}
+
+// registers are already mapped by bsp, timer is not used on aps
+void lapic_init_ap()
+{
+  lapic_write(LAPIC_REG_TPR, 0);
+  lapic_write(LAPIC_REG_SVR, LAPIC_SVR_ENABLE | LAPIC_SPURIOUS_VECTOR);
+  lapic_write(LAPIC_REG_LVT_TIMER, LAPIC_LVT_MASKED);
+}
+
+void lapic_init()
+{
+  uint32_t eax, edx;
+  cpuid(1, &eax, &edx);
+  if (!(edx & CPUID_FEAT_EDX_APIC))
+    return;
+
+  uint64_t base = rdmsr(IA32_APIC_BASE_MSR);
+  if (!(base & IA32_APIC_BASE_ENABLE))
+    return;
+
+  vmm_map_address(vmm_get_directory(), LAPIC_VADDR, base & 0xFFFFF000, I86_PTE_PRESENT | I86_PTE_WRITABLE | I86_PTE_NOT_CACHEABLE | I86_PTE_WRITETHOUGH);
+  lapic_write(LAPIC_REG_SVR, LAPIC_SVR_ENABLE | LAPIC_SPURIOUS_VECTOR);
+  lapic_enabled = true;
+
+  register_interrupt_handler(LAPIC_TIMER_VECTOR, lapic_timer_handler);
+  lapic_timer_calibrate();
+}
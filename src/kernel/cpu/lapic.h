@@ -0,0 +1,25 @@
+#ifndef CPU_LAPIC_H
+#define CPU_LAPIC_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "idt.h"
+
+#define LAPIC_TIMER_VECTOR IRQ16
+#define LAPIC_RESCHEDULE_VECTOR IRQ17
+#define LAPIC_TLB_VECTOR IRQ18
+#define LAPIC_SPURIOUS_VECTOR 0xFF
+
+void lapic_init();
+void lapic_init_ap();
+void lapic_eoi();
+bool lapic_available();
+uint32_t lapic_id();
+void lapic_send_ipi(uint32_t apic_id, uint32_t vector);
+void lapic_send_init(uint32_t apic_id);
+void lapic_send_startup(uint32_t apic_id, uint32_t page);
+bool lapic_timer_available();
+void lapic_timer_oneshot(uint32_t us);
+uint32_t lapic_timer_stop();
+
+#endif
@@ -1,5 +1,6 @@
 #include <include/list.h>
 #include <kernel/memory/vmm.h>
+#include <kernel/system/vdso.h>
 #include "idt.h"
 #include "pic.h"
 #include "pit.h"
@@ -7,28 +8,88 @@
 #define PIT_REG_COUNTER 0x40
 #define PIT_REG_COMMAND 0x43
 #define TICKS_PER_SECOND 1000
+#define PIT_FREQUENCY 1193181
+#define PIT_DIVISOR (PIT_FREQUENCY / TICKS_PER_SECOND)
+#define TSC_CALIBRATE_MS 10
 
 volatile uint32_t pit_ticks = 0;
+// time which is not counted as a whole tick yet (stopped in the middle of a tick)
+static uint32_t pit_remainder_us = 0;
+static uint32_t tsc_khz = 0;
 
 int32_t pit_interrupt_handler(struct interrupt_registers *regs)
 {
   pit_ticks++;
+  vdso_update_time();
 
   return IRQ_HANDLER_CONTINUE;
 }
 
 uint32_t get_milliseconds_from_boot()
 {
-  return pit_ticks * TICKS_PER_SECOND;
+  return (uint64_t)pit_ticks * 1000 / TICKS_PER_SECOND;
 }
 
-void pit_init()
+// busy waits for the start of the next tick (pit has to be ticking), a measurement from there covers whole ticks
+uint32_t pit_wait_next_tick()
 {
-  int divisor = 1193181 / TICKS_PER_SECOND;
+  uint32_t start = get_milliseconds_from_boot();
+  while (get_milliseconds_from_boot() == start)
+    ;
+  return get_milliseconds_from_boot();
+}
+
+// tsc is calibrated against pit once (scheduler clock, benchmarks), the first call needs interrupts enabled
+uint32_t get_tsc_khz()
+{
+  if (tsc_khz)
+    return tsc_khz;
+
+  uint32_t start = pit_wait_next_tick();
+  uint64_t tsc_start = rdtsc();
+  while (get_milliseconds_from_boot() - start < TSC_CALIBRATE_MS)
+    ;
+  tsc_khz = (rdtsc() - tsc_start) / TSC_CALIBRATE_MS;
+  return tsc_khz;
+}
 
+static void pit_start_periodic()
+{
   outportb(PIT_REG_COMMAND, 0x34);
-  outportb(PIT_REG_COUNTER, divisor & 0xff);
-  outportb(PIT_REG_COUNTER, (divisor >> 8) & 0xff);
+  outportb(PIT_REG_COUNTER, PIT_DIVISOR & 0xff);
+  outportb(PIT_REG_COUNTER, (PIT_DIVISOR >> 8) & 0xff);
+}
+
+/*
+  Idle cpu stops the periodic tick (tickless idle), time spent while stopped is measured by someone else (lapic timer)
+  + stop: latch counter to know how far current tick went, mode 0 without count keeps output low -> no irq0
+  + restart: add idle time (+ part of the tick before stop) to pit_ticks, then start a new period
+*/
+uint32_t pit_stop()
+{
+  outportb(PIT_REG_COMMAND, 0x00);
+  uint32_t count = inportb(PIT_REG_COUNTER);
+  count |= inportb(PIT_REG_COUNTER) << 8;
+
+  outportb(PIT_REG_COMMAND, 0x30);
+
+  // counter goes down from divisor to 1 in each tick
+  return (PIT_DIVISOR - count) * 1000 / PIT_DIVISOR;
+}
+
+void pit_restart(uint32_t elapsed_us)
+{
+  uint32_t us = pit_remainder_us + elapsed_us;
+  pit_ticks += us / (1000000 / TICKS_PER_SECOND);
+  pit_remainder_us = us % (1000000 / TICKS_PER_SECOND);
+  vdso_update_time();
+
+  pit_start_periodic();
+}
+
+void pit_init()
+{
+  pit_start_periodic();
 
   register_interrupt_handler(IRQ0, pit_interrupt_handler);
 }
\ No newline at end of file
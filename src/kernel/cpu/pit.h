@@ -6,5 +6,9 @@
 
 void pit_init();
 uint32_t get_milliseconds_from_boot();
+uint32_t pit_wait_next_tick();
+uint32_t get_tsc_khz();
+uint32_t pit_stop();
+void pit_restart(uint32_t elapsed_us);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,330 @@
+#include <kernel/memory/kernel_info.h>
+#include <kernel/memory/vmm.h>
+#include <kernel/proc/task.h>
+#include <kernel/locking/spinlock.h>
+#include <kernel/system/sysapi.h>
+#include <kernel/system/time.h>
+#include "hal.h"
+#include "fpu.h"
+#include "idt.h"
+#include "lapic.h"
+#include "pit.h"
+#include "smp.h"
+
+/*
+  Symmetric multiprocessing bring-up
+  + cpus are listed by intel multiprocessor specification table (_MP_ floating pointer in ebda, last kb of
+    base memory or bios rom), processor entries give lapic ids, without the table only bsp is used
+  + each ap is started by INIT - STARTUP - STARTUP ipis, it runs trampoline (real mode, below 1MB) with the
+    kernel page directory and a kernel stack which bsp prepared, then loads its own gdt/tss (per-cpu gs) and idt
+  + every ap gets a boot thread (like swapper on bsp) which blocks forever, after that cpu only runs threads
+    from its run queue or steals from other cpus when it would be idle
+  Legacy irqs (pic) and pit tick only go to bsp, aps only receive ipis (reschedule, tlb shootdown)
+*/
+
+#define TRAMPOLINE_BASE 0x8000
+#define BDA_EBDA_SEGMENT 0x40E
+#define BDA_BASE_MEMORY_KB 0x413
+#define BIOS_ROM_START 0xF0000
+#define BIOS_ROM_END 0x100000
+
+#define MP_SIGNATURE 0x5F504D5F /* "_MP_" */
+#define MP_CONFIG_SIGNATURE 0x504D4350 /* "PCMP" */
+#define MP_ENTRY_PROCESSOR 0
+#define MP_PROCESSOR_ENABLED 0x1
+#define MP_PROCESSOR_BSP 0x2
+
+#define AP_STARTUP_TIMEOUT 100 /* ms */
+
+struct mp_floating_pointer
+{
+  uint32_t signature;
+  uint32_t config;
+  uint8_t length; /* in 16 bytes */
+  uint8_t revision;
+  uint8_t checksum;
+  uint8_t features[5];
+} __attribute__((packed));
+
+struct mp_config_table
+{
+  uint32_t signature;
+  uint16_t length;
+  uint8_t revision;
+  uint8_t checksum;
+  char oem[8];
+  char product[12];
+  uint32_t oem_table;
+  uint16_t oem_table_size;
+  uint16_t entry_count;
+  uint32_t lapic_address;
+  uint16_t extended_length;
+  uint8_t extended_checksum;
+  uint8_t reserved;
+} __attribute__((packed));
+
+struct mp_processor_entry
+{
+  uint8_t type;
+  uint8_t lapic_id;
+  uint8_t lapic_version;
+  uint8_t flags;
+  uint32_t signature;
+  uint32_t features;
+  uint32_t reserved[2];
+} __attribute__((packed));
+
+extern char trampoline_start[], trampoline_end[];
+extern uint32_t trampoline_cr3, trampoline_stack, trampoline_entry;
+
+struct cpu cpus[MAX_CPUS];
+uint32_t nr_cpus = 1;
+
+static struct cpu *volatile ap_booting;
+
+static spinlock_t tlb_lock = SPINLOCK_INITIALIZER;
+static volatile uint32_t tlb_pending;
+static volatile uint32_t tlb_addr;
+
+static inline void *phys_to_virt(uint32_t paddr)
+{
+  // first 4MB are mapped at the start of higher half
+  return (void *)(paddr + KERNEL_HIGHER_HALF);
+}
+
+static bool mp_checksum(void *addr, uint32_t length)
+{
+  uint8_t sum = 0;
+  for (uint8_t *p = addr; length--; ++p)
+    sum += *p;
+  return sum == 0;
+}
+
+static struct mp_floating_pointer *mp_search(uint32_t start, uint32_t length)
+{
+  for (uint32_t addr = start; addr < start + length; addr += 16)
+  {
+    struct mp_floating_pointer *mp = phys_to_virt(addr);
+    if (mp->signature == MP_SIGNATURE && mp_checksum(mp, mp->length * 16))
+      return mp;
+  }
+  return NULL;
+}
+
+static struct mp_floating_pointer *mp_find()
+{
+  struct mp_floating_pointer *mp;
+  uint32_t ebda = *(uint16_t *)phys_to_virt(BDA_EBDA_SEGMENT) << 4;
+  uint32_t base_memory = *(uint16_t *)phys_to_virt(BDA_BASE_MEMORY_KB) * 1024;
+
+  if (ebda && (mp = mp_search(ebda, 1024)))
+    return mp;
+  if (base_memory && (mp = mp_search(base_memory - 1024, 1024)))
+    return mp;
+  return mp_search(BIOS_ROM_START, BIOS_ROM_END - BIOS_ROM_START);
+}
+
+static void mp_parse()
+{
+  struct mp_floating_pointer *mp = mp_find();
+  // config table is usually in the first megabyte (ebda or bios rom), default configurations are not supported
+  if (!mp || !mp->config || mp->config >= 0x400000)
+    return;
+
+  struct mp_config_table *config = phys_to_virt(mp->config);
+  if (config->signature != MP_CONFIG_SIGNATURE || !mp_checksum(config, config->length))
+    return;
+
+  uint8_t *entry = (uint8_t *)(config + 1);
+  for (uint32_t i = 0; i < config->entry_count; ++i)
+  {
+    // only processor entries are 20 bytes, the other types (bus, io apic, interrupt) are 8 bytes
+    if (*entry != MP_ENTRY_PROCESSOR)
+    {
+      entry += 8;
+      continue;
+    }
+
+    struct mp_processor_entry *processor = (struct mp_processor_entry *)entry;
+    entry += sizeof(struct mp_processor_entry);
+
+    if (!(processor->flags & MP_PROCESSOR_ENABLED) || (processor->flags & MP_PROCESSOR_BSP))
+      continue;
+    if (nr_cpus == MAX_CPUS)
+      break;
+
+    struct cpu *cpu = &cpus[nr_cpus];
+    cpu->id = nr_cpus++;
+    cpu->lapic_id = processor->lapic_id;
+  }
+}
+
+static void wait_milliseconds(uint32_t ms)
+{
+  uint32_t start = get_milliseconds_from_boot();
+  while (get_milliseconds_from_boot() - start < ms)
+    ;
+}
+
+static void ap_main()
+{
+  struct cpu *cpu = ap_booting;
+
+  gdt_init_cpu(cpu);
+  install_tss(5, 0x10, 0);
+  install_double_fault_tss(7);
+  idt_load();
+  fpu_init_cpu();
+  syscall_init_cpu();
+  lapic_init_ap();
+
+  cpu->online = true;
+
+  // boot thread is only a stack to stand on, cpu picks real work from now on
+  while (true)
+  {
+    update_thread(current_thread, THREAD_BLOCKED);
+    schedule();
+  }
+}
+
+static bool smp_boot_ap(struct cpu *cpu)
+{
+  struct thread *t = create_kernel_thread(current_process, 0, THREAD_RUNNING, 0);
+  t->cpu = cpu->id;
+  t->on_cpu = 1;
+  cpu->thread = t;
+  cpu->process = t->parent;
+
+  trampoline_stack = t->kernel_stack;
+  trampoline_entry = (uint32_t)ap_main;
+  ap_booting = cpu;
+  memcpy(phys_to_virt(TRAMPOLINE_BASE), trampoline_start, trampoline_end - trampoline_start);
+
+  lapic_send_init(cpu->lapic_id);
+  wait_milliseconds(10);
+  // second startup ipi is only for cpus which missed the first one
+  for (uint32_t i = 0; i < 2 && !cpu->online; ++i)
+  {
+    lapic_send_startup(cpu->lapic_id, TRAMPOLINE_BASE >> 12);
+    wait_milliseconds(1);
+  }
+
+  uint32_t start = get_milliseconds_from_boot();
+  while (!cpu->online && get_milliseconds_from_boot() - start < AP_STARTUP_TIMEOUT)
+    ;
+
+  return cpu->online;
+}
+
+static int32_t reschedule_ipi_handler(struct interrupt_registers *regs)
+{
+  // nothing to do, cpu leaves idle halt and looks at its run queue again
+  return IRQ_HANDLER_CONTINUE;
+}
+
+void smp_poll_ipi()
+{
+  uint32_t mask = 1 << this_cpu()->id;
+  if (!(tlb_pending & mask))
+    return;
+
+  if (tlb_addr == TLB_FLUSH_ALL)
+    flush_tlb_local();
+  else
+    __asm__ __volatile__("invlpg (%0)" ::"r"(tlb_addr)
+                         : "memory");
+  __sync_fetch_and_and(&tlb_pending, ~mask);
+}
+
+static int32_t tlb_ipi_handler(struct interrupt_registers *regs)
+{
+  smp_poll_ipi();
+  return IRQ_HANDLER_CONTINUE;
+}
+
+// invalidate addr (TLB_FLUSH_ALL -> whole user space) on other cpus which use dir (or on all cpus when dir is NULL) and wait for them
+void smp_flush_tlb_entry(uint32_t addr, struct pdirectory *dir)
+{
+  if (nr_cpus == 1)
+    return;
+
+  uint32_t flags = irq_save();
+  spin_lock(&tlb_lock);
+
+  uint32_t self = this_cpu()->id;
+  uint32_t targets = 0;
+  for (uint32_t i = 0; i < nr_cpus; ++i)
+  {
+    struct cpu *cpu = &cpus[i];
+    // cpu which is switching to another address space reloads cr3 anyway
+    if (i == self || !cpu->online || (dir && (!cpu->process || cpu->process->pdir != dir)))
+      continue;
+    targets |= 1 << i;
+  }
+
+  if (targets)
+  {
+    tlb_addr = addr;
+    tlb_pending = targets;
+    for (uint32_t i = 0; i < nr_cpus; ++i)
+      if (targets & (1 << i))
+        lapic_send_ipi(cpus[i].lapic_id, LAPIC_TLB_VECTOR);
+
+    while (tlb_pending)
+      cpu_relax();
+  }
+
+  spin_unlock(&tlb_lock);
+  irq_restore(flags);
+}
+
+void smp_send_reschedule(uint32_t cpu)
+{
+  if (cpu != this_cpu()->id && cpus[cpu].online)
+    lapic_send_ipi(cpus[cpu].lapic_id, LAPIC_RESCHEDULE_VECTOR);
+}
+
+bool smp_others_idle()
+{
+  uint32_t self = this_cpu()->id;
+  for (uint32_t i = 0; i < nr_cpus; ++i)
+    if (i != self && cpus[i].online && !cpus[i].idle)
+      return false;
+  return true;
+}
+
+void smp_init()
+{
+  // lapic is needed for ipis, without it only bsp runs
+  if (!lapic_available())
+    return;
+
+  cpus[0].lapic_id = lapic_id();
+  mp_parse();
+  if (nr_cpus == 1)
+    return;
+
+  register_interrupt_handler(LAPIC_RESCHEDULE_VECTOR, reschedule_ipi_handler);
+  register_interrupt_handler(LAPIC_TLB_VECTOR, tlb_ipi_handler);
+
+  // trampoline turns paging on while running below 1MB -> identity map the first 4MB until every ap is up
+  struct pdirectory *dir = current_process->pdir;
+  dir->m_entries[0] = I86_PDE_PRESENT | I86_PDE_WRITABLE | I86_PDE_4MB;
+  trampoline_cr3 = vmm_get_physical_address((uint32_t)dir, true);
+
+  uint32_t online = 1;
+  for (uint32_t i = 1; i < nr_cpus; ++i)
+  {
+    if (!smp_boot_ap(&cpus[i]))
+      break;
+    online++;
+  }
+  // cpus which don't answer are left out, cpu ids stay contiguous
+  nr_cpus = online;
+
+  dir->m_entries[0] = 0;
+  __asm__ __volatile__("invlpg (%0)" ::"r"(0)
+                       : "memory");
+  smp_flush_tlb_entry(0, NULL);
+}
@@ -0,0 +1,64 @@
+#ifndef CPU_SMP_H
+#define CPU_SMP_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "gdt.h"
+#include "tss.h"
+
+#define MAX_CPUS 8
+#define PERCPU_SELECTOR 0x30
+
+struct thread;
+struct process;
+struct pdirectory;
+
+/*
+  Per-cpu data, gs segment of each cpu is based at its struct cpu (gs:0 is `self`)
+  Interrupt stubs reload gs from PERCPU_SELECTOR, every cpu has its own gdt -> same selector, different base
+*/
+struct cpu
+{
+  struct cpu *self;
+  uint32_t id;
+  uint32_t lapic_id;
+  struct thread *thread;   /* current_thread */
+  struct process *process; /* current_process */
+  uint32_t scheduler_lock_counter;
+  volatile bool online;
+  volatile bool idle;
+  volatile bool need_resched; /* preempt current thread when it returns to user mode */
+  uint32_t softirq_pending;
+  bool in_softirq;
+  struct thread *fpu_owner; /* fpu registers hold its state and cr0.TS is clear */
+  struct thread *fpu_last;  /* last state saved from this cpu, registers still hold it */
+  struct gdt_descriptor gdt[MAX_DESCRIPTORS];
+  struct gdtr gdtr;
+  struct tss_entry tss;
+  struct tss_entry df_tss; /* double fault task, runs on its own stack */
+};
+
+static inline struct cpu *this_cpu()
+{
+  struct cpu *cpu;
+  // volatile, thread can continue on another cpu after schedule
+  __asm__ __volatile__("mov %%gs:0, %0"
+                       : "=r"(cpu));
+  return cpu;
+}
+
+#define current_thread (this_cpu()->thread)
+#define current_process (this_cpu()->process)
+
+extern struct cpu cpus[MAX_CPUS];
+extern uint32_t nr_cpus;
+
+void smp_init();
+bool smp_others_idle();
+void smp_send_reschedule(uint32_t cpu);
+#define TLB_FLUSH_ALL 0xFFFFFFFF /* not page aligned, never a real address to invalidate */
+
+void smp_flush_tlb_entry(uint32_t addr, struct pdirectory *dir);
+void smp_poll_ipi();
+
+#endif
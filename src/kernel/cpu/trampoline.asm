@@ -0,0 +1,73 @@
+; Application processor entry, copied to TRAMPOLINE_BASE (below 1MB) by smp_init
+; startup ipi starts ap in real mode at TRAMPOLINE_BASE -> protected mode -> paging (same page directory as bsp)
+; -> jump to higher half with the stack which bsp prepared
+; Addresses are computed relative to the copy, the first 4MB are identity mapped while aps are starting
+
+TRAMPOLINE_BASE equ 0x8000
+%define REL(label) (TRAMPOLINE_BASE + (label - trampoline_start))
+
+[global trampoline_start]
+[global trampoline_end]
+[global trampoline_cr3]
+[global trampoline_stack]
+[global trampoline_entry]
+
+section .text
+[bits 16]
+trampoline_start:
+    cli
+    cld
+    xor ax, ax
+    mov ds, ax
+
+    o32 lgdt [REL(trampoline_gdtr)]
+
+    mov eax, cr0
+    or eax, 0x1
+    mov cr0, eax
+
+    jmp dword 0x08:REL(trampoline_protected_mode)
+
+[bits 32]
+trampoline_protected_mode:
+    mov ax, 0x10
+    mov ds, ax
+    mov es, ax
+    mov fs, ax
+    mov gs, ax
+    mov ss, ax
+
+    ; PSE (4MB pages) and PGE (global pages) as on bsp
+    mov eax, cr4
+    or eax, 0x00000090
+    mov cr4, eax
+
+    mov eax, [REL(trampoline_cr3)]
+    mov cr3, eax
+
+    ; paging and write protect, caches are disabled (CD, NW) after INIT
+    mov eax, cr0
+    and eax, 0x9FFFFFFF
+    or eax, 0x80010000
+    mov cr0, eax
+
+    mov esp, [REL(trampoline_stack)]
+    mov eax, [REL(trampoline_entry)]
+    jmp eax
+
+align 8
+trampoline_gdt:
+    dq 0x0000000000000000
+    dq 0x00CF9A000000FFFF ; code
+    dq 0x00CF92000000FFFF ; data
+trampoline_gdtr:
+    dw trampoline_gdtr - trampoline_gdt - 1
+    dd REL(trampoline_gdt)
+
+trampoline_cr3:
+    dd 0
+trampoline_stack:
+    dd 0
+trampoline_entry:
+    dd 0
+trampoline_end:
@@ -1,23 +1,31 @@
 #include <kernel/utils/string.h>
 #include <kernel/cpu/gdt.h>
+#include <kernel/cpu/smp.h>
+#include <kernel/cpu/idt.h>
+#include "exception.h"
 #include "tss.h"
 
+#define DOUBLE_FAULT_STACK_SIZE 0x1000
+
 extern void tss_flush();
 
-static struct tss_entry TSS;
+static char double_fault_stacks[MAX_CPUS][DOUBLE_FAULT_STACK_SIZE] __attribute__((aligned(16)));
 
+// Each cpu has its own TSS (in struct cpu), esp0 is the kernel stack of thread running on that cpu
 void tss_set_stack(uint32_t kernelSS, uint32_t kernelESP)
 {
+	struct tss_entry *TSS = &this_cpu()->tss;
 
-	TSS.ss0 = kernelSS;
-	TSS.esp0 = kernelESP;
+	TSS->ss0 = kernelSS;
+	TSS->esp0 = kernelESP;
 }
 
 void install_tss(uint32_t idx, uint32_t kernelSS, uint32_t kernelESP)
 {
+	struct tss_entry *TSS = &this_cpu()->tss;
 
 	//! install TSS descriptor
-	uint32_t base = (uint32_t)&TSS;
+	uint32_t base = (uint32_t)TSS;
 
 	//! install descriptor
 	gdt_set_descriptor(idx, base, base + sizeof(struct tss_entry),
@@ -25,18 +33,53 @@ void install_tss(uint32_t idx, uint32_t kernelSS, uint32_t kernelESP)
 										 0);
 
 	//! initialize TSS
-	memset((void *)&TSS, 0, sizeof(struct tss_entry));
+	memset((void *)TSS, 0, sizeof(struct tss_entry));
 
 	//! set stack and segments
-	TSS.ss0 = kernelSS;
-	TSS.esp0 = kernelESP;
-	TSS.cs = 0x0b;
-	TSS.ss = 0x13;
-	TSS.es = 0x13;
-	TSS.ds = 0x13;
-	TSS.fs = 0x13;
-	TSS.gs = 0x13;
-	TSS.iomap = sizeof(struct tss_entry);
+	TSS->ss0 = kernelSS;
+	TSS->esp0 = kernelESP;
+	TSS->cs = 0x0b;
+	TSS->ss = 0x13;
+	TSS->es = 0x13;
+	TSS->ds = 0x13;
+	TSS->fs = 0x13;
+	TSS->gs = 0x13;
+	TSS->iomap = sizeof(struct tss_entry);
 
 	tss_flush();
 }
+
+/*
+  Kernel stack overflow runs into the guard page, the page fault cannot be pushed on that stack and becomes #DF
+  Vector 8 is a task gate to this TSS -> cpu switches to a fresh stack and a valid esp before touching memory
+  cr3 is the directory at install time, kernel half is the same in every address space
+*/
+void install_double_fault_tss(uint32_t idx)
+{
+	struct cpu *cpu = this_cpu();
+	struct tss_entry *TSS = &cpu->df_tss;
+	uint32_t base = (uint32_t)TSS;
+	uint32_t cr3;
+
+	__asm__ __volatile__("mov %%cr3, %0"
+											 : "=r"(cr3));
+
+	//! available 32-bit TSS, never loaded into tr, only reached through the task gate
+	gdt_set_descriptor(idx, base, sizeof(struct tss_entry) - 1,
+										 I86_GDT_DESC_ACCESS | I86_GDT_DESC_EXEC_CODE | I86_GDT_DESC_MEMORY,
+										 0);
+
+	memset((void *)TSS, 0, sizeof(struct tss_entry));
+
+	TSS->cr3 = cr3;
+	TSS->eip = (uint32_t)double_fault_task;
+	TSS->eflags = 0x2;
+	TSS->esp = (uint32_t)&double_fault_stacks[cpu->id][DOUBLE_FAULT_STACK_SIZE];
+	TSS->cs = 0x08;
+	TSS->ss = 0x10;
+	TSS->es = 0x10;
+	TSS->ds = 0x10;
+	TSS->fs = 0x10;
+	TSS->gs = PERCPU_SELECTOR;
+	TSS->iomap = sizeof(struct tss_entry);
+}
@@ -36,5 +36,6 @@ struct __attribute__((packed)) tss_entry
 
 void tss_set_stack(uint32_t kernelSS, uint32_t kernelESP);
 void install_tss(uint32_t sel, uint32_t kernelSS, uint32_t kernelESP);
+void install_double_fault_tss(uint32_t idx);
 
 #endif
@@ -2,7 +2,9 @@
 #include <kernel/utils/string.h>
 #include <kernel/cpu/hal.h>
 #include <kernel/cpu/idt.h>
+#include <kernel/locking/spinlock.h>
 #include <kernel/memory/vmm.h>
+#include <kernel/proc/task.h>
 #include "ata.h"
 
 #define MAX_ATA_DEVICE 4
@@ -28,9 +30,16 @@ int32_t ata_irq()
 
 int32_t ata_wait_irq()
 {
+  // irq is handled on bsp under big kernel lock, waiter on another cpu would block it forever
+  uint32_t lock_depth = release_kernel_lock(current_thread);
+  // cpu might wait with interrupts disabled, it still has to answer tlb shootdowns
   while (!ata_irq_called)
-    ;
+  {
+    smp_poll_ipi();
+    cpu_relax();
+  }
   ata_irq_called = false;
+  reacquire_kernel_lock(current_thread, lock_depth);
 
   return IRQ_HANDLER_CONTINUE;
 }
@@ -385,12 +385,12 @@ int32_t i86_kybrd_irq(struct interrupt_registers *registers)
 				// workaround via using left/right command to simuate left/right click
 				if (key == KEY_LCOMMAND || key == KEY_RCOMMAND)
 				{
-					struct mouse_device *mouse = kcalloc(1, sizeof(struct mouse_device));
-					mouse->x = 0;
-					mouse->y = 0;
-					mouse->state = key == KEY_LCOMMAND ? MOUSE_LEFT_CLICK : MOUSE_RIGHT_CLICK;
-					enqueue_mouse_event(mouse);
-					kfree(mouse);
+					struct mouse_device mouse = {
+						.x = 0,
+						.y = 0,
+						.state = key == KEY_LCOMMAND ? MOUSE_LEFT_CLICK : MOUSE_RIGHT_CLICK,
+					};
+					enqueue_mouse_event(&mouse);
 				}
 				else
 					enqueue_keyboard_event(key);
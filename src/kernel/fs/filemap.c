@@ -0,0 +1,104 @@
+#include <kernel/memory/pmm.h>
+#include <kernel/memory/vmm.h>
+#include <kernel/proc/task.h>
+#include <kernel/utils/string.h>
+#include "vfs.h"
+
+/*
+  Page cache of disk files which are mapped privately (elf segments), kept per inode and indexed by file page
+  + every instance of a program maps the cached frame instead of reading its own copy
+    read-only segment -> shared read-only, writable segment -> copy-on-write (first write copies it)
+  + cache holds its own frame reference, it is dropped when the last file of the inode is closed
+    (mappings hold their file) or the file is written or truncated, processes which map the old frames keep them
+  + table and slots are changed under i_sem, the disk read runs without it and the slot is checked again after it
+  Memory backed files (tmpfs) have their own pages and map them directly (f_op->mmap), they are not cached here
+*/
+static uint32_t *filemap_frames(struct vfs_inode *inode, uint32_t index)
+{
+  struct address_space *mapping = &inode->i_data;
+  if (index < mapping->nr_cached)
+    return mapping->cached_frames;
+
+  uint32_t nr_cached = PAGE_ALIGN(inode->i_size) / PMM_FRAME_SIZE;
+  if (index >= nr_cached)
+    return NULL;
+
+  uint32_t *frames = kcalloc(nr_cached, sizeof(uint32_t));
+  if (mapping->cached_frames)
+  {
+    memcpy(frames, mapping->cached_frames, mapping->nr_cached * sizeof(uint32_t));
+    kfree(mapping->cached_frames);
+  }
+  mapping->cached_frames = frames;
+  mapping->nr_cached = nr_cached;
+  return frames;
+}
+
+// frame of the file page at pos (page aligned), caller gets a reference for its mapping, 0 if it is not cacheable
+uint32_t filemap_get_page(struct vfs_file *file, uint32_t pos)
+{
+  struct vfs_inode *inode = file->f_dentry->d_inode;
+  if (file->f_op->mmap || (pos & ~PAGE_MASK))
+    return 0;
+
+  uint32_t index = pos / PMM_FRAME_SIZE;
+  uint32_t frame = 0;
+
+  acquire_semaphore(&inode->i_sem);
+  uint32_t *frames = filemap_frames(inode, index);
+  if (frames && frames[index])
+  {
+    frame = frames[index];
+    pmm_ref_block((void *)frame);
+  }
+  release_semaphore(&inode->i_sem);
+
+  if (frame || !frames)
+    return frame;
+
+  struct page p = {.frame = (uint32_t)alloc_page(GFP_ZERO)};
+  if (!p.frame)
+    return 0;
+
+  kmap(&p);
+  file->f_op->read(file, (char *)p.virtual, min_t(uint32_t, PMM_FRAME_SIZE, inode->i_size - pos), pos);
+  kunmap(&p);
+
+  // disk read might sleep, the slot could be filled or the cache dropped (write, truncate) meanwhile
+  acquire_semaphore(&inode->i_sem);
+  frames = filemap_frames(inode, index);
+  if (frames && frames[index])
+  {
+    pmm_free_block((void *)p.frame);
+    p.frame = frames[index];
+  }
+  else if (frames)
+    frames[index] = p.frame;
+  // page past the new end of file, caller gets the frame as a private copy
+  if (frames)
+    pmm_ref_block((void *)p.frame);
+  release_semaphore(&inode->i_sem);
+
+  return p.frame;
+}
+
+void filemap_invalidate(struct vfs_inode *inode)
+{
+  struct address_space *mapping = &inode->i_data;
+  acquire_semaphore(&inode->i_sem);
+  if (!mapping->cached_frames)
+  {
+    release_semaphore(&inode->i_sem);
+    return;
+  }
+
+  for (uint32_t i = 0; i < mapping->nr_cached; ++i)
+  {
+    if (mapping->cached_frames[i])
+      pmm_free_block((void *)mapping->cached_frames[i]);
+  }
+  kfree(mapping->cached_frames);
+  mapping->cached_frames = NULL;
+  mapping->nr_cached = 0;
+  release_semaphore(&inode->i_sem);
+}
@@ -1,13 +1,14 @@
+#include <include/errno.h>
 #include <kernel/utils/string.h>
 #include <kernel/memory/vmm.h>
 #include <kernel/proc/task.h>
 #include "vfs.h"
 
-extern struct process *current_process;
+struct kmem_cache *dentry_cache;
 
 struct vfs_dentry *alloc_dentry(struct vfs_dentry *parent, char *name)
 {
-  struct vfs_dentry *d = kcalloc(1, sizeof(struct vfs_dentry));
+  struct vfs_dentry *d = kmem_cache_zalloc(dentry_cache);
   d->d_name = name;
   d->d_parent = parent;
   INIT_LIST_HEAD(&d->d_subdirs);
@@ -43,7 +44,10 @@ struct nameidata *path_walk(const char *path)
     }
 
     if (d_child)
+    {
       nd->dentry = d_child;
+      kfree(part_name);
+    }
     else
     {
       d_child = alloc_dentry(nd->dentry, part_name);
@@ -69,22 +73,60 @@ struct nameidata *path_walk(const char *path)
   return nd;
 }
 
-long vfs_open(const char *path)
+// File which is only used by kernel (not in any fd table), like elf of a process which is mapped on demand
+struct vfs_file *filp_open(const char *path)
 {
-  int fd = find_unused_fd_slot();
   struct nameidata *nd = path_walk(path);
+  struct vfs_dentry *dentry = nd->dentry;
+  struct vfs_mount *mnt = nd->mnt;
+  kfree(nd);
+  if (!dentry->d_inode)
+    return NULL;
 
   struct vfs_file *file = kcalloc(1, sizeof(struct vfs_file));
-  file->f_dentry = nd->dentry;
-  file->f_vfsmnt = nd->mnt;
+  file->f_dentry = dentry;
+  file->f_vfsmnt = mnt;
   file->f_pos = 0;
-  file->f_op = nd->dentry->d_inode->i_fop;
+  file->f_op = dentry->d_inode->i_fop;
+  // opener holds the first reference, last close (or exit) releases the file
+  file->f_count = 1;
+  dentry->d_inode->i_data.nr_files++;
 
   if (file->f_op && file->f_op->open)
   {
-    file->f_op->open(nd->dentry->d_inode, file);
+    file->f_op->open(dentry->d_inode, file);
   }
 
+  return file;
+}
+
+// mapping (vma) holds its own reference, file outlives the fd it was mapped from
+struct vfs_file *get_file(struct vfs_file *file)
+{
+  file->f_count++;
+  return file;
+}
+
+void fput(struct vfs_file *file)
+{
+  if (--file->f_count > 0)
+    return;
+
+  struct vfs_inode *inode = file->f_dentry->d_inode;
+  if (file->f_op && file->f_op->release)
+    file->f_op->release(inode, file);
+  if (!--inode->i_data.nr_files)
+    filemap_invalidate(inode);
+  kfree(file);
+}
+
+long vfs_open(const char *path)
+{
+  struct vfs_file *file = filp_open(path);
+  if (!file)
+    return -ENOENT;
+
+  int fd = find_unused_fd_slot();
   current_process->files->fd[fd] = file;
   return fd;
 }
@@ -96,10 +138,8 @@ long vfs_close(uint32_t fd)
   acquire_semaphore(&files->lock);
 
   struct vfs_file *f = files->fd[fd];
-  f->f_count--;
-  if (!f->f_count && f->f_op->release)
-    f->f_op->release(f->f_dentry->d_inode, f);
   files->fd[fd] = NULL;
+  fput(f);
 
   release_semaphore(&files->lock);
   return 0;
@@ -143,7 +183,9 @@ int do_getattr(struct vfs_mount *mnt, struct vfs_dentry *dentry, struct kstat *s
 int vfs_stat(const char *path, struct kstat *stat)
 {
   struct nameidata *nd = path_walk(path);
-  return do_getattr(nd->mnt, nd->dentry, stat);
+  int ret = do_getattr(nd->mnt, nd->dentry, stat);
+  kfree(nd);
+  return ret;
 }
 
 int vfs_fstat(uint32_t fd, struct kstat *stat)
@@ -158,7 +200,9 @@ int vfs_mknod(const char *path, int mode, dev_t dev)
   strlsplat(path, strliof(path, "/"), &dir, &name);
 
   struct nameidata *nd = path_walk(dir);
-  return nd->dentry->d_inode->i_op->mknod(nd->dentry->d_inode, name, mode, dev);
+  struct vfs_inode *inode = nd->dentry->d_inode;
+  kfree(nd);
+  return inode->i_op->mknod(inode, name, mode, dev);
 }
 
 int simple_setattr(struct vfs_dentry *d, struct iattr *attrs)
@@ -173,6 +217,8 @@ int simple_setattr(struct vfs_dentry *d, struct iattr *attrs)
 int do_truncate(struct vfs_dentry *dentry, int32_t length)
 {
   struct vfs_inode *inode = dentry->d_inode;
+  filemap_invalidate(inode);
+
   struct iattr *attrs = kcalloc(1, sizeof(struct iattr));
   attrs->ia_valid = ATTR_SIZE;
   attrs->ia_size = length;
@@ -181,13 +227,16 @@ int do_truncate(struct vfs_dentry *dentry, int32_t length)
     inode->i_op->setattr(dentry, attrs);
   else
     simple_setattr(dentry, attrs);
+  kfree(attrs);
   return 0;
 }
 
 int vfs_truncate(const char *path, int32_t length)
 {
   struct nameidata *nd = path_walk(path);
-  return do_truncate(nd->dentry, length);
+  struct vfs_dentry *dentry = nd->dentry;
+  kfree(nd);
+  return do_truncate(dentry, length);
 }
 
 int vfs_ftruncate(uint32_t fd, int32_t length)
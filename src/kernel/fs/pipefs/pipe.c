@@ -6,8 +6,6 @@
 #include <kernel/proc/task.h>
 #include "pipe.h"
 
-extern struct process *current_process;
-
 // TODO: MQ 2019-01-03 Implement empty for read and full for write (http://man7.org/linux/man-pages/man7/pipe.7.html)
 ssize_t pipe_read(struct vfs_file *file, char *buf, size_t count, loff_t ppos)
 {
@@ -139,6 +137,7 @@ int32_t do_pipe(int32_t *fd)
   f2->f_op = &pipe_fops;
   f2->f_dentry = dentry;
   f2->f_count = 1;
+  inode->i_data.nr_files = 2;
 
   int32_t ufd1 = find_unused_fd_slot();
   current_process->files->fd[ufd1] = f1;
@@ -3,8 +3,6 @@
 #include <kernel/proc/task.h>
 #include "vfs.h"
 
-extern struct process *current_process;
-
 char *vfs_read(const char *path)
 {
   long fd = vfs_open(path);
@@ -30,6 +28,7 @@ int vfs_write(const char *path, const char *buf, size_t count)
 ssize_t vfs_fwrite(uint32_t fd, const char *buf, size_t count)
 {
   struct vfs_file *file = current_process->files->fd[fd];
+  filemap_invalidate(file->f_dentry->d_inode);
   return file->f_op->write(file, buf, count, file->f_pos);
 }
 
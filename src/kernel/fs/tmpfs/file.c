@@ -5,8 +5,6 @@
 #include <kernel/proc/task.h>
 #include "tmpfs.h"
 
-extern struct process *current_process;
-
 loff_t tmpfs_llseek_file(struct vfs_file *file, loff_t ppos)
 {
   struct vfs_inode *inode = file->f_dentry->d_inode;
@@ -92,6 +90,8 @@ int tmpfs_mmap_file(struct vfs_file *file, struct vm_area_struct *new_vma)
     if (addr >= new_vma->vm_end)
       break;
     vmm_map_address(current_process->pdir, addr, iter_page->frame, I86_PTE_PRESENT | I86_PTE_WRITABLE | I86_PTE_USER);
+    // The mapping holds its own reference, dropped by munmap or exit
+    pmm_ref_block((void *)iter_page->frame);
     addr += sb->s_blocksize;
   }
 
@@ -5,8 +5,6 @@
 #include <kernel/proc/task.h>
 #include "tmpfs.h"
 
-extern struct process *current_process;
-
 int tmpfs_setsize(struct vfs_inode *inode, loff_t new_size)
 {
     uint32_t aligned_new_size = PAGE_ALIGN(new_size);
@@ -17,7 +15,8 @@ int tmpfs_setsize(struct vfs_inode *inode, loff_t new_size)
         for (uint32_t i = 0; i < extended_frames; ++i)
         {
             struct page *p = kcalloc(1, sizeof(struct page));
-            p->frame = pmm_alloc_block();
+            // shm pages are mapped into userspace, they must not carry old data
+            p->frame = (uint32_t)alloc_page(GFP_ZERO);
             list_add_tail(&p->sibling, &inode->i_data.pages);
         }
     }
@@ -25,7 +24,13 @@ int tmpfs_setsize(struct vfs_inode *inode, loff_t new_size)
     {
         uint32_t shrink_frames = (aligned_size - aligned_new_size) / PMM_FRAME_SIZE;
         for (uint32_t i = 0; i < shrink_frames; ++i)
-            list_del(inode->i_data.pages.prev);
+        {
+            // Frame is released once the last mapping of it is gone
+            struct page *p = list_last_entry(&inode->i_data.pages, struct page, sibling);
+            list_del(&p->sibling);
+            pmm_free_block((void *)p->frame);
+            kfree(p);
+        }
     }
     inode->i_data.npages = aligned_new_size / PMM_FRAME_SIZE;
     inode->i_size = new_size;
@@ -9,8 +9,8 @@
 
 static struct vfs_file_system_type *file_systems;
 struct list_head vfsmntlist;
-
-extern struct process *current_process;
+struct kmem_cache *inode_cache;
+extern struct kmem_cache *dentry_cache;
 
 struct vfs_file_system_type **find_filesystem(const char *name)
 {
@@ -58,7 +58,7 @@ int find_unused_fd_slot()
 
 struct vfs_inode *init_inode()
 {
-  struct vfs_inode *i = kcalloc(1, sizeof(struct vfs_inode));
+  struct vfs_inode *i = kmem_cache_zalloc(inode_cache);
   i->i_blocks = 0;
   i->i_size = 0;
   sema_init(&i->i_sem, 1);
@@ -99,6 +99,7 @@ struct vfs_mount *do_mount(const char *fstype, int flags, const char *path)
 
   list_add_tail(&mnt->mnt_mountpoint->d_sibling, &nd->dentry->d_subdirs);
   list_add_tail(&mnt->sibling, &vfsmntlist);
+  kfree(nd);
 
   return mnt;
 }
@@ -117,6 +118,8 @@ void init_rootfs(struct vfs_file_system_type *fs_type, char *dev_name)
 void vfs_init(struct vfs_file_system_type *fs, char *dev_name)
 {
   INIT_LIST_HEAD(&vfsmntlist);
+  inode_cache = kmem_cache_create("inode", sizeof(struct vfs_inode), 0);
+  dentry_cache = kmem_cache_create("dentry", sizeof(struct vfs_dentry), 0);
 
   init_ext2_fs();
   init_rootfs(fs, dev_name);
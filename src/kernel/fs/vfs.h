@@ -36,6 +36,11 @@ struct address_space
   struct vm_area_struct *i_mmap;
   struct list_head pages;
   uint32_t npages;
+  // cache of disk file pages (filemap.c), frame of file page i or 0
+  uint32_t *cached_frames;
+  uint32_t nr_cached;
+  // open files of the inode (mappings hold theirs), the cache is dropped with the last one
+  uint32_t nr_files;
 };
 
 struct kstat
@@ -204,6 +209,9 @@ struct vfs_mount *do_mount(const char *fstype, int flags, const char *name);
 
 // open.c
 struct vfs_dentry *alloc_dentry(struct vfs_dentry *parent, char *name);
+struct vfs_file *filp_open(const char *path);
+struct vfs_file *get_file(struct vfs_file *file);
+void fput(struct vfs_file *file);
 long vfs_open(const char *path);
 long vfs_close(uint32_t fd);
 int vfs_stat(const char *path, struct kstat *stat);
@@ -213,6 +221,10 @@ struct nameidata *path_walk(const char *path);
 int vfs_truncate(const char *path, int32_t length);
 int vfs_ftruncate(uint32_t fd, int32_t length);
 
+// filemap.c
+uint32_t filemap_get_page(struct vfs_file *file, uint32_t pos);
+void filemap_invalidate(struct vfs_inode *inode);
+
 // read_write.c
 char *vfs_read(const char *path);
 ssize_t vfs_fread(uint32_t fd, char *buf, size_t count);
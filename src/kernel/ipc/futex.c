@@ -0,0 +1,135 @@
+#include <include/errno.h>
+#include <include/futex.h>
+#include <kernel/cpu/hal.h>
+#include <kernel/locking/spinlock.h>
+#include <kernel/memory/vmm.h>
+#include <kernel/proc/task.h>
+#include "futex.h"
+
+/*
+  Futex waiters are hashed by the physical address of the futex word, not by the virtual one
+  -> the same word in a MAP_SHARED mapping is one futex for every process which maps it
+  + key is taken after the page is faulted in and a copy-on-write page is made private,
+    so waiter and waker of a private futex agree on the frame
+  + value is compared under the bucket lock, a wake which happens after the check finds the waiter in the bucket
+  + waiter lives on the sleeping thread's stack, waker unlinks it before making it ready (same as semaphore)
+*/
+#define FUTEX_HASH_BITS 6
+#define FUTEX_HASH_SIZE (1 << FUTEX_HASH_BITS)
+
+struct futex_waiter
+{
+  struct list_head sibling;
+  uint32_t key;
+  struct thread *task;
+};
+
+struct futex_bucket
+{
+  spinlock_t lock;
+  struct list_head waiters;
+};
+
+static struct futex_bucket futex_queues[FUTEX_HASH_SIZE];
+
+static struct futex_bucket *futex_hash(uint32_t key)
+{
+  // word aligned keys, golden ratio hash spreads neighbouring words
+  return &futex_queues[((key >> 2) * 0x9E370001UL) >> (32 - FUTEX_HASH_BITS)];
+}
+
+static int32_t futex_get_key(int32_t *uaddr, uint32_t *key)
+{
+  uint32_t addr = (uint32_t)uaddr;
+  if (addr & 0x3 || addr >= KERNEL_HIGHER_HALF || !find_vma(current_process->mm, addr))
+    return -EINVAL;
+
+  // page fault handler maps an anonymous page on first touch
+  if (!vmm_is_page_present(addr))
+    (void)*(volatile int32_t *)uaddr;
+  if (vmm_get_physical_address(addr, true) & I86_PTE_COW)
+    vmm_cow_page(addr);
+  if (!vmm_is_page_present(addr))
+    return -EFAULT;
+
+  *key = vmm_get_physical_address(addr, false);
+  return 0;
+}
+
+int32_t futex_wait(int32_t *uaddr, int32_t val)
+{
+  uint32_t key;
+  int32_t ret = futex_get_key(uaddr, &key);
+  if (ret < 0)
+    return ret;
+
+  struct futex_bucket *fb = futex_hash(key);
+  uint32_t flags = irq_save();
+  spin_lock(&fb->lock);
+
+  if (*(volatile int32_t *)uaddr != val)
+  {
+    spin_unlock(&fb->lock);
+    irq_restore(flags);
+    return -EAGAIN;
+  }
+
+  struct futex_waiter waiter = {.key = key, .task = current_thread};
+  list_add_tail(&waiter.sibling, &fb->waiters);
+  update_thread(current_thread, THREAD_BLOCKED);
+  spin_unlock(&fb->lock);
+  schedule();
+  irq_restore(flags);
+
+  return 0;
+}
+
+// returns number of woken threads
+int32_t futex_wake(int32_t *uaddr, int32_t nr)
+{
+  uint32_t key;
+  int32_t ret = futex_get_key(uaddr, &key);
+  if (ret < 0)
+    return ret;
+
+  struct futex_bucket *fb = futex_hash(key);
+  uint32_t flags = irq_save();
+  spin_lock(&fb->lock);
+
+  struct futex_waiter *iter, *next;
+  list_for_each_entry_safe(iter, next, &fb->waiters, sibling)
+  {
+    if (ret >= nr)
+      break;
+    if (iter->key != key)
+      continue;
+
+    list_del(&iter->sibling);
+    update_thread(iter->task, THREAD_READY);
+    ret++;
+  }
+
+  spin_unlock(&fb->lock);
+  irq_restore(flags);
+
+  return ret;
+}
+
+int32_t do_futex(int32_t *uaddr, int32_t op, int32_t val)
+{
+  if (op == FUTEX_WAIT)
+    return futex_wait(uaddr, val);
+  else if (op == FUTEX_WAKE)
+    return futex_wake(uaddr, val);
+  else
+    return -EINVAL;
+}
+
+void futex_init()
+{
+  for (uint32_t i = 0; i < FUTEX_HASH_SIZE; ++i)
+  {
+    spin_lock_init(&futex_queues[i].lock);
+    INIT_LIST_HEAD(&futex_queues[i].waiters);
+  }
+}
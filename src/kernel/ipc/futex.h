@@ -0,0 +1,11 @@
+#ifndef IPC_FUTEX_H
+#define IPC_FUTEX_H
+
+#include <stdint.h>
+
+void futex_init();
+int32_t futex_wait(int32_t *uaddr, int32_t val);
+int32_t futex_wake(int32_t *uaddr, int32_t nr);
+int32_t do_futex(int32_t *uaddr, int32_t op, int32_t val);
+
+#endif
@@ -4,15 +4,17 @@
 #include <include/errno.h>
 #include "message_queue.h"
 
-extern struct thread *current_thread;
-
 struct semaphore mq_locking;
 struct hashmap mq_map;
+struct kmem_cache *mq_message_cache;
+struct kmem_cache *mq_receiver_cache;
 
 void mq_init()
 {
   sema_init(&mq_locking, 1);
   hashmap_init(&mq_map, hashmap_hash_string, hashmap_compare_string, 0);
+  mq_message_cache = kmem_cache_create("mq_message", sizeof(struct mq_message), 0);
+  mq_receiver_cache = kmem_cache_create("mq_receiver", sizeof(struct mq_receiver), 0);
 }
 
 int32_t mq_open(const char *name, int32_t flags)
@@ -69,7 +71,7 @@ int32_t mq_enqueue(const char *name, char *kernel_buf, int32_t mtype, uint32_t m
   }
   else
   {
-    struct mq_message *msg = kcalloc(1, sizeof(struct mq_message));
+    struct mq_message *msg = kmem_cache_zalloc(mq_message_cache);
     msg->buf = kernel_buf;
     msg->msize = msize;
     msg->mtype = mtype;
@@ -110,7 +112,7 @@ int32_t mq_send(const char *name, char *user_buf, int32_t mtype, uint32_t msize)
   }
   else
   {
-    struct mq_message *msg = kcalloc(1, sizeof(struct mq_message));
+    struct mq_message *msg = kmem_cache_zalloc(mq_message_cache);
     msg->buf = kernel_buf;
     msg->msize = msize;
     msg->mtype = mtype;
@@ -156,12 +158,12 @@ int32_t mq_receive(const char *name, char *user_buf, int32_t mtype, uint32_t msi
   }
   else
   {
-    struct mq_receiver *mqr = kcalloc(1, sizeof(struct mq_receiver));
+    struct mq_receiver *mqr = kmem_cache_zalloc(mq_receiver_cache);
     mqr->mtype = mtype;
     mqr->msize = msize;
     mqr->receiver = current_thread;
     list_add_tail(&mqr->sibling, &mq->receivers);
-    update_thread(current_thread, THREAD_WAITING);
+    update_thread(current_thread, THREAD_BLOCKED);
     schedule();
 
     if (!mqr->buf && mtype >= 0)
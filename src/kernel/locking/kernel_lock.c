@@ -0,0 +1,59 @@
+#include <kernel/cpu/hal.h>
+#include <kernel/proc/task.h>
+#include "spinlock.h"
+#include "kernel_lock.h"
+
+/*
+  Big kernel lock, only one cpu at a time runs code which was written for one cpu
+  (syscalls, page faults, kernel threads and legacy irq handlers -> vfs, net, ipc, memory management)
+  + recursive, depth is kept per thread
+  + schedule() drops it while the thread is switched out and takes it again when the thread continues
+  Scheduler, timers, semaphores, tlb shootdown and the page/slab/pkmap allocators have their own spinlocks
+  and never take it
+*/
+
+static spinlock_t kernel_flag = SPINLOCK_INITIALIZER;
+
+void lock_kernel()
+{
+  uint32_t flags = irq_save();
+
+  struct thread *t = current_thread;
+  // before the first thread is created, only bsp runs
+  if (t && t->lock_depth++ == 0)
+    spin_lock(&kernel_flag);
+
+  irq_restore(flags);
+}
+
+void unlock_kernel()
+{
+  uint32_t flags = irq_save();
+
+  struct thread *t = current_thread;
+  if (t && --t->lock_depth == 0)
+    spin_unlock(&kernel_flag);
+
+  irq_restore(flags);
+}
+
+uint32_t release_kernel_lock(struct thread *t)
+{
+  uint32_t depth = t->lock_depth;
+
+  if (depth)
+  {
+    t->lock_depth = 0;
+    spin_unlock(&kernel_flag);
+  }
+  return depth;
+}
+
+void reacquire_kernel_lock(struct thread *t, uint32_t depth)
+{
+  if (!depth)
+    return;
+
+  spin_lock(&kernel_flag);
+  t->lock_depth = depth;
+}
@@ -0,0 +1,13 @@
+#ifndef LOCKING_KERNEL_LOCK_H
+#define LOCKING_KERNEL_LOCK_H
+
+#include <stdint.h>
+
+struct thread;
+
+void lock_kernel();
+void unlock_kernel();
+uint32_t release_kernel_lock(struct thread *t);
+void reacquire_kernel_lock(struct thread *t, uint32_t depth);
+
+#endif
@@ -2,39 +2,43 @@
 #include <kernel/proc/task.h>
 #include "semaphore.h"
 
-extern struct thread *current_thread;
-
 struct semaphore_waiter
 {
   struct list_head sibling;
   struct thread *task;
 };
 
+/*
+  cli only protects against the local cpu, count and wait list are guarded by sem->lock
+  + waiter lives on the sleeping thread's stack (no allocation while holding the lock)
+  + thread is marked blocked before the lock is released, a release on another cpu which comes
+    before schedule() just makes it ready again and schedule() keeps it running
+*/
 void acquire_semaphore(struct semaphore *sem)
 {
-  disable_interrupts();
+  uint32_t flags = irq_save();
   spin_lock(&sem->lock);
   if (sem->count > 0)
   {
     sem->count--;
     spin_unlock(&sem->lock);
-    enable_interrupts();
+    irq_restore(flags);
   }
   else
   {
-    struct semaphore_waiter *waiter = kcalloc(1, sizeof(struct semaphore_waiter));
-    waiter->task = current_thread;
+    struct semaphore_waiter waiter = {.task = current_thread};
 
-    list_add_tail(&waiter->sibling, &sem->wait_list);
-    update_thread(current_thread, THREAD_WAITING);
+    list_add_tail(&waiter.sibling, &sem->wait_list);
+    update_thread(current_thread, THREAD_BLOCKED);
     spin_unlock(&sem->lock);
     schedule();
+    irq_restore(flags);
   }
 }
 
 void release_semaphore(struct semaphore *sem)
 {
-  disable_interrupts();
+  uint32_t flags = irq_save();
   spin_lock(&sem->lock);
   if (list_empty(&sem->wait_list))
   {
@@ -50,5 +54,5 @@ void release_semaphore(struct semaphore *sem)
   }
 
   spin_unlock(&sem->lock);
-  enable_interrupts();
-}
\ No newline at end of file
+  irq_restore(flags);
+}
@@ -15,7 +15,7 @@ struct semaphore
 
 #define __SEMAPHORE_INITIALIZER(name, n)           \
   {                                                \
-    .lock = 0,                                     \
+    .lock = SPINLOCK_INITIALIZER,                  \
     .count = n,                                    \
     .capacity = n,                                 \
     .wait_list = LIST_HEAD_INIT((name).wait_list), \
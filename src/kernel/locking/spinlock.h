@@ -1,6 +1,8 @@
 #ifndef LOCKING_SPINLOCK_H
 #define LOCKING_SPINLOCK_H
 
+#include <stdint.h>
+
 #define barrier() asm volatile("" \
                                :  \
                                :  \
@@ -12,42 +14,85 @@
                                  :         \
                                  : "memory")
 
-static inline unsigned short xchg_8(void *ptr, unsigned char x)
+/*
+  Ticket spinlock: `next` is the ticket of the next comer, `owner` is the ticket which holds the lock,
+  cpus get the lock in the order they asked for it (xchg lock let one cpu starve under contention)
+  A spinning cpu might have interrupts disabled, it still answers tlb shootdowns (smp_poll_ipi),
+  otherwise the cpu holding the lock could wait for it forever
+*/
+typedef union
 {
-  __asm__ __volatile__("xchgb %0,%1"
-                       : "=r"(x)
-                       : "m"(*(volatile unsigned char *)ptr), "0"(x)
+  volatile uint32_t slock;
+  struct
+  {
+    volatile uint16_t owner;
+    volatile uint16_t next;
+  } tickets;
+} spinlock_t;
+
+#define SPINLOCK_INITIALIZER \
+  {                          \
+    .slock = 0               \
+  }
+
+void smp_poll_ipi();
+
+static inline uint16_t xadd_16(volatile uint16_t *ptr, uint16_t x)
+{
+  __asm__ __volatile__("lock xaddw %0, %1"
+                       : "+r"(x), "+m"(*ptr)
+                       :
                        : "memory");
 
   return x;
 }
 
-#define BUSY 1
-typedef unsigned char spinlock_t;
+static inline uint32_t cmpxchg_32(volatile uint32_t *ptr, uint32_t old, uint32_t new)
+{
+  uint32_t prev;
+  __asm__ __volatile__("lock cmpxchgl %2, %1"
+                       : "=a"(prev), "+m"(*ptr)
+                       : "r"(new), "0"(old)
+                       : "memory");
+
+  return prev;
+}
 
-#define SPINLOCK_INITIALIZER 0
+static inline void spin_lock_init(spinlock_t *lock)
+{
+  lock->slock = 0;
+}
 
 static inline void spin_lock(spinlock_t *lock)
 {
-  while (1)
-  {
-    if (!xchg_8(lock, BUSY))
-      return;
+  uint16_t ticket = xadd_16(&lock->tickets.next, 1);
 
-    while (*lock)
-      cpu_relax();
+  while (lock->tickets.owner != ticket)
+  {
+    smp_poll_ipi();
+    cpu_relax();
   }
+  barrier();
 }
 
 static inline void spin_unlock(spinlock_t *lock)
 {
   barrier();
-  *lock = 0;
+  // only the holder writes owner
+  lock->tickets.owner++;
 }
 
+// nonzero -> lock is taken, 0 -> it is busy (nothing is changed)
 static inline int spin_trylock(spinlock_t *lock)
 {
-  return xchg_8(lock, BUSY);
+  uint32_t old = lock->slock;
+  uint16_t owner = old & 0xffff;
+  uint16_t next = old >> 16;
+
+  if (owner != next)
+    return 0;
+
+  return cmpxchg_32(&lock->slock, old, old + (1 << 16)) == old;
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -6,11 +6,16 @@
 #include "cpu/hal.h"
 #include "cpu/gdt.h"
 #include "cpu/idt.h"
+#include "cpu/lapic.h"
 #include "cpu/pit.h"
+#include "cpu/smp.h"
 #include "cpu/tss.h"
 #include "cpu/exception.h"
+#include "cpu/fpu.h"
 #include "system/sysapi.h"
 #include "system/time.h"
+#include "system/timer.h"
+#include "system/vdso.h"
 #include "proc/task.h"
 #include "devices/kybrd.h"
 #include "devices/mouse.h"
@@ -26,10 +31,12 @@
 #include "devices/char/memory.h"
 #include "system/uiserver.h"
 #include "ipc/message_queue.h"
+#include "ipc/futex.h"
 #include "system/console.h"
+#include "system/benchmark.h"
+#include "proc/workqueue.h"
 #include "multiboot2.h"
 
-extern struct thread *current_thread;
 extern struct vfs_file_system_type ext2_fs_type;
 
 void setup_window_server(struct Elf32_Layout *elf_layout)
@@ -38,15 +45,15 @@ void setup_window_server(struct Elf32_Layout *elf_layout)
   mq_open(WINDOW_SERVER_SHM, 0);
 
   struct framebuffer *fb = get_framebuffer();
-  uint32_t screen_size = fb->height * fb->pitch;
-  struct vm_area_struct *area = get_unmapped_area(0, screen_size);
-  uint32_t blocks = (area->vm_end - area->vm_start) / PMM_FRAME_SIZE;
-  for (uint32_t iblock = 0; iblock < blocks; ++iblock)
-    vmm_map_address(
-        current_thread->parent->pdir,
-        area->vm_start + iblock * PMM_FRAME_SIZE,
-        fb->addr + iblock * PMM_FRAME_SIZE,
-        I86_PTE_PRESENT | I86_PTE_WRITABLE | I86_PTE_USER);
+  uint32_t screen_size = get_framebuffer_map_size(fb);
+  struct vm_area_struct *area = get_unmapped_aligned_area(0, screen_size, LARGE_PAGE_SIZE);
+  area->vm_flags = VM_READ | VM_WRITE | VM_SHARED;
+  vmm_map_range(
+      current_thread->parent->pdir,
+      area->vm_start,
+      fb->addr,
+      area->vm_end - area->vm_start,
+      I86_PTE_PRESENT | I86_PTE_WRITABLE | I86_PTE_USER);
 
   elf_layout->stack -= sizeof(struct framebuffer);
   struct framebuffer *ws_fb = (struct framebuffer *)elf_layout->stack;
@@ -59,6 +66,12 @@ void kernel_init()
   // setup random's seed
   srand(get_seconds(NULL));
 
+  // kworker for deferred work of irq handlers (network, input)
+  workqueue_init();
+
+  // frees terminated threads and exited processes
+  reaper_init();
+
   // FIXME: MQ 2019-11-19 ata_init is not called in pci_scan_buses without enabling -O2
   pci_init();
   ata_init();
@@ -68,23 +81,45 @@ void kernel_init()
 
   console_setup();
 
+  uint32_t unmanaged_frames = get_unmanaged_frames();
+  if (unmanaged_frames)
+    printf("pmm: frame table is capped to the boot mapping, %d MB of memory are not used\n",
+           unmanaged_frames / (1024 * 1024 / PMM_FRAME_SIZE));
+
+#ifdef CONFIG_BENCHMARK
+  kmalloc_benchmark();
+  thread_benchmark();
+  file_teardown_check();
+#endif
+
   rtl8139_init();
   dhcp_discovery();
 
   // init ipc message queue
   mq_init();
+  futex_init();
+
+  // pre-zeroed frames, filled while cpu is idle
+  zpool_init();
+
+  // application processors, they take threads from now on
+  smp_init();
 
   // register system apis
   syscall_init();
 
-  // process_load("window server", "/bin/window_server", 0, setup_window_server);
+#ifdef CONFIG_BENCHMARK
+  deferred_work_stats_init();
+#endif
 
-  // idle
-  // update_thread(current_thread, THREAD_WAITING);
-  // schedule();
+  // process_load("window server", "/bin/window_server", THREAD_SYSTEM_POLICY, 0, setup_window_server);
 
+  // idle, init doesn't spin (holding big kernel lock) while other cpus have work
   for (;;)
-    ;
+  {
+    update_thread(current_thread, THREAD_BLOCKED);
+    schedule();
+  }
 }
 
 int kernel_main(unsigned long addr, unsigned long magic)
@@ -131,11 +166,22 @@ int kernel_main(unsigned long addr, unsigned long magic)
   // physical memory and paging
   pmm_init(multiboot_meminfo, multiboot_mmap);
   vmm_init();
+  kmem_cache_init();
+
+  // #DF runs on its own stack, takes cr3 of the kernel directory
+  install_double_fault_tss(7);
 
   exception_init();
 
+  // fpu/sse, registers are handed to threads lazily
+  fpu_init();
+
+  // read-only time page for userspace, pit ticks keep it up to date
+  vdso_init();
+
   // timer and keyboard
   pit_init();
+  timer_init();
   kkybrd_install();
   mouse_init();
 
@@ -144,6 +190,9 @@ int kernel_main(unsigned long addr, unsigned long magic)
   // enable interrupts to start irqs (timer, keyboard)
   enable_interrupts();
 
+  // lapic timer is calibrated against pit ticks
+  lapic_init();
+
   task_init(kernel_init);
 
   for (;;)
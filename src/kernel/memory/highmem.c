@@ -1,12 +1,14 @@
+#include <kernel/cpu/hal.h>
+#include <kernel/locking/spinlock.h>
 #include <kernel/proc/task.h>
 #include "vmm.h"
 
 #define PKMAP_BASE 0xE0000000
 #define LAST_PKMAP 1024
 
-extern struct process *current_process;
-
+// pkmap_lock (interrupts off) guards the bitmap, a reserved slot belongs to its caller until kunmap
 uint32_t pkmap[LAST_PKMAP];
+static spinlock_t pkmap_lock = SPINLOCK_INITIALIZER;
 
 void pkmap_bitmap_set(uint32_t block)
 {
@@ -75,22 +77,32 @@ int get_pkmaps_free(size_t size)
 
 void kmap(struct page *p)
 {
+  uint32_t flags = irq_save();
+  spin_lock(&pkmap_lock);
   uint32_t block = get_pkmap_free();
-  uint32_t vaddr = block * PMM_FRAME_SIZE + PKMAP_BASE;
-
   pkmap_bitmap_set(block);
-  vmm_map_address(current_process->pdir, vaddr, p->frame, I86_PTE_PRESENT | I86_PTE_WRITABLE);
+  spin_unlock(&pkmap_lock);
+  irq_restore(flags);
+
+  uint32_t vaddr = block * PMM_FRAME_SIZE + PKMAP_BASE;
+  // pkmap is kernel space (same in every page directory), kmap also works before the first process (zpool)
+  vmm_map_address(vmm_get_directory(), vaddr, p->frame, I86_PTE_PRESENT | I86_PTE_WRITABLE);
   p->virtual = vaddr;
 }
 
 void kmaps(struct pages *p)
 {
+  uint32_t flags = irq_save();
+  spin_lock(&pkmap_lock);
   uint32_t block = get_pkmaps_free(p->number_of_frames);
-  uint32_t vaddr = block * PMM_FRAME_SIZE + PKMAP_BASE;
+  for (uint32_t i = 0; i < p->number_of_frames; ++i)
+    pkmap_bitmap_set(block + i);
+  spin_unlock(&pkmap_lock);
+  irq_restore(flags);
 
+  uint32_t vaddr = block * PMM_FRAME_SIZE + PKMAP_BASE;
   for (uint32_t i = 0; i < p->number_of_frames; ++i)
   {
-    pkmap_bitmap_set(block + i);
     vmm_map_address(current_process->pdir, vaddr + i * PMM_FRAME_SIZE, p->paddr + i * PMM_FRAME_SIZE, I86_PTE_PRESENT | I86_PTE_WRITABLE);
   }
   p->vaddr = vaddr;
@@ -102,8 +114,13 @@ void kunmap(struct page *p)
     return;
 
   uint32_t block = (p->virtual - PKMAP_BASE) / PMM_FRAME_SIZE;
+  vmm_unmap_address(vmm_get_directory(), p->virtual);
+
+  uint32_t flags = irq_save();
+  spin_lock(&pkmap_lock);
   pkmap_bitmap_unset(block);
-  vmm_unmap_address(current_process->pdir, p->virtual);
+  spin_unlock(&pkmap_lock);
+  irq_restore(flags);
 }
 
 void kunmaps(struct pages *p)
@@ -113,8 +130,12 @@ void kunmaps(struct pages *p)
 
   uint32_t block = (p->vaddr - PKMAP_BASE) / PMM_FRAME_SIZE;
   for (uint32_t i = 0; i < p->number_of_frames; ++i)
-  {
-    pkmap_bitmap_unset(block + i);
     vmm_unmap_address(current_process->pdir, p->vaddr + i * PMM_FRAME_SIZE);
-  }
+
+  uint32_t flags = irq_save();
+  spin_lock(&pkmap_lock);
+  for (uint32_t i = 0; i < p->number_of_frames; ++i)
+    pkmap_bitmap_unset(block + i);
+  spin_unlock(&pkmap_lock);
+  irq_restore(flags);
 }
\ No newline at end of file
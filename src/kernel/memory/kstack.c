@@ -0,0 +1,106 @@
+#include <kernel/cpu/hal.h>
+#include <kernel/locking/spinlock.h>
+#include <kernel/proc/task.h>
+#include "vmm.h"
+
+/*
+  Kernel stacks have their own virtual range instead of kernel heap, each slot is
+  +-----------------------+ slot + KSTACK_SLOT_SIZE (initial esp)
+  | stack (STACK_SIZE)    |
+  +-----------------------+ slot + KSTACK_GUARD_SIZE
+  | guard (never mapped)  |
+  +-----------------------+ slot
+  + overflow runs into the guard page instead of corrupting heap objects next to it, the page fault cannot be
+    pushed on the overflowed stack and becomes #DF, which switches to its own stack (task gate) and panics
+  + freed stack keeps its frames and goes to the free list, allocation is a pop (no first-fit walk)
+  Stacks are not zeroed, every thread builds its own trap frame on top of it
+*/
+
+#define KSTACK_GUARD_SIZE PMM_FRAME_SIZE
+#define KSTACK_SLOT_SIZE (KSTACK_GUARD_SIZE + STACK_SIZE)
+
+struct kstack_free
+{
+  struct kstack_free *next;
+};
+
+static spinlock_t kstack_lock = SPINLOCK_INITIALIZER;
+static struct kstack_free *free_stacks;
+static uint32_t kstack_next = KERNEL_STACK_BOTTOM;
+
+// slot which was never handed out goes back to the range if nothing was carved after it
+static void release_kernel_stack_slot(uint32_t slot)
+{
+  uint32_t flags = irq_save();
+  spin_lock(&kstack_lock);
+
+  if (kstack_next == slot + KSTACK_SLOT_SIZE)
+    kstack_next = slot;
+
+  spin_unlock(&kstack_lock);
+  irq_restore(flags);
+}
+
+// returns top of the stack, 0 when the range or physical memory is used up
+uint32_t alloc_kernel_stack()
+{
+  uint32_t flags = irq_save();
+  spin_lock(&kstack_lock);
+
+  struct kstack_free *stack = free_stacks;
+  uint32_t slot = 0;
+  if (stack)
+    free_stacks = stack->next;
+  else if (kstack_next + KSTACK_SLOT_SIZE <= KERNEL_STACK_TOP)
+  {
+    slot = kstack_next;
+    kstack_next += KSTACK_SLOT_SIZE;
+  }
+
+  spin_unlock(&kstack_lock);
+  irq_restore(flags);
+
+  if (stack)
+    return (uint32_t)stack + STACK_SIZE;
+  if (!slot)
+    return 0;
+
+  // kernel page tables are preallocated and shared by every address space
+  uint32_t bottom = slot + KSTACK_GUARD_SIZE;
+  for (uint32_t addr = bottom; addr < bottom + STACK_SIZE; addr += PMM_FRAME_SIZE)
+  {
+    void *frame = alloc_page(0);
+    if (frame)
+    {
+      vmm_map_address(vmm_get_directory(), addr, (uint32_t)frame, I86_PTE_PRESENT | I86_PTE_WRITABLE);
+      continue;
+    }
+
+    // out of memory, give back pages which are already mapped
+    for (uint32_t mapped = bottom; mapped < addr; mapped += PMM_FRAME_SIZE)
+    {
+      uint32_t paddr = vmm_get_physical_address(mapped, false);
+      vmm_unmap_address(vmm_get_directory(), mapped);
+      pmm_free_block((void *)paddr);
+    }
+    release_kernel_stack_slot(slot);
+    return 0;
+  }
+
+  return bottom + STACK_SIZE;
+}
+
+// nothing runs on the stack anymore (reaper checks on_cpu)
+void free_kernel_stack(uint32_t top)
+{
+  struct kstack_free *stack = (struct kstack_free *)(top - STACK_SIZE);
+
+  uint32_t flags = irq_save();
+  spin_lock(&kstack_lock);
+
+  stack->next = free_stacks;
+  free_stacks = stack;
+
+  spin_unlock(&kstack_lock);
+  irq_restore(flags);
+}
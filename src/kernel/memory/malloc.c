@@ -2,6 +2,7 @@
 #include <kernel/utils/string.h>
 #include <stdbool.h>
 #include "vmm.h"
+#include "slab.h"
 
 #define BLOCK_MAGIC 0x464E
 
@@ -65,7 +66,7 @@ struct block_meta *request_space(struct block_meta *last, size_t size)
   return block;
 }
 
-void *kmalloc(size_t size)
+void *kmalloc_block(size_t size)
 {
   if (size <= 0)
     return NULL;
@@ -98,6 +99,22 @@ void *kmalloc(size_t size)
     return NULL;
 }
 
+void *kmalloc(size_t size)
+{
+  if (size <= 0)
+    return NULL;
+
+  struct kmem_cache *cache = kmalloc_cache(size);
+  if (cache)
+  {
+    void *obj = kmem_cache_alloc(cache);
+    if (obj)
+      return obj;
+  }
+
+  return kmalloc_block(size);
+}
+
 void *kcalloc(size_t n, size_t size)
 {
   void *block = kmalloc(n * size);
@@ -111,14 +128,37 @@ struct block_meta *get_block_ptr(void *ptr)
   return (struct block_meta *)ptr - 1;
 }
 
-void kfree(void *ptr)
+// merge with following free blocks which are next to it in heap space
+void merge_block(struct block_meta *block)
 {
-  if (!ptr)
-    return;
+  while (block->next && block->next->free &&
+         (char *)(block + 1) + block->size == (char *)block->next)
+  {
+    block->size += sizeof(struct block_meta) + block->next->size;
+    block->next = block->next->next;
+  }
+}
 
+void kfree_block(void *ptr)
+{
   struct block_meta *block = get_block_ptr(ptr);
   validate_kblock(block);
   block->free = true;
+  merge_block(block);
+}
+
+void kfree(void *ptr)
+{
+  if (!ptr)
+    return;
+
+  if (is_slab_object(ptr))
+  {
+    struct slab *slab = (struct slab *)((uint32_t)ptr & SLAB_MASK);
+    kmem_cache_free(slab->cache, ptr);
+  }
+  else
+    kfree_block(ptr);
 }
 
 // NOTE: MQ 2019-11-24
@@ -143,13 +183,26 @@ void *kalign_heap(size_t size)
 
   while (padding_size <= KERNEL_HEAP_TOP)
   {
+    // padding has to come from heap space, small sizes are served by slab caches
     if (padding_size > required_size)
-      return kcalloc(padding_size - required_size, sizeof(char));
+      return kmalloc_block(padding_size - required_size);
     padding_size += size;
   }
   return NULL;
 }
 
+// bytes of heap blocks which are in use, used to spot leaks
+size_t kmalloc_block_used()
+{
+  size_t used = 0;
+  for (struct block_meta *block = kblocklist; block; block = block->next)
+  {
+    if (!block->free)
+      used += block->size;
+  }
+  return used;
+}
+
 void *krealloc(void *ptr, size_t size)
 {
   if (!ptr && size == 0)
@@ -160,7 +213,12 @@ void *krealloc(void *ptr, size_t size)
   else if (!ptr)
     return kcalloc(size, sizeof(char));
 
+  size_t old_size = is_slab_object(ptr) ? ksize(ptr) : get_block_ptr(ptr)->size;
+  if (size <= old_size)
+    return ptr;
+
   void *newptr = kcalloc(size, sizeof(char));
-  memcpy(newptr, ptr, size);
+  memcpy(newptr, ptr, old_size);
+  kfree(ptr);
   return newptr;
-}
\ No newline at end of file
+}
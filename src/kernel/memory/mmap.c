@@ -1,137 +1,435 @@
+#include <include/errno.h>
+#include <include/mman.h>
+#include <include/vdso.h>
 #include <kernel/fs/vfs.h>
 #include <kernel/proc/task.h>
 #include <kernel/memory/vmm.h>
 #include "vmm.h"
 
-extern struct process *current_process;
+extern struct kmem_cache *vm_area_cache;
 
-// TODO: MQ 2020-01-25 Add support for release block when there is no reference to frame block
+// [MMAP_MIN_ADDR, MMAP_MAX_ADDR) is user space which can be mapped (see memory layout in vmm.c)
+#define MMAP_MIN_ADDR 0x00100000
+#define MMAP_MAX_ADDR VDSO_TIME_ADDRESS
 
-struct vm_area_struct *get_unmapped_area(uint32_t addr, uint32_t len)
+/*
+  vmas are kept in rbtree sorted by vm_start, every node stores the largest free gap (before a vma) in its subtree
+        [vma 3] (gap 0x1000, subtree gap 0x8000)
+         /    \
+  [vma 1]      [vma 5]
+  (gap 0x8000)  (gap 0)
+  find_vma and get_unmapped_area are O(log n), find_vma also keeps the last hit in mm->mmap_cache
+*/
+
+static struct vm_area_struct *vma_prev(struct vm_area_struct *vma)
 {
-  struct mm_struct *mm = current_process->mm;
-  struct vm_area_struct *vma = kcalloc(1, sizeof(struct vm_area_struct));
-  vma->vm_mm = mm;
+  if (vma->vm_sibling.prev == &vma->vm_mm->mmap)
+    return NULL;
+  return list_prev_entry(vma, vm_sibling);
+}
 
-  if (!addr || addr < mm->end_brk)
-    addr = max(mm->free_area_cache, mm->end_brk);
-  addr = PAGE_ALIGN(addr);
-  len = PAGE_ALIGN(len);
+static struct vm_area_struct *vma_next(struct vm_area_struct *vma)
+{
+  if (list_is_last(&vma->vm_sibling, &vma->vm_mm->mmap))
+    return NULL;
+  return list_next_entry(vma, vm_sibling);
+}
 
-  uint32_t found_addr = addr;
-  if (list_empty(&mm->mmap))
-    list_add(&vma->vm_sibling, &mm->mmap);
-  else
+// free space between previous vma and this one
+static uint32_t vma_gap(struct vm_area_struct *vma)
+{
+  struct vm_area_struct *prev = vma_prev(vma);
+  uint32_t prev_end = prev ? prev->vm_end : 0;
+  return vma->vm_start > prev_end ? vma->vm_start - prev_end : 0;
+}
+
+static void vma_compute_subtree_gap(struct rb_node *node)
+{
+  struct vm_area_struct *vma = rb_entry(node, struct vm_area_struct, vm_rb);
+  uint32_t max_gap = vma_gap(vma);
+
+  if (node->rb_left)
+    max_gap = max(max_gap, rb_entry(node->rb_left, struct vm_area_struct, vm_rb)->rb_subtree_gap);
+  if (node->rb_right)
+    max_gap = max(max_gap, rb_entry(node->rb_right, struct vm_area_struct, vm_rb)->rb_subtree_gap);
+
+  vma->rb_subtree_gap = max_gap;
+}
+
+static void vma_gap_update(struct vm_area_struct *vma)
+{
+  if (vma)
+    rb_augment_path(&vma->vm_rb, vma_compute_subtree_gap);
+}
+
+void vma_link(struct mm_struct *mm, struct vm_area_struct *vma)
+{
+  struct rb_node **link = &mm->mm_rb.rb_node, *parent = NULL;
+  struct vm_area_struct *prev = NULL;
+
+  while (*link)
   {
-    struct vm_area_struct *iter = NULL;
-    list_for_each_entry(iter, &mm->mmap, vm_sibling)
+    parent = *link;
+    struct vm_area_struct *iter = rb_entry(parent, struct vm_area_struct, vm_rb);
+    if (vma->vm_start < iter->vm_start)
+      link = &parent->rb_left;
+    else
     {
-      struct vm_area_struct *next = list_next_entry(iter, vm_sibling);
-      bool is_last_entry = list_is_last(&iter->vm_sibling, &mm->mmap);
+      prev = iter;
+      link = &parent->rb_right;
+    }
+  }
+
+  vma->vm_mm = mm;
+  list_add(&vma->vm_sibling, prev ? &prev->vm_sibling : &mm->mmap);
+  rb_link_node(&vma->vm_rb, parent, link);
+  rb_insert_color(&vma->vm_rb, &mm->mm_rb, vma_compute_subtree_gap);
+  vma_gap_update(vma_next(vma));
+}
+
+void vma_unlink(struct mm_struct *mm, struct vm_area_struct *vma)
+{
+  struct vm_area_struct *next = vma_next(vma);
+
+  rb_erase(&vma->vm_rb, &mm->mm_rb, vma_compute_subtree_gap);
+  list_del(&vma->vm_sibling);
+  vma_gap_update(next);
+
+  if (mm->mmap_cache == vma)
+    mm->mmap_cache = NULL;
+}
 
-      if (addr + len <= iter->vm_start)
+// vma's range is changed in place (without crossing its neighbours)
+static void vma_adjust(struct vm_area_struct *vma, uint32_t start, uint32_t end)
+{
+  vma->vm_start = start;
+  vma->vm_end = end;
+  vma_gap_update(vma);
+  vma_gap_update(vma_next(vma));
+}
+
+static struct vm_area_struct *find_vma_intersection(struct mm_struct *mm, uint32_t start, uint32_t end)
+{
+  struct rb_node *node = mm->mm_rb.rb_node;
+  while (node)
+  {
+    struct vm_area_struct *vma = rb_entry(node, struct vm_area_struct, vm_rb);
+    if (vma->vm_end <= start)
+      node = node->rb_right;
+    else if (vma->vm_start >= end)
+      node = node->rb_left;
+    else
+      return vma;
+  }
+  return NULL;
+}
+
+// lowest gap which fits [addr, addr + length) in [low_limit, high_limit) with addr aligned by `align`, 0 if there is none
+static uint32_t unmapped_area(struct mm_struct *mm, uint32_t length, uint32_t align, uint32_t low_limit, uint32_t high_limit)
+{
+  uint32_t gap_start, gap_end;
+  uint32_t min_addr = low_limit;
+  // vmas are always page aligned, only larger alignments need extra room
+  uint32_t align_mask = (align - 1) & PAGE_MASK;
+  struct vm_area_struct *vma;
+
+  // the gap has to be larger to leave room for aligning the start
+  length += align_mask;
+  if (length < align_mask || high_limit < length)
+    return 0;
+  high_limit -= length;
+  if (low_limit > high_limit)
+    return 0;
+  low_limit += length;
+
+  if (RB_EMPTY_ROOT(&mm->mm_rb))
+    goto check_highest;
+  vma = rb_entry(mm->mm_rb.rb_node, struct vm_area_struct, vm_rb);
+  if (vma->rb_subtree_gap < length)
+    goto check_highest;
+
+  while (true)
+  {
+    // visit left subtree if it looks promising
+    gap_end = vma->vm_start;
+    if (gap_end >= low_limit && vma->vm_rb.rb_left)
+    {
+      struct vm_area_struct *left = rb_entry(vma->vm_rb.rb_left, struct vm_area_struct, vm_rb);
+      if (left->rb_subtree_gap >= length)
       {
-        list_add(&iter->vm_sibling, &mm->mmap);
-        break;
+        vma = left;
+        continue;
       }
-      else if (addr >= iter->vm_end &&
-               (is_last_entry ||
-                (!is_last_entry && addr + len <= next->vm_start)))
+    }
+
+    struct vm_area_struct *prev = vma_prev(vma);
+    gap_start = prev ? prev->vm_end : 0;
+  check_current:
+    if (gap_start > high_limit)
+      return 0;
+    if (gap_end >= low_limit && gap_end > gap_start && gap_end - gap_start >= length)
+      goto found;
+
+    // visit right subtree if it looks promising
+    if (vma->vm_rb.rb_right)
+    {
+      struct vm_area_struct *right = rb_entry(vma->vm_rb.rb_right, struct vm_area_struct, vm_rb);
+      if (right->rb_subtree_gap >= length)
       {
-        list_add(&vma->vm_sibling, &iter->vm_sibling);
-        break;
+        vma = right;
+        continue;
       }
-      else if (!is_last_entry &&
-               (iter->vm_end <= addr && addr < next->vm_start) && next->vm_start - iter->vm_end >= len)
+    }
+
+    // go back up to find the next candidate (the first ancestor we reach from its left subtree)
+    while (true)
+    {
+      struct rb_node *node = &vma->vm_rb;
+      if (!node->rb_parent)
+        goto check_highest;
+      vma = rb_entry(node->rb_parent, struct vm_area_struct, vm_rb);
+      if (node == vma->vm_rb.rb_left)
       {
-        list_add(&vma->vm_sibling, &iter->vm_sibling);
-        found_addr = next->vm_start - len;
-        break;
+        prev = vma_prev(vma);
+        gap_start = prev ? prev->vm_end : 0;
+        gap_end = vma->vm_start;
+        goto check_current;
       }
     }
   }
 
-  if (found_addr)
-  {
-    vma->vm_start = found_addr;
-    vma->vm_end = found_addr + len;
-    mm->free_area_cache = vma->vm_end;
-  }
+check_highest:
+  gap_start = list_empty(&mm->mmap) ? 0 : list_last_entry(&mm->mmap, struct vm_area_struct, vm_sibling)->vm_end;
+  if (gap_start > high_limit)
+    return 0;
+
+found:
+  gap_start = max(gap_start, min_addr);
+  return (gap_start + align_mask) & ~align_mask;
+}
+
+struct vm_area_struct *get_unmapped_area(uint32_t addr, uint32_t len)
+{
+  return get_unmapped_aligned_area(addr, len, PMM_FRAME_SIZE);
+}
+
+struct vm_area_struct *get_unmapped_aligned_area(uint32_t addr, uint32_t len, uint32_t align)
+{
+  struct mm_struct *mm = current_process->mm;
+  len = PAGE_ALIGN(len);
+
+  if (!addr || addr < mm->end_brk)
+    addr = 0;
+  addr = PAGE_ALIGN(addr);
+
+  // Hint is used as it is when the range is free (elf segments), otherwise take the lowest gap above heap
+  if (!addr || (addr & (align - 1)) || find_vma_intersection(mm, addr, addr + len))
+    addr = unmapped_area(mm, len, align, max_t(uint32_t, mm->end_brk, MMAP_MIN_ADDR), MMAP_MAX_ADDR);
+
+  if (!addr)
+    return NULL;
+
+  struct vm_area_struct *vma = kmem_cache_zalloc(vm_area_cache);
+  vma->vm_start = addr;
+  vma->vm_end = addr + len;
+  vma_link(mm, vma);
 
   return vma;
 }
 
 struct vm_area_struct *find_vma(struct mm_struct *mm, uint32_t addr)
 {
-  struct vm_area_struct *iter = NULL;
-  list_for_each_entry(iter, &mm->mmap, vm_sibling)
+  struct vm_area_struct *vma = mm->mmap_cache;
+  if (vma && vma->vm_start <= addr && addr < vma->vm_end)
+    return vma;
+
+  struct rb_node *node = mm->mm_rb.rb_node;
+  while (node)
   {
-    if (iter->vm_start <= addr && addr < iter->vm_end)
-      return iter;
+    vma = rb_entry(node, struct vm_area_struct, vm_rb);
+    if (addr < vma->vm_start)
+      node = node->rb_left;
+    else if (addr >= vma->vm_end)
+      node = node->rb_right;
+    else
+    {
+      mm->mmap_cache = vma;
+      return vma;
+    }
   }
 
   return NULL;
 }
 
-// NOTE: MQ 2020-01-25 We only support unmap in one area
+// file mapping drops its reference to the file
+static void vma_free(struct vm_area_struct *vma)
+{
+  if (vma->vm_file)
+    fput(vma->vm_file);
+  kmem_cache_free(vm_area_cache, vma);
+}
+
+/*
+  Unmapped pages drop their frame reference (pmm_free_block), frame is released when nobody maps it anymore
+  vma which is partially unmapped is trimmed, unmapping the middle splits it into two
+*/
 int do_munmap(struct mm_struct *mm, uint32_t addr, size_t len)
 {
-  struct vm_area_struct *vma = find_vma(mm, addr);
-  if (!vma || vma->vm_start < addr)
-    return 0;
+  if (addr & ~PAGE_MASK)
+    return -EINVAL;
 
   len = PAGE_ALIGN(len);
-  if (vma->vm_end - vma->vm_start >= len)
-    vma->vm_end = addr;
-  else
-    list_del(&vma->vm_sibling);
+  if (!len || addr + len < addr)
+    return -EINVAL;
+
+  uint32_t end = addr + len;
+  struct vm_area_struct *vma;
+  while ((vma = find_vma_intersection(mm, addr, end)))
+  {
+    uint32_t start = max(vma->vm_start, addr);
+    uint32_t stop = min(vma->vm_end, end);
+    vmm_unmap_range(current_process->pdir, start, stop);
+
+    if (start == vma->vm_start && stop == vma->vm_end)
+    {
+      vma_unlink(mm, vma);
+      vma_free(vma);
+    }
+    else if (start == vma->vm_start)
+      vma_adjust(vma, stop, vma->vm_end);
+    else if (stop == vma->vm_end)
+      vma_adjust(vma, vma->vm_start, start);
+    else
+    {
+      struct vm_area_struct *tail = kmem_cache_zalloc(vm_area_cache);
+      tail->vm_start = stop;
+      tail->vm_end = vma->vm_end;
+      tail->vm_flags = vma->vm_flags;
+      tail->vm_file = vma->vm_file ? get_file(vma->vm_file) : NULL;
+      tail->vm_pgoff = vma->vm_pgoff + (stop - vma->vm_start);
+      tail->vm_file_end = vma->vm_file_end;
+
+      vma_adjust(vma, vma->vm_start, start);
+      vma_link(mm, tail);
+    }
+  }
 
   return 0;
 }
 
+// vmas only, frames are released by whoever owns the page directory
+void free_vmas(struct mm_struct *mm)
+{
+  struct vm_area_struct *iter, *next;
+  list_for_each_entry_safe(iter, next, &mm->mmap, vm_sibling)
+  {
+    vma_free(iter);
+  }
+
+  INIT_LIST_HEAD(&mm->mmap);
+  mm->mm_rb = RB_ROOT;
+  mm->mmap_cache = NULL;
+}
+
+// Called by the last thread of an exiting process, its page directory is the current one
+void exit_mmap(struct mm_struct *mm)
+{
+  vmm_free_user_space(current_process->pdir);
+  free_vmas(mm);
+}
+
 int32_t do_mmap(uint32_t addr,
                 size_t len, uint32_t prot,
                 uint32_t flag, int32_t fd)
 {
   struct vfs_file *file = fd >= 0 ? current_process->files->fd[fd] : NULL;
   struct vm_area_struct *vma = get_unmapped_area(addr, len);
+  if (!vma)
+    return -ENOMEM;
+
+  vma->vm_flags = prot & (VM_READ | VM_WRITE | VM_EXEC);
+  if (flag & MAP_SHARED)
+    vma->vm_flags |= VM_SHARED;
 
+  // Anonymous area only records the range, frames are allocated on first touch (do_anonymous_page)
   if (file)
   {
     file->f_op->mmap(file, vma);
-    vma->vm_file = file;
+    vma->vm_file = get_file(file);
+    vma->vm_file_end = vma->vm_end;
   }
-  else
-    for (uint32_t vaddr = vma->vm_start; vaddr < vma->vm_end; vaddr += PMM_FRAME_SIZE)
-    {
-      uint32_t paddr = (uint32_t)pmm_alloc_block();
-      vmm_map_address(current_process->pdir, vaddr, paddr, I86_PTE_PRESENT | I86_PTE_WRITABLE | I86_PTE_USER);
-    }
 
   return vma->vm_start;
 }
 
-int expand_area(struct vm_area_struct *vma, unsigned long address)
+/*
+  Demand paging for anonymous areas (heap, stack, elf segments, mmap without file)
+  A not-present fault inside such area gets a zero-filled frame (from pre-zeroed pool), everything else is a real fault
+*/
+int32_t do_anonymous_page(uint32_t addr)
+{
+  if (addr >= KERNEL_HIGHER_HALF || !current_process || !current_process->mm)
+    return -EFAULT;
+
+  struct vm_area_struct *vma = find_vma(current_process->mm, addr);
+  if (!vma || vma->vm_file)
+    return -EFAULT;
+
+  uint32_t paddr = (uint32_t)alloc_page(GFP_ZERO);
+  if (!paddr)
+    return -ENOMEM;
+
+  uint32_t flags = I86_PTE_PRESENT | I86_PTE_USER;
+  if (vma->vm_flags & VM_WRITE)
+    flags |= I86_PTE_WRITABLE;
+  vmm_map_address(current_process->pdir, addr & PAGE_MASK, paddr, flags);
+
+  return 0;
+}
+
+/*
+  Demand paging for private file mappings (elf segments)
+  A not-present fault maps the page from the file's page cache (filemap.c) when the whole page is file content,
+  otherwise (last page of a segment) it is read into a fresh zero-filled frame, the part after vm_file_end stays zero
+  Private frame belongs to the process, writable segment maps it writable, text is mapped read-only
+*/
+int32_t do_file_page(uint32_t addr)
 {
-  address = PAGE_ALIGN(address);
-  if (address <= vma->vm_end)
+  if (addr >= KERNEL_HIGHER_HALF || !current_process || !current_process->mm)
+    return -EFAULT;
+
+  struct vm_area_struct *vma = find_vma(current_process->mm, addr);
+  if (!vma || !vma->vm_file || (vma->vm_flags & VM_SHARED))
+    return -EFAULT;
+
+  uint32_t vaddr = addr & PAGE_MASK;
+  uint32_t pos = vma->vm_pgoff + (vaddr - vma->vm_start);
+
+  // whole page comes from the file -> map the cached frame, writable segment gets it copy-on-write
+  uint32_t frame = vaddr + PMM_FRAME_SIZE <= vma->vm_file_end ? filemap_get_page(vma->vm_file, pos) : 0;
+  if (frame)
+  {
+    vmm_map_address(current_process->pdir, vaddr, frame, I86_PTE_PRESENT | I86_PTE_USER | (vma->vm_flags & VM_WRITE ? I86_PTE_COW : 0));
     return 0;
+  }
 
-  if (list_is_last(&vma->vm_sibling, &current_process->mm->mmap))
-    vma->vm_end = address;
-  else
+  struct page p = {.frame = (uint32_t)alloc_page(GFP_ZERO)};
+  if (!p.frame)
+    return -ENOMEM;
+
+  if (vaddr < vma->vm_file_end)
   {
-    struct vm_area_struct *next = list_next_entry(vma, vm_sibling);
-    if (address <= next->vm_start)
-      vma->vm_end = address;
-    else
-    {
-      list_del(&vma->vm_sibling);
-      struct vm_area_struct *vma_expand = get_unmapped_area(0, address - vma->vm_start);
-      memcpy(vma, vma_expand, sizeof(struct vm_area_struct));
-      kfree(vma_expand);
-    }
+    struct vfs_file *file = vma->vm_file;
+    kmap(&p);
+    file->f_op->read(file, (char *)p.virtual, min_t(uint32_t, PMM_FRAME_SIZE, vma->vm_file_end - vaddr), pos);
+    kunmap(&p);
   }
+
+  uint32_t flags = I86_PTE_PRESENT | I86_PTE_USER;
+  if (vma->vm_flags & VM_WRITE)
+    flags |= I86_PTE_WRITABLE;
+  vmm_map_address(current_process->pdir, vaddr, p.frame, flags);
+
   return 0;
 }
 
@@ -139,27 +437,22 @@ void shift_area(struct vm_area_struct *vma, struct vm_area_struct *new_vma)
 {
   if (vma->vm_start == new_vma->vm_start)
   {
-    if (new_vma->vm_end > vma->vm_end)
-    {
-      uint32_t nframes = (new_vma->vm_end - vma->vm_end) / PMM_FRAME_SIZE;
-      uint32_t paddr = (uint32_t)pmm_alloc_blocks(nframes);
-      for (uint32_t vaddr = vma->vm_end; vaddr < new_vma->vm_end; vaddr += PMM_FRAME_SIZE, paddr += PMM_FRAME_SIZE)
-        vmm_map_address(current_process->pdir, vaddr, paddr, I86_PTE_PRESENT | I86_PTE_WRITABLE | I86_PTE_USER);
-    }
-    else if (new_vma->vm_end < vma->vm_end)
-      for (uint32_t addr = new_vma->vm_end; addr < vma->vm_end; addr += PMM_FRAME_SIZE)
-        vmm_unmap_address(current_process->pdir, addr);
+    // Growing heap is faulted in lazily, only shrinking has to touch page tables
+    if (new_vma->vm_end < vma->vm_end)
+      vmm_unmap_range(current_process->pdir, new_vma->vm_end, vma->vm_end);
   }
   else
   {
     uint32_t old_length = vma->vm_end - vma->vm_start;
     uint32_t new_length = new_vma->vm_end - new_vma->vm_start;
-    for (uint32_t vaddr = 0; vaddr < new_length; vaddr += PMM_FRAME_SIZE)
+    for (uint32_t vaddr = 0; vaddr < new_length && vaddr < old_length; vaddr += PMM_FRAME_SIZE)
     {
-      uint32_t paddr = vaddr < old_length ? vmm_get_physical_address(vma->vm_start + vaddr, false) : (uint32_t)pmm_alloc_block();
+      if (!vmm_is_page_present(vma->vm_start + vaddr))
+        continue;
+
       vmm_map_address(current_process->pdir,
                       new_vma->vm_start + vaddr,
-                      paddr,
+                      vmm_get_physical_address(vma->vm_start + vaddr, false),
                       I86_PTE_PRESENT | I86_PTE_WRITABLE | I86_PTE_USER);
     };
   }
@@ -176,18 +469,15 @@ uint32_t do_brk(uint32_t addr, size_t len)
   if (!vma || vma->vm_end >= new_brk)
     return 0;
 
-  struct vm_area_struct *new_vma = kcalloc(1, sizeof(struct vm_area_struct));
-  memcpy(new_vma, vma, sizeof(struct vm_area_struct));
-  if (new_brk > mm->brk)
-    expand_area(new_vma, new_brk);
-  else
-    new_vma->vm_end = new_brk;
+  // only describes the new range, it is never linked
+  struct vm_area_struct new_vma = *vma;
+  new_vma.vm_end = new_brk;
 
   if (vma->vm_file)
-    vma->vm_file->f_op->mmap(vma->vm_file, new_vma);
+    vma->vm_file->f_op->mmap(vma->vm_file, &new_vma);
   else
-    shift_area(vma, new_vma);
-  memcpy(vma, new_vma, sizeof(struct vm_area_struct));
+    shift_area(vma, &new_vma);
+  vma_adjust(vma, new_vma.vm_start, new_vma.vm_end);
 
   return 0;
 }
\ No newline at end of file
@@ -1,93 +1,159 @@
+#include <kernel/cpu/hal.h>
+#include <kernel/locking/spinlock.h>
 #include "pmm.h"
 
-static uint32_t *memory_bitmap = 0;
+/*
+  Physical frames are managed by a binary buddy allocator. Every frame has a descriptor in `frames` (placed right after the kernel image,
+  where the bitmap used to live). A free block of 2^order frames is represented by its first frame which is linked into free_area[order].
+
+  free_area[0]  -> [x] -> [y]
+  free_area[1]  -> [xx]
+  ...
+  free_area[11] -> [xxxx...xxxx]
+
+  alloc: take the smallest non-empty order >= requested and split it in halves until it fits -> O(log n)
+  free: while the buddy (pfn ^ (1 << order)) is a free block of the same order, merge and go up -> O(log n)
+
+  Allocated frames are reference counted (copy-on-write fork shares them between address spaces).
+  pmm_alloc_block(s) returns frames with count = 1, pmm_ref_block takes one more reference
+  and pmm_free_block drops one, the frame only goes back to buddy lists when the last reference is gone.
+
+  pmm_lock (interrupts off) guards free lists, counts and used_frames, callers don't need the kernel lock.
+*/
+
+#define PMM_FRAME_NONE 0xFFFFFFFF
+#define PMM_BOOT_MAPPED_SIZE 0x400000
+
+static struct pmm_frame *frames = 0;
+static struct pmm_free_area free_area[PMM_MAX_ORDER];
 static uint32_t max_frames = 0;
 static uint32_t used_frames = 0;
 static uint32_t memory_size = 0;
-static uint32_t memory_bitmap_size = 0;
+static uint32_t frames_size = 0;
+static spinlock_t pmm_lock = SPINLOCK_INITIALIZER;
 
 void pmm_regions(struct multiboot_tag_mmap *multiboot_mmap);
 void pmm_init_region(uint32_t addr, uint32_t length);
 void pmm_deinit_region(uint32_t add, uint32_t length);
 
-void memory_bitmap_set(uint32_t frame)
+static void free_area_add(uint32_t pfn, uint8_t order)
 {
-  memory_bitmap[frame / 32] |= (1 << (frame % 32));
+  struct pmm_free_area *area = &free_area[order];
+  struct pmm_frame *frame = &frames[pfn];
+
+  frame->flags = PMM_FRAME_FREE;
+  frame->order = order;
+  frame->prev = PMM_FRAME_NONE;
+  frame->next = area->head;
+  if (area->head != PMM_FRAME_NONE)
+    frames[area->head].prev = pfn;
+  area->head = pfn;
+  area->nr_free++;
 }
 
-void memory_bitmap_unset(uint32_t frame)
+static void free_area_del(uint32_t pfn)
 {
-  memory_bitmap[frame / 32] &= ~(1 << (frame % 32));
+  struct pmm_frame *frame = &frames[pfn];
+  struct pmm_free_area *area = &free_area[frame->order];
+
+  if (frame->prev != PMM_FRAME_NONE)
+    frames[frame->prev].next = frame->next;
+  else
+    area->head = frame->next;
+  if (frame->next != PMM_FRAME_NONE)
+    frames[frame->next].prev = frame->prev;
+
+  frame->flags = 0;
+  frame->next = frame->prev = PMM_FRAME_NONE;
+  area->nr_free--;
 }
 
-bool memory_bitmap_test(uint32_t frame)
+static bool is_free_block(uint32_t pfn, uint8_t order)
 {
-  return memory_bitmap[frame / 32] & (1 << (frame % 32));
+  return pfn < max_frames && (frames[pfn].flags & PMM_FRAME_FREE) && frames[pfn].order == order;
 }
 
-int memory_bitmap_first_free()
+static void buddy_free(uint32_t pfn, uint8_t order)
 {
-  for (uint32_t i = 0; i < max_frames / 32; ++i)
-    if (memory_bitmap[i] != 0xffffffff)
-      for (uint32_t j = 0; j < 32; ++j)
-      {
-        int bit = 1 << j;
-        if (!(memory_bitmap[i] & bit))
-          return i * 32 + j;
-      }
+  while (order < PMM_MAX_ORDER - 1)
+  {
+    uint32_t buddy = pfn ^ (1 << order);
+    if (!is_free_block(buddy, order))
+      break;
 
-  return -1;
+    free_area_del(buddy);
+    pfn &= ~(1 << order);
+    order++;
+  }
+  free_area_add(pfn, order);
 }
 
-int memory_bitmap_first_frees(size_t size)
+// split a free block of `order` at `pfn` down to `target` and keep the first part
+static void buddy_split(uint32_t pfn, uint8_t order, uint8_t target)
 {
-  if (size == 0)
-    return -1;
-
-  if (size == 1)
-    return memory_bitmap_first_free();
-
-  for (uint32_t i = 0; i < max_frames / 32; i++)
-    if (memory_bitmap[i] != 0xffffffff)
-      for (int j = 0; j < 32; j++)
-      { //! test each bit in the dword
-
-        int bit = 1 << j;
-        if (!(memory_bitmap[i] & bit))
-        {
-
-          int startingBit = i * 32;
-          startingBit += j; //get the free bit in the dword at index i
+  while (order > target)
+  {
+    order--;
+    free_area_add(pfn + (1 << order), order);
+  }
+}
 
-          uint32_t free = 0; //loop through each bit to see if its enough space
-          for (uint32_t count = 0; count <= size; count++)
-          {
+static int32_t buddy_alloc(uint8_t order)
+{
+  uint8_t current = order;
+  while (current < PMM_MAX_ORDER && free_area[current].head == PMM_FRAME_NONE)
+    current++;
 
-            if (!memory_bitmap_test(startingBit + count))
-              free++; // this bit is clear (free frame)
+  if (current >= PMM_MAX_ORDER)
+    return -1;
 
-            if (free == size)
-              return i * 32 + j; //free count==size needed; return index
-          }
-        }
-      }
+  uint32_t pfn = free_area[current].head;
+  free_area_del(pfn);
+  buddy_split(pfn, current, order);
+  return pfn;
+}
 
-  return -1;
+static uint8_t get_order(size_t size)
+{
+  uint8_t order = 0;
+  while ((1u << order) < size)
+    order++;
+  return order;
 }
 
 void pmm_init(struct multiboot_tag_basic_meminfo *multiboot_meminfo, struct multiboot_tag_mmap *multiboot_mmap)
 {
   memory_size = (multiboot_meminfo->mem_lower + multiboot_meminfo->mem_upper) * 1024;
-  memory_bitmap = (uint32_t *)KERNEL_END;
-  used_frames = max_frames = div_ceil(memory_size, PMM_FRAME_SIZE);
+  frames = (struct pmm_frame *)KERNEL_END;
+  max_frames = div_ceil(memory_size, PMM_FRAME_SIZE);
+
+  // Only the first 4MB are mapped (boot.asm) when pmm is initialized, frames have to fit into it
+  uint32_t boot_available = PMM_BOOT_MAPPED_SIZE - (KERNEL_END - KERNEL_HIGHER_HALF);
+  if (max_frames * sizeof(struct pmm_frame) > boot_available)
+    max_frames = boot_available / sizeof(struct pmm_frame);
+  used_frames = max_frames;
 
-  memory_bitmap_size = div_ceil(max_frames, PMM_FRAMES_PER_BYTE);
-  memset(memory_bitmap, 0xff, memory_bitmap_size);
+  frames_size = max_frames * sizeof(struct pmm_frame);
+  memset(frames, 0, frames_size);
+
+  for (uint32_t i = 0; i < PMM_MAX_ORDER; ++i)
+  {
+    free_area[i].head = PMM_FRAME_NONE;
+    free_area[i].nr_free = 0;
+  }
 
   pmm_regions(multiboot_mmap);
 
   pmm_deinit_region(0x0, KERNEL_BOOT);
-  pmm_deinit_region(KERNEL_BOOT, KERNEL_END - KERNEL_START + memory_bitmap_size);
+  pmm_deinit_region(KERNEL_BOOT, KERNEL_END - KERNEL_START + frames_size);
+
+  // seed buddy free lists from available frames, freeing them one by one merges them into the largest aligned blocks
+  for (uint32_t pfn = 0; pfn < max_frames; ++pfn)
+    if (frames[pfn].flags & PMM_FRAME_AVAILABLE)
+    {
+      frames[pfn].flags = 0;
+      buddy_free(pfn, 0);
+    }
 }
 
 void pmm_regions(struct multiboot_tag_mmap *multiboot_mmap)
@@ -107,62 +173,87 @@ void pmm_regions(struct multiboot_tag_mmap *multiboot_mmap)
 void pmm_init_region(uint32_t addr, uint32_t length)
 {
   uint32_t frame = addr / PMM_FRAME_SIZE;
-  uint32_t frames = div_ceil(length, PMM_FRAME_SIZE);
+  uint32_t frames_count = div_ceil(length, PMM_FRAME_SIZE);
 
-  for (uint32_t i = 0; i < frames; ++i)
+  for (uint32_t i = 0; i < frames_count && frame + i < max_frames; ++i)
+    if (!(frames[frame + i].flags & PMM_FRAME_AVAILABLE))
+    {
+      frames[frame + i].flags |= PMM_FRAME_AVAILABLE;
+      used_frames--;
+    }
+
+  if (frames[0].flags & PMM_FRAME_AVAILABLE)
   {
-    memory_bitmap_unset(frame + i);
-    used_frames--;
+    frames[0].flags &= ~PMM_FRAME_AVAILABLE;
+    used_frames++;
   }
-
-  memory_bitmap_set(0);
 }
 
 void pmm_deinit_region(uint32_t addr, uint32_t length)
 {
   uint32_t frame = addr / PMM_FRAME_SIZE;
-  uint32_t frames = div_ceil(length, PMM_FRAME_SIZE);
-
-  for (uint32_t i = 0; i < frames; ++i)
-  {
-    memory_bitmap_set(frame + i);
-    used_frames++;
-  }
+  uint32_t frames_count = div_ceil(length, PMM_FRAME_SIZE);
+
+  for (uint32_t i = 0; i < frames_count && frame + i < max_frames; ++i)
+    if (frames[frame + i].flags & PMM_FRAME_AVAILABLE)
+    {
+      frames[frame + i].flags &= ~PMM_FRAME_AVAILABLE;
+      used_frames++;
+    }
 }
 
 void *pmm_alloc_block()
 {
-  if (max_frames <= used_frames)
-    return 0;
+  uint32_t flags = irq_save();
+  spin_lock(&pmm_lock);
+
+  int32_t frame = max_frames > used_frames ? buddy_alloc(0) : -1;
+  if (frame != -1)
+  {
+    used_frames++;
+    frames[frame].count = 1;
+  }
 
-  int frame = memory_bitmap_first_free();
+  spin_unlock(&pmm_lock);
+  irq_restore(flags);
 
   if (frame == -1)
     return 0;
 
-  memory_bitmap_set(frame);
-  used_frames++;
-
   uint32_t addr = frame * PMM_FRAME_SIZE;
   return (void *)addr;
 }
 
 void *pmm_alloc_blocks(size_t size)
 {
-  if (max_frames - used_frames < size)
+  if (size == 0 || size > max_frames)
     return 0;
 
-  int frame = memory_bitmap_first_frees(size);
-
-  if (frame == -1)
+  uint8_t order = get_order(size);
+  if (order >= PMM_MAX_ORDER)
     return 0;
 
-  for (uint32_t i = 0; i < size; ++i)
+  uint32_t flags = irq_save();
+  spin_lock(&pmm_lock);
+
+  int32_t frame = max_frames - used_frames >= size ? buddy_alloc(order) : -1;
+  if (frame != -1)
   {
-    memory_bitmap_set(frame + i);
-    used_frames++;
+    // give the unused tail of 2^order block back, each returned frame can later be freed one by one via pmm_free_block
+    for (uint32_t pfn = frame + size, end = frame + (1 << order); pfn < end; ++pfn)
+      buddy_free(pfn, 0);
+
+    used_frames += size;
+    for (uint32_t pfn = frame; pfn < frame + size; ++pfn)
+      frames[pfn].count = 1;
   }
 
+  spin_unlock(&pmm_lock);
+  irq_restore(flags);
+
+  if (frame == -1)
+    return 0;
+
   uint32_t addr = frame * PMM_FRAME_SIZE;
   return (void *)addr;
 }
@@ -172,22 +263,99 @@ void pmm_free_block(void *p)
   uint32_t addr = (uint32_t)p;
   uint32_t frame = addr / PMM_FRAME_SIZE;
 
-  memory_bitmap_unset(frame);
+  if (frame >= max_frames)
+    return;
+
+  uint32_t flags = irq_save();
+  spin_lock(&pmm_lock);
+
+  if (frames[frame].count > 1)
+    frames[frame].count--;
+  else if (!(frames[frame].flags & PMM_FRAME_FREE))
+  {
+    frames[frame].count = 0;
+    buddy_free(frame, 0);
+    used_frames--;
+  }
 
-  used_frames--;
+  spin_unlock(&pmm_lock);
+  irq_restore(flags);
 }
 
-void pmm_mark_used_addr(uint32_t paddr)
+static void pmm_mark_used_frame(uint32_t frame)
 {
-  uint32_t frame = paddr / PMM_FRAME_SIZE;
-  if (!memory_bitmap_test(frame))
+  // find the free block which contains the frame, then split it until the frame is an order-0 block
+  for (uint8_t order = 0; order < PMM_MAX_ORDER; ++order)
   {
-    memory_bitmap_set(frame);
+    uint32_t head = frame & ~((1 << order) - 1);
+    if (!is_free_block(head, order))
+      continue;
+
+    free_area_del(head);
+    while (order > 0)
+    {
+      order--;
+      uint32_t half = head + (1 << order);
+      if (frame >= half)
+      {
+        free_area_add(head, order);
+        head = half;
+      }
+      else
+        free_area_add(half, order);
+    }
+    frames[frame].count = 1;
     used_frames++;
+    return;
   }
 }
 
+void pmm_mark_used_addr(uint32_t paddr)
+{
+  uint32_t frame = paddr / PMM_FRAME_SIZE;
+  if (frame >= max_frames)
+    return;
+
+  uint32_t flags = irq_save();
+  spin_lock(&pmm_lock);
+  pmm_mark_used_frame(frame);
+  spin_unlock(&pmm_lock);
+  irq_restore(flags);
+}
+
+void pmm_ref_block(void *p)
+{
+  uint32_t frame = (uint32_t)p / PMM_FRAME_SIZE;
+
+  // Frames outside of ram (framebuffer, devices) are not managed by us
+  if (frame >= max_frames)
+    return;
+
+  uint32_t flags = irq_save();
+  spin_lock(&pmm_lock);
+  if (!(frames[frame].flags & PMM_FRAME_FREE))
+    frames[frame].count++;
+  spin_unlock(&pmm_lock);
+  irq_restore(flags);
+}
+
+uint32_t pmm_get_block_count(void *p)
+{
+  uint32_t frame = (uint32_t)p / PMM_FRAME_SIZE;
+
+  if (frame >= max_frames || (frames[frame].flags & PMM_FRAME_FREE))
+    return 0;
+
+  return frames[frame].count;
+}
+
 uint32_t get_total_frames()
 {
   return max_frames;
-}
\ No newline at end of file
+}
+
+// frames which exist but are not in the frame table (pmm_init caps it to the boot mapping)
+uint32_t get_unmanaged_frames()
+{
+  return div_ceil(memory_size, PMM_FRAME_SIZE) - max_frames;
+}
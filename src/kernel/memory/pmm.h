@@ -13,12 +13,35 @@
 #define PMM_FRAME_ALIGN PMM_FRAME_SIZE
 #define PAGE_MASK (~(PMM_FRAME_SIZE - 1))
 #define PAGE_ALIGN(addr) (((addr) + PMM_FRAME_SIZE - 1) & PAGE_MASK)
+#define PMM_MAX_ORDER 12
+
+// frame flags
+#define PMM_FRAME_FREE 0x01      /* first frame of a free buddy block */
+#define PMM_FRAME_AVAILABLE 0x02 /* usable ram, only used while seeding buddy lists */
+
+struct pmm_frame
+{
+  uint32_t next;
+  uint32_t prev;
+  uint8_t order;
+  uint8_t flags;
+  uint16_t count; /* number of owners (page tables, kernel), frame is released when it drops to zero */
+};
+
+struct pmm_free_area
+{
+  uint32_t head;
+  uint32_t nr_free;
+};
 
 void pmm_init(struct multiboot_tag_basic_meminfo *, struct multiboot_tag_mmap *);
 void *pmm_alloc_block();
 void *pmm_alloc_blocks(size_t);
 void pmm_free_block(void *);
+void pmm_ref_block(void *);
+uint32_t pmm_get_block_count(void *);
 void pmm_mark_used_addr(uint32_t paddr);
 uint32_t get_total_frames();
+uint32_t get_unmanaged_frames();
 
 #endif
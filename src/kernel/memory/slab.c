@@ -0,0 +1,236 @@
+#include <include/ctype.h>
+#include <kernel/cpu/idt.h>
+#include <kernel/cpu/exception.h>
+#include <kernel/locking/spinlock.h>
+#include <kernel/utils/string.h>
+#include "vmm.h"
+#include "slab.h"
+
+/*
+  Small kernel objects are served from per-size caches instead of walking the block list in malloc.c
+
+  +-----------------------+ slab (16KB, aligned by 16KB) in [KERNEL_SLAB_BOTTOM, KERNEL_SLAB_TOP)
+  | struct slab           |
+  |-----------------------|
+  | object | object | ... | free objects are chained through their first word (slab->freelist)
+  +-----------------------+
+
+  A cache keeps its slabs in three lists (partial, full, free), alloc/free are O(1).
+  Empty slabs stay in slabs_free and are reused by the same cache.
+  slab_lock (interrupts off) guards every cache and slab_current, callers don't need the kernel lock.
+*/
+
+static uint32_t slab_current = KERNEL_SLAB_BOTTOM;
+static struct kmem_cache cache_cache;
+static struct kmem_cache kmalloc_caches[KMALLOC_CACHES];
+static const char *kmalloc_names[KMALLOC_CACHES] = {
+    "kmalloc-16",
+    "kmalloc-32",
+    "kmalloc-64",
+    "kmalloc-128",
+    "kmalloc-256",
+    "kmalloc-512",
+    "kmalloc-1024",
+    "kmalloc-2048",
+};
+static struct list_head caches;
+static bool slab_ready = false;
+static spinlock_t slab_lock = SPINLOCK_INITIALIZER;
+
+static void kmem_cache_setup(struct kmem_cache *cache, const char *name, size_t size, size_t align)
+{
+  if (align < sizeof(void *))
+    align = sizeof(void *);
+  if (size < sizeof(void *))
+    size = sizeof(void *);
+
+  uint32_t first = ((sizeof(struct slab) + align - 1) / align) * align;
+
+  cache->name = name;
+  cache->align = align;
+  cache->object_size = ((size + align - 1) / align) * align;
+  cache->objects_per_slab = (SLAB_SIZE - first) / cache->object_size;
+  cache->nr_slabs = 0;
+  cache->nr_active = 0;
+  INIT_LIST_HEAD(&cache->slabs_partial);
+  INIT_LIST_HEAD(&cache->slabs_full);
+  INIT_LIST_HEAD(&cache->slabs_free);
+  list_add_tail(&cache->sibling, &caches);
+}
+
+static struct slab *kmem_cache_grow(struct kmem_cache *cache)
+{
+  if (slab_current + SLAB_SIZE > KERNEL_SLAB_TOP)
+    return NULL;
+
+  uint32_t vaddr = slab_current;
+  for (uint32_t i = 0; i < SLAB_PAGES; ++i)
+  {
+    uint32_t paddr = (uint32_t)pmm_alloc_block();
+    if (!paddr)
+    {
+      for (uint32_t j = 0; j < i; ++j)
+      {
+        pmm_free_block((void *)vmm_get_physical_address(vaddr + j * PMM_FRAME_SIZE, false));
+        vmm_unmap_address(vmm_get_directory(), vaddr + j * PMM_FRAME_SIZE);
+      }
+      return NULL;
+    }
+    vmm_map_address(vmm_get_directory(), vaddr + i * PMM_FRAME_SIZE, paddr, I86_PTE_PRESENT | I86_PTE_WRITABLE);
+  }
+  slab_current += SLAB_SIZE;
+
+  struct slab *slab = (struct slab *)vaddr;
+  slab->cache = cache;
+  slab->inuse = 0;
+  slab->magic = SLAB_MAGIC;
+  slab->freelist = NULL;
+
+  char *first = (char *)vaddr + ((sizeof(struct slab) + cache->align - 1) / cache->align) * cache->align;
+  for (int32_t i = cache->objects_per_slab - 1; i >= 0; --i)
+  {
+    void **obj = (void **)(first + i * cache->object_size);
+    *obj = slab->freelist;
+    slab->freelist = obj;
+  }
+
+  list_add(&slab->sibling, &cache->slabs_free);
+  cache->nr_slabs++;
+  return slab;
+}
+
+void kmem_cache_init()
+{
+  INIT_LIST_HEAD(&caches);
+
+  kmem_cache_setup(&cache_cache, "kmem_cache", sizeof(struct kmem_cache), 0);
+  for (uint32_t i = 0, size = KMALLOC_MIN_SIZE; i < KMALLOC_CACHES; ++i, size <<= 1)
+    kmem_cache_setup(&kmalloc_caches[i], kmalloc_names[i], size, min_t(uint32_t, size, 16));
+
+  slab_ready = true;
+}
+
+struct kmem_cache *kmem_cache_create(const char *name, size_t size, size_t align)
+{
+  if (!slab_ready || size > KMALLOC_MAX_CACHE_SIZE)
+    return NULL;
+
+  struct kmem_cache *cache = kmem_cache_alloc(&cache_cache);
+  if (!cache)
+    return NULL;
+
+  uint32_t flags = irq_save();
+  spin_lock(&slab_lock);
+  kmem_cache_setup(cache, name, size, align);
+  spin_unlock(&slab_lock);
+  irq_restore(flags);
+
+  return cache;
+}
+
+void *kmem_cache_alloc(struct kmem_cache *cache)
+{
+  struct slab *slab = NULL;
+  uint32_t flags = irq_save();
+  spin_lock(&slab_lock);
+
+  if (!list_empty(&cache->slabs_partial))
+    slab = list_first_entry(&cache->slabs_partial, struct slab, sibling);
+  else if (!list_empty(&cache->slabs_free) || kmem_cache_grow(cache))
+    slab = list_first_entry(&cache->slabs_free, struct slab, sibling);
+  else
+  {
+    spin_unlock(&slab_lock);
+    irq_restore(flags);
+    return NULL;
+  }
+
+  void **obj = slab->freelist;
+  slab->freelist = *obj;
+  slab->inuse++;
+  cache->nr_active++;
+
+  if (slab->inuse == cache->objects_per_slab)
+    list_move(&slab->sibling, &cache->slabs_full);
+  else if (slab->inuse == 1)
+    list_move(&slab->sibling, &cache->slabs_partial);
+
+  spin_unlock(&slab_lock);
+  irq_restore(flags);
+
+  return obj;
+}
+
+void *kmem_cache_zalloc(struct kmem_cache *cache)
+{
+  void *obj = kmem_cache_alloc(cache);
+  if (obj)
+    memset(obj, 0, cache->object_size);
+  return obj;
+}
+
+void kmem_cache_free(struct kmem_cache *cache, void *obj)
+{
+  if (!obj)
+    return;
+
+  // freeing into the wrong cache or a pointer which is not a slab object corrupts the freelists
+  struct slab *slab = (struct slab *)((uint32_t)obj & SLAB_MASK);
+  uint32_t flags = irq_save();
+  spin_lock(&slab_lock);
+
+  if (slab->magic != SLAB_MAGIC)
+    kernel_panic("kmem_cache_free: object is not from a slab");
+  if (slab->cache != cache)
+    kernel_panic("kmem_cache_free: object belongs to another cache");
+  if (!slab->inuse)
+    kernel_panic("kmem_cache_free: double free");
+
+  *(void **)obj = slab->freelist;
+  slab->freelist = obj;
+  slab->inuse--;
+  cache->nr_active--;
+
+  if (slab->inuse == 0)
+    list_move(&slab->sibling, &cache->slabs_free);
+  else if (slab->inuse == cache->objects_per_slab - 1)
+    list_move(&slab->sibling, &cache->slabs_partial);
+
+  spin_unlock(&slab_lock);
+  irq_restore(flags);
+}
+
+struct kmem_cache *kmalloc_cache(size_t size)
+{
+  if (!slab_ready || size > KMALLOC_MAX_CACHE_SIZE)
+    return NULL;
+
+  uint32_t i = 0;
+  for (uint32_t csize = KMALLOC_MIN_SIZE; csize < size; csize <<= 1)
+    i++;
+  return &kmalloc_caches[i];
+}
+
+// objects which are allocated from every cache, used to spot leaks
+uint32_t kmem_cache_active_objects()
+{
+  uint32_t active = 0;
+  uint32_t flags = irq_save();
+  spin_lock(&slab_lock);
+
+  struct kmem_cache *cache;
+  list_for_each_entry(cache, &caches, sibling)
+  {
+    active += cache->nr_active;
+  }
+
+  spin_unlock(&slab_lock);
+  irq_restore(flags);
+  return active;
+}
+
+size_t ksize(void *obj)
+{
+  struct slab *slab = (struct slab *)((uint32_t)obj & SLAB_MASK);
+  return slab->cache->object_size;
+}
@@ -0,0 +1,60 @@
+#ifndef MEMORY_SLAB_H
+#define MEMORY_SLAB_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <include/list.h>
+#include "pmm.h"
+
+#define KERNEL_SLAB_BOTTOM 0xC8000000
+#define KERNEL_SLAB_TOP 0xD0000000
+
+// every slab is 16KB and aligned by its size, so slab header of an object is `addr & SLAB_MASK`
+#define SLAB_PAGES 4
+#define SLAB_SIZE (SLAB_PAGES * PMM_FRAME_SIZE)
+#define SLAB_MASK (~(SLAB_SIZE - 1))
+#define SLAB_MAGIC 0x51AB
+
+#define KMALLOC_MIN_SIZE 16
+#define KMALLOC_MAX_CACHE_SIZE 2048
+#define KMALLOC_CACHES 8
+
+struct kmem_cache
+{
+  const char *name;
+  uint32_t object_size;
+  uint32_t align;
+  uint32_t objects_per_slab;
+  uint32_t nr_slabs;
+  uint32_t nr_active;
+  struct list_head slabs_partial;
+  struct list_head slabs_full;
+  struct list_head slabs_free;
+  struct list_head sibling;
+};
+
+struct slab
+{
+  struct kmem_cache *cache;
+  void *freelist;
+  uint32_t inuse;
+  uint32_t magic;
+  struct list_head sibling;
+};
+
+static inline bool is_slab_object(void *ptr)
+{
+  return KERNEL_SLAB_BOTTOM <= (uint32_t)ptr && (uint32_t)ptr < KERNEL_SLAB_TOP;
+}
+
+void kmem_cache_init();
+struct kmem_cache *kmem_cache_create(const char *name, size_t size, size_t align);
+void *kmem_cache_alloc(struct kmem_cache *cache);
+void *kmem_cache_zalloc(struct kmem_cache *cache);
+void kmem_cache_free(struct kmem_cache *cache, void *obj);
+struct kmem_cache *kmalloc_cache(size_t size);
+size_t ksize(void *obj);
+uint32_t kmem_cache_active_objects();
+
+#endif
@@ -1,3 +1,5 @@
+#include <include/errno.h>
+#include <kernel/proc/task.h>
 #include "vmm.h"
 
 #define PAGE_DIRECTORY_BASE 0xFFFFF000
@@ -7,6 +9,7 @@
 #define get_page_table_entry_index(x) (((x) >> 12) & 0x3ff)
 #define get_aligned_address(x) (x & ~0xfff)
 #define is_page_enabled(x) (x & 0x1)
+#define is_large_page(x) (x & I86_PDE_4MB)
 
 void vmm_init_and_map(struct pdirectory *, uint32_t, uint32_t);
 void vmm_alloc_ptable(struct pdirectory *va_dir, uint32_t index);
@@ -19,11 +22,16 @@ void vmm_paging(struct pdirectory *, uint32_t);
 
 static struct pdirectory *_current_dir;
 
+// Kernel half is shared by every cpu, user half (and its page tables) only by cpus running the same address space
 void vmm_flush_tlb_entry(uint32_t addr)
 {
 
   __asm__ __volatile__("invlpg (%0)" ::"r"(addr)
                        : "memory");
+
+  bool is_user = addr < KERNEL_HIGHER_HALF ||
+                 (addr >= PAGE_TABLE_BASE && addr < PAGE_TABLE_BASE + get_page_directory_index(KERNEL_HIGHER_HALF) * PMM_FRAME_SIZE);
+  smp_flush_tlb_entry(addr, is_user && current_process ? current_process->pdir : NULL);
 }
 
 /*
@@ -32,6 +40,8 @@ void vmm_flush_tlb_entry(uint32_t addr)
   | Page table mapping      |
   |_________________________| 0xFFC00000
   |                         |
+  |-------------------------| 0xF8000000
+  | Kernel stacks (guarded) |
   |-------------------------| 0xF0000000
   |                         |
   | Device drivers          |
@@ -43,6 +53,9 @@ void vmm_flush_tlb_entry(uint32_t addr)
   |                         |
   | Kernel heap             |
   |                         |
+  |_________________________| 0xD0000000
+  |                         |
+  | Slab caches             |
   |_________________________| 0xC8000000
   |                         | 
   | Kernel itself           |
@@ -50,6 +63,8 @@ void vmm_flush_tlb_entry(uint32_t addr)
   |                         |
   | Page for page faults    |
   |_________________________| 0xBFFFF000
+  | vdso (time, process)    |
+  |_________________________| 0xBFFFD000
   |                         |
   |                         |
   |                         |
@@ -95,36 +110,29 @@ void vmm_alloc_ptable(struct pdirectory *va_dir, uint32_t index)
   va_dir->m_entries[index] = pa_table | I86_PDE_PRESENT | I86_PDE_WRITABLE;
 }
 
+// Kernel image (first 4MB) is mapped by one 4MB page, no page table is needed
 void vmm_init_and_map(struct pdirectory *va_dir, uint32_t vaddr, uint32_t paddr)
 {
-  uint32_t pa_table = (uint32_t)pmm_alloc_block();
-  struct ptable *va_table = (struct ptable *)(pa_table + KERNEL_HIGHER_HALF);
-  memset(va_table, 0, sizeof(struct ptable));
-
-  uint32_t ivirtual = vaddr;
-  uint32_t iframe = paddr;
-
-  for (int i = 0; i < 1024; ++i, ivirtual += PMM_FRAME_SIZE, iframe += PMM_FRAME_SIZE)
-  {
-    pt_entry *entry = &va_table->m_entries[get_page_table_entry_index(ivirtual)];
-    *entry = iframe | I86_PTE_PRESENT | I86_PTE_WRITABLE;
+  for (uint32_t iframe = paddr; iframe < paddr + LARGE_PAGE_SIZE; iframe += PMM_FRAME_SIZE)
     pmm_mark_used_addr(iframe);
-  }
 
   pd_entry *entry = &va_dir->m_entries[get_page_directory_index(vaddr)];
-  *entry = pa_table | I86_PDE_PRESENT | I86_PDE_WRITABLE;
+  *entry = paddr | I86_PDE_PRESENT | I86_PDE_WRITABLE | I86_PDE_4MB | I86_PDE_CPU_GLOBAL;
 }
 
+// CR0.WP is set, kernel writes to read-only user pages have to fault as well (copy-on-write)
+// CR4.PSE stays enabled (boot.asm already uses it) for 4MB pages
+// CR4.PGE, kernel pages are global and survive cr3 reloads (see vmm_map_address)
 void vmm_paging(struct pdirectory *va_dir, uint32_t pa_dir)
 {
   _current_dir = va_dir;
 
-  __asm__ __volatile__("mov %0, %%cr3           \n"
-                       "mov %%cr4, %%ecx        \n"
-                       "and $~0x00000010, %%ecx \n"
+  __asm__ __volatile__("mov %%cr4, %%ecx        \n"
+                       "or $0x00000090, %%ecx   \n"
                        "mov %%ecx, %%cr4        \n"
+                       "mov %0, %%cr3           \n"
                        "mov %%cr0, %%ecx        \n"
-                       "or $0x80000000, %%ecx   \n"
+                       "or $0x80010000, %%ecx   \n"
                        "mov %%ecx, %%cr0        \n" ::"r"(pa_dir));
 }
 
@@ -150,6 +158,16 @@ void pd_entry_set_frame(pd_entry *e, uint32_t addr)
 
 uint32_t vmm_get_physical_address(uint32_t vaddr, bool is_page)
 {
+  pd_entry pde = ((struct pdirectory *)PAGE_DIRECTORY_BASE)->m_entries[get_page_directory_index(vaddr)];
+  if (is_page_enabled(pde) && is_large_page(pde))
+  {
+    uint32_t paddr = (pde & LARGE_PAGE_MASK) | (vaddr & ~LARGE_PAGE_MASK);
+    if (is_page)
+      return (paddr & ~0xfff) | (pde & 0xfff & ~I86_PDE_4MB);
+    else
+      return paddr;
+  }
+
   uint32_t *table = (uint32_t *)((char *)PAGE_TABLE_BASE + get_page_directory_index(vaddr) * PMM_FRAME_SIZE);
   uint32_t tindex = get_page_table_entry_index(vaddr);
   uint32_t paddr = table[tindex];
@@ -159,13 +177,103 @@ uint32_t vmm_get_physical_address(uint32_t vaddr, bool is_page)
     return (paddr & ~0xfff) | (vaddr & 0xfff);
 }
 
+bool vmm_is_page_present(uint32_t vaddr)
+{
+  struct pdirectory *va_dir = (struct pdirectory *)PAGE_DIRECTORY_BASE;
+  pd_entry pde = va_dir->m_entries[get_page_directory_index(vaddr)];
+  if (!is_page_enabled(pde))
+    return false;
+  if (is_large_page(pde))
+    return true;
+
+  return is_page_enabled(vmm_get_physical_address(vaddr, true));
+}
+
+// Unmap [start, end) of current address space and drop references of its frames, page tables are kept
+void vmm_unmap_range(struct pdirectory *va_dir, uint32_t start, uint32_t end)
+{
+  uint32_t vaddr = start;
+  while (start <= vaddr && vaddr < end)
+  {
+    uint32_t ipd = get_page_directory_index(vaddr);
+    uint32_t next_pd = (vaddr & LARGE_PAGE_MASK) + LARGE_PAGE_SIZE;
+    pd_entry pde = va_dir->m_entries[ipd];
+
+    if (!is_page_enabled(pde))
+    {
+      vaddr = next_pd;
+      continue;
+    }
+
+    // 4MB page is only used for devices, it is dropped when the whole page is unmapped
+    if (is_large_page(pde))
+    {
+      if (!(vaddr & ~LARGE_PAGE_MASK) && end - vaddr >= LARGE_PAGE_SIZE)
+      {
+        va_dir->m_entries[ipd] = 0;
+        vmm_flush_tlb_entry(vaddr);
+      }
+      vaddr = next_pd;
+      continue;
+    }
+
+    struct ptable *pt = (struct ptable *)(PAGE_TABLE_BASE + ipd * PMM_FRAME_SIZE);
+    for (; start <= vaddr && vaddr < end && vaddr < next_pd; vaddr += PMM_FRAME_SIZE)
+    {
+      pt_entry *entry = &pt->m_entries[get_page_table_entry_index(vaddr)];
+      if (!is_page_enabled(*entry))
+        continue;
+
+      pmm_free_block((void *)get_aligned_address(*entry));
+      *entry = 0;
+      vmm_flush_tlb_entry(vaddr);
+    }
+  }
+}
+
+// Release every user frame and page table of current address space (process exit)
+void vmm_free_user_space(struct pdirectory *va_dir)
+{
+  vmm_unmap_range(va_dir, 0, KERNEL_HIGHER_HALF);
+
+  for (uint32_t ipd = 0; ipd < 768; ++ipd)
+  {
+    pd_entry pde = va_dir->m_entries[ipd];
+    if (!is_page_enabled(pde))
+      continue;
+
+    if (!is_large_page(pde))
+      pmm_free_block((void *)get_aligned_address(pde));
+    va_dir->m_entries[ipd] = 0;
+    vmm_flush_tlb_entry(PAGE_TABLE_BASE + ipd * PMM_FRAME_SIZE);
+  }
+}
+
+// Directories of released processes are kept for reuse instead of going back to heap,
+// a freed heap block is not page-aligned anymore once it is split or merged
+static struct pdirectory *free_directories;
+static spinlock_t free_directories_lock = SPINLOCK_INITIALIZER;
+
 struct pdirectory *vmm_create_address_space(struct pdirectory *current)
 {
-  char *aligned_object = kalign_heap(PMM_FRAME_SIZE);
-  // NOTE: MQ 2019-11-24 page directory, page table have to be aligned by 4096
-  struct pdirectory *va_dir = kcalloc(1, sizeof(struct pdirectory));
-  if (aligned_object)
-    kfree(aligned_object);
+  uint32_t flags = irq_save();
+  spin_lock(&free_directories_lock);
+  struct pdirectory *va_dir = free_directories;
+  if (va_dir)
+    free_directories = *(struct pdirectory **)va_dir;
+  spin_unlock(&free_directories_lock);
+  irq_restore(flags);
+
+  if (va_dir)
+    memset(va_dir, 0, sizeof(struct pdirectory));
+  else
+  {
+    char *aligned_object = kalign_heap(PMM_FRAME_SIZE);
+    // NOTE: MQ 2019-11-24 page directory, page table have to be aligned by 4096
+    va_dir = kcalloc(1, sizeof(struct pdirectory));
+    if (aligned_object)
+      kfree(aligned_object);
+  }
 
   if (!va_dir)
     return NULL;
@@ -179,6 +287,17 @@ struct pdirectory *vmm_create_address_space(struct pdirectory *current)
   return va_dir;
 }
 
+// user space is already released (vmm_free_user_space) and no cpu uses the directory anymore
+void vmm_free_address_space(struct pdirectory *va_dir)
+{
+  uint32_t flags = irq_save();
+  spin_lock(&free_directories_lock);
+  *(struct pdirectory **)va_dir = free_directories;
+  free_directories = va_dir;
+  spin_unlock(&free_directories_lock);
+  irq_restore(flags);
+}
+
 struct pdirectory *vmm_get_directory()
 {
   return _current_dir;
@@ -205,11 +324,71 @@ void vmm_map_address(struct pdirectory *va_dir, uint32_t virt, uint32_t phys, ui
 {
   if (!is_page_enabled(va_dir->m_entries[get_page_directory_index(virt)]))
     vmm_create_page_table(va_dir, virt, flags);
+  else if (is_large_page(va_dir->m_entries[get_page_directory_index(virt)]))
+    return;
 
   uint32_t *table = (uint32_t *)((char *)PAGE_TABLE_BASE + get_page_directory_index(virt) * PMM_FRAME_SIZE);
   uint32_t tindex = get_page_table_entry_index(virt);
+  uint32_t old = table[tindex];
+
+  /*
+    Kernel space is shared by all address spaces, its pages are global (not flushed when cr3 is reloaded)
+    Only ptes are marked, pde's bit 8 is read as pte's global bit via recursive mapping
+  */
+  if (virt >= KERNEL_HIGHER_HALF)
+    flags |= I86_PTE_CPU_GLOBAL;
 
   table[tindex] = phys | flags;
+
+  // global entry is not dropped by switching address space, remapping has to invalidate it explicitly
+  if (is_page_enabled(old))
+    vmm_flush_tlb_entry(virt);
+}
+
+/*
+  4MB page (PSE): page directory entry points directly to 4MB aligned physical memory, one TLB entry covers 4MB
+  For kernel space it has to be done before the first address space is created (pdes 768->1022 are copied)
+*/
+void vmm_map_large_address(struct pdirectory *va_dir, uint32_t virt, uint32_t phys, uint32_t flags)
+{
+  uint32_t index = get_page_directory_index(virt);
+  pd_entry *entry = &va_dir->m_entries[index];
+
+  // page table which was there (preallocated for kernel space) is not used anymore, it has to be empty
+  if (is_page_enabled(*entry) && !is_large_page(*entry))
+  {
+    pmm_free_block((void *)get_aligned_address(*entry));
+    vmm_flush_tlb_entry(PAGE_TABLE_BASE + index * PMM_FRAME_SIZE);
+  }
+
+  if (virt >= KERNEL_HIGHER_HALF)
+    flags |= I86_PDE_CPU_GLOBAL;
+
+  *entry = (phys & LARGE_PAGE_MASK) | flags | I86_PDE_4MB;
+  vmm_flush_tlb_entry(virt & LARGE_PAGE_MASK);
+}
+
+// map [virt, virt + size) by 4MB pages where both sides are 4MB aligned, the rest by 4KB pages
+void vmm_map_range(struct pdirectory *va_dir, uint32_t virt, uint32_t phys, uint32_t size, uint32_t flags)
+{
+  size = PAGE_ALIGN(size);
+  while (size > 0)
+  {
+    if (!(virt & ~LARGE_PAGE_MASK) && !(phys & ~LARGE_PAGE_MASK) && size >= LARGE_PAGE_SIZE)
+    {
+      vmm_map_large_address(va_dir, virt, phys, flags);
+      virt += LARGE_PAGE_SIZE;
+      phys += LARGE_PAGE_SIZE;
+      size -= LARGE_PAGE_SIZE;
+    }
+    else
+    {
+      vmm_map_address(va_dir, virt, phys, flags);
+      virt += PMM_FRAME_SIZE;
+      phys += PMM_FRAME_SIZE;
+      size -= PMM_FRAME_SIZE;
+    }
+  }
 }
 
 void vmm_create_page_table(struct pdirectory *va_dir, uint32_t virt, uint32_t flags)
@@ -217,17 +396,17 @@ void vmm_create_page_table(struct pdirectory *va_dir, uint32_t virt, uint32_t fl
   if (is_page_enabled(va_dir->m_entries[get_page_directory_index(virt)]))
     return;
 
-  uint32_t pa_table = (uint32_t)pmm_alloc_block();
+  uint32_t pa_table = (uint32_t)alloc_page(GFP_ZERO);
 
   va_dir->m_entries[get_page_directory_index(virt)] = pa_table | flags;
   vmm_flush_tlb_entry(virt);
-
-  memset((char *)PAGE_TABLE_BASE + get_page_directory_index(virt) * PMM_FRAME_SIZE, 0, sizeof(struct ptable));
+  vmm_flush_tlb_entry(PAGE_TABLE_BASE + get_page_directory_index(virt) * PMM_FRAME_SIZE);
 }
 
 void vmm_unmap_address(struct pdirectory *va_dir, uint32_t virt)
 {
-  if (!is_page_enabled(va_dir->m_entries[get_page_directory_index(virt)]))
+  pd_entry pde = va_dir->m_entries[get_page_directory_index(virt)];
+  if (!is_page_enabled(pde) || is_large_page(pde))
     return;
 
   struct ptable *pt = (struct ptable *)(PAGE_TABLE_BASE + get_page_directory_index(virt) * PMM_FRAME_SIZE);
@@ -240,48 +419,140 @@ void vmm_unmap_address(struct pdirectory *va_dir, uint32_t virt)
   vmm_flush_tlb_entry(virt);
 }
 
-struct pdirectory *vmm_fork(struct pdirectory *va_dir)
+/*
+  Copy-on-write fork: user frames are not copied anymore, both address spaces point to the same frames.
+  Private writable pages become read-only with I86_PTE_COW in parent and child, every shared frame gets one more reference.
+  The first write from either side faults and vmm_cow_page gives the writer its own copy
+  (or just makes the page writable again if nobody else references the frame).
+  Shared mappings (MAP_SHARED, framebuffer) stay writable in both.
+  Parent's tlb is flushed once after every pte is marked (local cr3 reload + one shootdown), not per page
+*/
+// fork ran out of frames, drop references and page tables of the part which is already copied
+static void vmm_release_forked(struct pdirectory *forked_dir, struct ptable *forked_pt)
+{
+  for (uint32_t ipd = 0; ipd < 768; ++ipd)
+  {
+    pd_entry pde = forked_dir->m_entries[ipd];
+    if (!is_page_enabled(pde) || is_large_page(pde))
+      continue;
+
+    uint32_t forked_pt_paddr = get_aligned_address(pde);
+    vmm_map_address(_current_dir, (uint32_t)forked_pt, forked_pt_paddr, I86_PTE_PRESENT | I86_PTE_WRITABLE);
+    for (uint32_t ipt = 0; ipt < PAGES_PER_TABLE; ++ipt)
+      if (is_page_enabled(forked_pt->m_entries[ipt]))
+        pmm_free_block((void *)get_aligned_address(forked_pt->m_entries[ipt]));
+    vmm_unmap_address(_current_dir, (uint32_t)forked_pt);
+    pmm_free_block((void *)forked_pt_paddr);
+  }
+  vmm_free_address_space(forked_dir);
+}
+
+struct pdirectory *vmm_fork(struct pdirectory *va_dir, struct mm_struct *mm)
 {
   struct pdirectory *forked_dir = vmm_create_address_space(va_dir);
+  if (!forked_dir)
+    return NULL;
+
   char *aligned_object = kalign_heap(PMM_FRAME_SIZE);
   uint32_t heap_current = (uint32_t)sbrk(0);
+  struct ptable *forked_pt = (struct ptable *)heap_current;
+  struct vm_area_struct *vma = NULL;
+  bool cow_marked = false;
+  bool out_of_memory = false;
 
   // NOTE: MQ 2019-12-15 Any heap changes via malloc is forbidden
   for (uint32_t ipd = 0; ipd < 768; ++ipd)
-    if (is_page_enabled(va_dir->m_entries[ipd]))
+    if (is_page_enabled(va_dir->m_entries[ipd]) && is_large_page(va_dir->m_entries[ipd]))
+      // 4MB pages in user space are only used for devices (framebuffer), they are shared as they are
+      forked_dir->m_entries[ipd] = va_dir->m_entries[ipd];
+    else if (is_page_enabled(va_dir->m_entries[ipd]))
     {
-      struct ptable *forked_pt = (struct ptable *)heap_current;
-      uint32_t forked_pt_paddr = (uint32_t)pmm_alloc_block();
-      vmm_map_address(va_dir, forked_pt, forked_pt_paddr, I86_PTE_PRESENT | I86_PTE_WRITABLE | I86_PTE_USER);
-      memset(forked_pt, 0, sizeof(struct ptable));
+      uint32_t forked_pt_paddr = (uint32_t)alloc_page(GFP_ZERO);
+      if (!forked_pt_paddr)
+      {
+        out_of_memory = true;
+        break;
+      }
+      vmm_map_address(va_dir, (uint32_t)forked_pt, forked_pt_paddr, I86_PTE_PRESENT | I86_PTE_WRITABLE);
 
-      heap_current += sizeof(struct ptable);
       struct ptable *pt = (struct ptable *)(PAGE_TABLE_BASE + ipd * PMM_FRAME_SIZE);
       for (uint32_t ipt = 0; ipt < PAGES_PER_TABLE; ++ipt)
       {
-        if (is_page_enabled(pt->m_entries[ipt]))
-        {
-          char *pte = (char *)heap_current;
-          char *forked_pte = pte + PMM_FRAME_SIZE;
-          heap_current = (uint32_t)(forked_pte + PMM_FRAME_SIZE);
-          uint32_t forked_pte_paddr = (uint32_t)pmm_alloc_block();
+        pt_entry entry = pt->m_entries[ipt];
+        if (!is_page_enabled(entry))
+          continue;
 
-          vmm_map_address(va_dir, (uint32_t)pte, pt->m_entries[ipt], I86_PTE_PRESENT | I86_PTE_WRITABLE | I86_PTE_USER);
-          vmm_map_address(va_dir, (uint32_t)forked_pte, forked_pte_paddr, I86_PTE_PRESENT | I86_PTE_WRITABLE | I86_PTE_USER);
+        uint32_t vaddr = (ipd << 22) | (ipt << 12);
+        if (!vma || vaddr < vma->vm_start || vaddr >= vma->vm_end)
+          vma = find_vma(mm, vaddr);
 
-          memcpy(forked_pte, pte, PMM_FRAME_SIZE);
-
-          vmm_unmap_address(va_dir, (uint32_t)pte);
-          vmm_unmap_address(va_dir, (uint32_t)forked_pte);
-
-          forked_pt->m_entries[ipt] = forked_pte_paddr | I86_PTE_PRESENT | I86_PTE_WRITABLE | I86_PTE_USER;
+        if ((entry & I86_PTE_WRITABLE) && !(vma && (vma->vm_flags & VM_SHARED)))
+        {
+          entry = (entry & ~I86_PTE_WRITABLE) | I86_PTE_COW;
+          pt->m_entries[ipt] = entry;
+          cow_marked = true;
         }
+
+        pmm_ref_block((void *)get_aligned_address(entry));
+        forked_pt->m_entries[ipt] = entry;
       }
-      vmm_unmap_address(va_dir, forked_pt);
+      vmm_unmap_address(va_dir, (uint32_t)forked_pt);
       forked_dir->m_entries[ipd] = forked_pt_paddr | I86_PDE_PRESENT | I86_PDE_WRITABLE | I86_PDE_USER;
     }
 
+  // parent's writable entries are read-only now, stale writable tlb entries must not survive
+  if (cow_marked)
+  {
+    flush_tlb_local();
+    smp_flush_tlb_entry(TLB_FLUSH_ALL, va_dir);
+  }
+
+  if (out_of_memory)
+  {
+    vmm_release_forked(forked_dir, forked_pt);
+    forked_dir = NULL;
+  }
+
   if (aligned_object)
     kfree(aligned_object);
   return forked_dir;
-}
\ No newline at end of file
+}
+
+int32_t vmm_cow_page(uint32_t vaddr)
+{
+  struct pdirectory *va_dir = current_process->pdir;
+  pd_entry pde = va_dir->m_entries[get_page_directory_index(vaddr)];
+  if (!is_page_enabled(pde) || is_large_page(pde))
+    return -EFAULT;
+
+  struct ptable *pt = (struct ptable *)(PAGE_TABLE_BASE + get_page_directory_index(vaddr) * PMM_FRAME_SIZE);
+  pt_entry *entry = &pt->m_entries[get_page_table_entry_index(vaddr)];
+  if (!is_page_enabled(*entry) || !(*entry & I86_PTE_COW))
+    return -EFAULT;
+
+  vaddr = get_aligned_address(vaddr);
+  uint32_t paddr = get_aligned_address(*entry);
+  uint32_t flags = (*entry & ~I86_PTE_FRAME & ~I86_PTE_COW) | I86_PTE_WRITABLE;
+
+  // Last owner of the frame, no need to copy
+  if (pmm_get_block_count((void *)paddr) <= 1)
+  {
+    *entry = paddr | flags;
+    vmm_flush_tlb_entry(vaddr);
+    return 0;
+  }
+
+  uint32_t new_paddr = (uint32_t)pmm_alloc_block();
+  if (!new_paddr)
+    return -ENOMEM;
+
+  struct page p = {.frame = new_paddr};
+  kmap(&p);
+  memcpy((char *)p.virtual, (char *)vaddr, PMM_FRAME_SIZE);
+  kunmap(&p);
+
+  *entry = new_paddr | flags;
+  vmm_flush_tlb_entry(vaddr);
+  pmm_free_block((void *)paddr);
+  return 0;
+}
@@ -5,11 +5,18 @@
 #include <include/list.h>
 #include "pmm.h"
 #include "kernel_info.h"
+#include "slab.h"
 
 #define KERNEL_HEAP_TOP 0xF0000000
 #define KERNEL_HEAP_BOTTOM 0xD0000000
+#define KERNEL_STACK_TOP 0xF8000000
+#define KERNEL_STACK_BOTTOM 0xF0000000
 #define USER_HEAP_TOP 0x40000000
 
+#define LARGE_PAGE_SIZE 0x400000
+#define LARGE_PAGE_MASK (~(LARGE_PAGE_SIZE - 1))
+#define LARGE_PAGE_ALIGN(addr) (((addr) + LARGE_PAGE_SIZE - 1) & LARGE_PAGE_MASK)
+
 struct vm_area_struct;
 struct mm_struct;
 
@@ -27,6 +34,7 @@ enum PAGE_PTE_FLAGS
   I86_PTE_PAT = 0x80,           //0000000000000000000000010000000
   I86_PTE_CPU_GLOBAL = 0x100,   //0000000000000000000000100000000
   I86_PTE_LV4_GLOBAL = 0x200,   //0000000000000000000001000000000
+  I86_PTE_COW = 0x400,          //0000000000000000000010000000000 (available bit, copy-on-write page)
   I86_PTE_FRAME = 0x7FFFF000    //1111111111111111111000000000000
 };
 
@@ -55,6 +63,9 @@ typedef uint32_t pd_entry;
 #define PAGES_PER_TABLE 1024
 #define PAGES_PER_DIR 1024
 
+// alloc_page flags
+#define GFP_ZERO 0x01 /* zero-filled frame, taken from pre-zeroed pool when possible */
+
 struct page
 {
   uint32_t frame;
@@ -83,10 +94,16 @@ void vmm_init();
 struct pdirectory *vmm_get_directory();
 void vmm_map_address(struct pdirectory *dir, uint32_t virt, uint32_t phys, uint32_t flags);
 void vmm_unmap_address(struct pdirectory *va_dir, uint32_t virt);
-void *create_kernel_stack(int32_t blocks);
+void vmm_map_large_address(struct pdirectory *va_dir, uint32_t virt, uint32_t phys, uint32_t flags);
+void vmm_map_range(struct pdirectory *va_dir, uint32_t virt, uint32_t phys, uint32_t size, uint32_t flags);
+void vmm_unmap_range(struct pdirectory *va_dir, uint32_t start, uint32_t end);
+void vmm_free_user_space(struct pdirectory *va_dir);
 struct pdirectory *vmm_create_address_space(struct pdirectory *dir);
+void vmm_free_address_space(struct pdirectory *va_dir);
 uint32_t vmm_get_physical_address(uint32_t vaddr, bool is_page);
-struct pdirectory *vmm_fork(struct pdirectory *va_dir);
+bool vmm_is_page_present(uint32_t vaddr);
+struct pdirectory *vmm_fork(struct pdirectory *va_dir, struct mm_struct *mm);
+int32_t vmm_cow_page(uint32_t vaddr);
 
 // malloc.c
 void *sbrk(size_t n);
@@ -95,14 +112,23 @@ void *kcalloc(size_t n, size_t size);
 void *krealloc(void *ptr, size_t size);
 void kfree(void *ptr);
 void *kalign_heap(size_t size);
+size_t kmalloc_block_used();
 
 // mmap.c
 struct vm_area_struct *get_unmapped_area(uint32_t addr, uint32_t len);
+struct vm_area_struct *get_unmapped_aligned_area(uint32_t addr, uint32_t len, uint32_t align);
+struct vm_area_struct *find_vma(struct mm_struct *mm, uint32_t addr);
+void vma_link(struct mm_struct *mm, struct vm_area_struct *vma);
+void vma_unlink(struct mm_struct *mm, struct vm_area_struct *vma);
 int expand_stack(struct vm_area_struct *vma, unsigned long address);
 int32_t do_mmap(uint32_t addr,
                 size_t len, uint32_t prot,
                 uint32_t flag, int32_t fd);
+int32_t do_anonymous_page(uint32_t addr);
+int32_t do_file_page(uint32_t addr);
 int do_munmap(struct mm_struct *mm, uint32_t addr, size_t len);
+void free_vmas(struct mm_struct *mm);
+void exit_mmap(struct mm_struct *mm);
 uint32_t do_brk(uint32_t addr, size_t len);
 
 // highmem.c
@@ -111,4 +137,13 @@ void kmaps(struct pages *p);
 void kunmap(struct page *p);
 void kunmaps(struct pages *p);
 
+// kstack.c
+uint32_t alloc_kernel_stack();
+void free_kernel_stack(uint32_t top);
+
+// zpool.c
+void *alloc_page(uint32_t gfp_flags);
+bool zpool_need_refill();
+void zpool_init();
+
 #endif
\ No newline at end of file
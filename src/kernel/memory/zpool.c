@@ -0,0 +1,100 @@
+#include <kernel/cpu/hal.h>
+#include <kernel/locking/spinlock.h>
+#include <kernel/proc/task.h>
+#include "vmm.h"
+
+/*
+  Pool of pre-zeroed frames, clearing is moved out of latency-critical paths (page fault, sbrk, fork)
+  + kzerod (idle thread) only gets cpu when nothing else is ready (instead of halt in schedule),
+    it refills the pool up to ZPOOL_SIZE and gives cpu back as soon as another thread is ready
+  + alloc_page(GFP_ZERO) takes a frame from the pool, if the pool is empty the frame is cleared inline
+  Frames in the pool are already allocated (count = 1) and not mapped anywhere
+  Pool is shared by every cpu and alloc_page is called with or without the kernel lock, zpool_lock guards
+  frames and count, clearing runs outside of it (pmm and pkmap used underneath have their own locks)
+*/
+
+#define ZPOOL_SIZE 256 /* 1MB */
+#define ZPOOL_LOW 64   /* idle cpu wakes kzerod below this */
+
+extern struct thread *idle_thread;
+
+static spinlock_t zpool_lock = SPINLOCK_INITIALIZER;
+static uint32_t zpool_frames[ZPOOL_SIZE];
+static uint32_t zpool_count = 0;
+
+static void clear_page(uint32_t paddr)
+{
+  struct page p = {.frame = paddr};
+  kmap(&p);
+  memset((char *)p.virtual, 0, PMM_FRAME_SIZE);
+  kunmap(&p);
+}
+
+void *alloc_page(uint32_t gfp_flags)
+{
+  if (!(gfp_flags & GFP_ZERO))
+    return pmm_alloc_block();
+
+  uint32_t paddr = 0;
+  uint32_t flags = irq_save();
+  spin_lock(&zpool_lock);
+  if (zpool_count)
+    paddr = zpool_frames[--zpool_count];
+  spin_unlock(&zpool_lock);
+  irq_restore(flags);
+
+  if (paddr)
+    return (void *)paddr;
+
+  paddr = (uint32_t)pmm_alloc_block();
+  if (paddr)
+    clear_page(paddr);
+  return (void *)paddr;
+}
+
+bool zpool_need_refill()
+{
+  return zpool_count < ZPOOL_LOW;
+}
+
+static void kzerod()
+{
+  while (true)
+  {
+    while (zpool_count < ZPOOL_SIZE && !has_ready_thread())
+    {
+      uint32_t paddr = (uint32_t)pmm_alloc_block();
+      if (!paddr)
+        break;
+
+      clear_page(paddr);
+
+      // pool might have been refilled meanwhile (count is only read unlocked as a hint)
+      uint32_t flags = irq_save();
+      spin_lock(&zpool_lock);
+      bool stored = zpool_count < ZPOOL_SIZE;
+      if (stored)
+        zpool_frames[zpool_count++] = paddr;
+      spin_unlock(&zpool_lock);
+      irq_restore(flags);
+
+      if (!stored)
+      {
+        pmm_free_block((void *)paddr);
+        break;
+      }
+
+      // Let syscalls on other cpus in between pages
+      unlock_kernel();
+      lock_kernel();
+    }
+
+    update_thread(current_thread, THREAD_BLOCKED);
+    schedule();
+  }
+}
+
+void zpool_init()
+{
+  idle_thread = create_kernel_thread(current_process, (uint32_t)kzerod, THREAD_BLOCKED, 0);
+}
@@ -4,19 +4,19 @@
 #include <kernel/cpu/pic.h>
 #include <kernel/memory/vmm.h>
 #include <kernel/proc/task.h>
+#include <kernel/proc/workqueue.h>
 #include <kernel/system/console.h>
 #include <kernel/utils/printf.h>
 #include <kernel/net/net.h>
 #include "rtl8139.h"
 
-extern struct process *current_process;
-
 static uint32_t ioaddr;
 static char rx_buffer[RX_PADDING_BUFFER_SIZE] __attribute__((aligned(4)));
 // NOTE: MQ 2020-04-10 The maximum ethernet transmitted packet's size is 1792 -> one page
 static char tx_buffer[4][PMM_FRAME_SIZE] __attribute__((aligned(4)));
 static uint8_t mac_address[6];
 static uint8_t tx_counter = 0;
+static struct work_struct rx_work;
 
 void rtl8139_send_packet(void *payload, uint32_t size)
 {
@@ -56,6 +56,11 @@ void rtl8139_receive_packet()
   }
 }
 
+static void rtl8139_rx_work(struct work_struct *work)
+{
+  rtl8139_receive_packet();
+}
+
 int rtl8139_irq_handler(struct interrupt_registers *regs)
 {
   uint16_t status = inportw(ioaddr + RTL8139_IntrStatus);
@@ -68,9 +73,10 @@ int rtl8139_irq_handler(struct interrupt_registers *regs)
   if (status & TOK)
   {
   }
+  // Packets stay in rx ring until kworker copies them out, irq only acks
   if (status & ROK)
   {
-    rtl8139_receive_packet();
+    queue_work(&rx_work);
   }
 
   return IRQ_HANDLER_CONTINUE;
@@ -86,6 +92,7 @@ void rtl8139_init()
   struct pci_device *dev = get_pci_device(RTL8139_VENDOR_ID, RTL8139_DEVICE_ID);
   ioaddr = dev->bar0 & 0xFFFFFFFC;
   memset(rx_buffer, 0, RX_PADDING_BUFFER_SIZE);
+  work_setup(&rx_work, rtl8139_rx_work, 0);
 
   for (int i = 0; i < 6; ++i)
     mac_address[i] = inportb(ioaddr + RTL8139_MAC0 + i);
@@ -1,4 +1,5 @@
 #include <include/errno.h>
+#include <include/mman.h>
 #include <kernel/memory/pmm.h>
 #include <kernel/memory/vmm.h>
 #include <kernel/proc/task.h>
@@ -11,8 +12,6 @@
 #define ERR_WRONG_VERSION 4
 #define ERR_NOT_SUPPORTED_TYPE 5
 
-extern struct process *current_process;
-
 int elf_verify(struct Elf32_Ehdr *elf_header)
 {
   if (!(elf_header->e_ident[EI_MAG0] == ELFMAG0 &&
@@ -57,52 +56,125 @@ int elf_verify(struct Elf32_Ehdr *elf_header)
 * 	| .text section |
 * 	+---------------+
 */
-struct Elf32_Layout *elf_load(char *buf)
+/*
+  Segments are not copied anymore, each PT_LOAD becomes a private file mapping which is read page by page on fault (do_file_page)
+  + [p_vaddr, p_vaddr + p_filesz) is backed by the file, the rest of the last file page is zero
+  + pages which are entirely bss are an anonymous area (zero-filled on first touch)
+  Only elf header and program headers are read when loading, cost of starting a program is the pages it touches
+*/
+static int32_t elf_map_segment(struct vfs_file *file, struct Elf32_Phdr *ph)
 {
-  struct Elf32_Ehdr *elf_header = (struct Elf32_Ehdr *)buf;
+  uint32_t start = ph->p_vaddr & PAGE_MASK;
+  uint32_t file_end = ph->p_vaddr + ph->p_filesz;
+  uint32_t end = PAGE_ALIGN(ph->p_vaddr + ph->p_memsz);
+  uint32_t flags = 0;
+
+  if (ph->p_flags & PF_R)
+    flags |= VM_READ;
+  if (ph->p_flags & PF_W)
+    flags |= VM_WRITE;
+  if (ph->p_flags & PF_X)
+    flags |= VM_EXEC;
+
+  uint32_t bss_start = end;
+  if (ph->p_filesz)
+  {
+    bss_start = PAGE_ALIGN(file_end);
+    struct vm_area_struct *vma = get_unmapped_area(start, bss_start - start);
+    if (!vma)
+      return -ENOMEM;
+
+    vma->vm_flags = flags;
+    vma->vm_file = get_file(file);
+    vma->vm_pgoff = ph->p_offset - (ph->p_vaddr - start);
+    vma->vm_file_end = file_end;
+  }
+  else
+    bss_start = start;
+
+  if (bss_start < end)
+  {
+    struct vm_area_struct *vma = get_unmapped_area(bss_start, end - bss_start);
+    if (!vma)
+      return -ENOMEM;
 
-  if (elf_verify(elf_header) != NO_ERROR || elf_header->e_phoff == 0)
+    vma->vm_flags = flags;
+  }
+
+  return 0;
+}
+
+// elf header and program headers are in the first page, a warm binary reads them from page cache
+static void elf_read(struct vfs_file *file, char *buf, uint32_t count, uint32_t pos)
+{
+  struct page p = {.frame = pos + count <= PMM_FRAME_SIZE ? filemap_get_page(file, 0) : 0};
+  if (!p.frame)
+  {
+    file->f_op->read(file, buf, count, pos);
+    return;
+  }
+
+  kmap(&p);
+  memcpy(buf, (char *)p.virtual + pos, count);
+  kunmap(&p);
+  pmm_free_block((void *)p.frame);
+}
+
+struct Elf32_Layout *elf_load(struct vfs_file *file)
+{
+  struct Elf32_Ehdr elf_header;
+  elf_read(file, (char *)&elf_header, sizeof(struct Elf32_Ehdr), 0);
+
+  if (elf_verify(&elf_header) != NO_ERROR || elf_header.e_phoff == 0)
     return NULL;
 
+  uint32_t phsize = elf_header.e_phentsize * elf_header.e_phnum;
+  char *phdrs = kcalloc(phsize, sizeof(char));
+  elf_read(file, phdrs, phsize, elf_header.e_phoff);
+
   struct mm_struct *mm = current_process->mm;
   struct Elf32_Layout *layout = kcalloc(1, sizeof(struct Elf32_Layout));
-  layout->entry = elf_header->e_entry;
-  for (struct Elf32_Phdr *ph = (struct Elf32_Phdr *)(buf + elf_header->e_phoff);
-       ph && (char *)ph < (buf + elf_header->e_phoff + elf_header->e_phentsize * elf_header->e_phnum);
-       ++ph)
+  layout->entry = elf_header.e_entry;
+  for (char *iter = phdrs; iter < phdrs + phsize; iter += elf_header.e_phentsize)
   {
-    if (ph->p_type != PT_LOAD)
+    struct Elf32_Phdr *ph = (struct Elf32_Phdr *)iter;
+    if (ph->p_type != PT_LOAD || !ph->p_memsz)
       continue;
 
+    // areas which are already mapped go away with the process (exit_mmap)
+    if (elf_map_segment(file, ph) < 0)
+    {
+      kfree(phdrs);
+      kfree(layout);
+      return NULL;
+    }
+
     // text segment
     if ((ph->p_flags & PF_X) != 0 && (ph->p_flags & PF_R) != 0)
     {
-      do_mmap(ph->p_vaddr, ph->p_memsz, 0, 0, -1);
       mm->start_code = ph->p_vaddr;
       mm->end_code = ph->p_vaddr + ph->p_memsz;
     }
     // data segment
     else if ((ph->p_flags & PF_W) != 0 && (ph->p_flags & PF_R) != 0)
     {
-      do_mmap(ph->p_vaddr, ph->p_memsz, 0, 0, -1);
       mm->start_data = ph->p_vaddr;
-      mm->end_data = ph->p_memsz;
+      mm->end_data = ph->p_vaddr + ph->p_memsz;
     }
-    // eh frame
-    else
-      do_mmap(ph->p_vaddr, ph->p_memsz, 0, 0, -1);
+  }
+  kfree(phdrs);
 
-    // NOTE: MQ 2019-11-26 According to elf's spec, p_memsz may be larger than p_filesz due to bss section
-    memset((char *)ph->p_vaddr, 0, ph->p_memsz);
-    memcpy((char *)ph->p_vaddr, buf + ph->p_offset, ph->p_filesz);
+  int32_t heap_start = do_mmap(0, UHEAP_SIZE, PROT_READ | PROT_WRITE, 0, -1);
+  int32_t stack_start = do_mmap(0, STACK_SIZE, PROT_READ | PROT_WRITE, 0, -1);
+  if (heap_start < 0 || stack_start < 0)
+  {
+    kfree(layout);
+    return NULL;
   }
 
-  uint32_t heap_start = do_mmap(0, UHEAP_SIZE, 0, 0, -1);
   mm->start_brk = heap_start;
   mm->brk = heap_start;
   mm->end_brk = USER_HEAP_TOP;
-
-  uint32_t stack_start = do_mmap(0, STACK_SIZE, 0, 0, -1);
   layout->stack = stack_start + STACK_SIZE;
 
   return layout;
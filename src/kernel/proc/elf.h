@@ -166,6 +166,6 @@ struct Elf32_Layout
   uint32_t entry;
 };
 
-struct Elf32_Layout *elf_load(char *);
+struct Elf32_Layout *elf_load(struct vfs_file *file);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,277 @@
+#include <include/errno.h>
+#include <include/wait.h>
+#include <kernel/cpu/hal.h>
+#include <kernel/fs/vfs.h>
+#include <kernel/locking/spinlock.h>
+#include <kernel/memory/vmm.h>
+#include <kernel/utils/hashmap.h>
+#include "task.h"
+
+/*
+  Process teardown
+  + the last thread of a process releases its user space and files in do_exit, process becomes a zombie
+  + a terminated thread can't free the kernel stack it is running on, reaper (kernel thread) frees stack,
+    fpu state and struct thread once the thread's cpu has switched away (on_cpu is cleared)
+  + the last reaped thread takes page directory, fs, files and mm with it, zombie is only pid and exit code
+  + parent collects the zombie by waitpid, children of kernel processes, of processes which set nocldwait
+    (like SIGCHLD ignored) and orphans are freed without it
+  Everything except the terminated list (sched_lock) runs under the big kernel lock
+*/
+
+extern struct hashmap mprocess;
+extern struct kmem_cache *thread_cache;
+
+static spinlock_t reaper_lock = SPINLOCK_INITIALIZER;
+static struct thread *reaper;
+static bool reaper_pending = true; /* threads which terminated before reaper started (swapper) */
+
+// kernel processes (swapper, init) never load a program and never wait for their children
+static bool is_kernel_process(struct process *p)
+{
+  return !p->mm->end_code;
+}
+
+static void release_process(struct process *p)
+{
+  hashmap_remove(&mprocess, &p->pid);
+  kfree(p);
+}
+
+// the last thread is reaped, nothing runs in the address space anymore
+static void release_process_resources(struct process *p)
+{
+  if (p->pdir)
+    vmm_free_address_space(p->pdir);
+  kfree(p->files);
+  kfree(p->fs);
+  kfree(p->mm);
+  kfree(p->name);
+  p->pdir = NULL;
+  p->files = NULL;
+  p->fs = NULL;
+  p->mm = NULL;
+  p->name = NULL;
+}
+
+static void release_zombie(struct process *p)
+{
+  p->state = PROCESS_DEAD;
+  if (list_empty(&p->threads))
+    release_process(p);
+}
+
+static void release_thread(struct thread *t)
+{
+  struct process *p = t->parent;
+
+  list_del(&t->sibling);
+  fpu_release(t);
+  free_kernel_stack(t->kernel_stack);
+  kmem_cache_free(thread_cache, t);
+
+  if (p->state == PROCESS_RUNNING || !list_empty(&p->threads))
+    return;
+
+  release_process_resources(p);
+  if (p->state == PROCESS_DEAD)
+    release_process(p);
+}
+
+static void wake_reaper()
+{
+  uint32_t flags = irq_save();
+  spin_lock(&reaper_lock);
+
+  reaper_pending = true;
+  if (reaper && reaper->state == THREAD_BLOCKED)
+    update_thread(reaper, THREAD_READY);
+
+  spin_unlock(&reaper_lock);
+  irq_restore(flags);
+}
+
+static void reaper_thread()
+{
+  while (true)
+  {
+    uint32_t flags = irq_save();
+    spin_lock(&reaper_lock);
+
+    // blocked under reaper_lock -> wake_reaper in between can't miss it
+    if (!reaper_pending)
+    {
+      update_thread(current_thread, THREAD_BLOCKED);
+      spin_unlock(&reaper_lock);
+      irq_restore(flags);
+      schedule();
+      continue;
+    }
+
+    reaper_pending = false;
+    spin_unlock(&reaper_lock);
+    irq_restore(flags);
+
+    bool busy;
+    do
+    {
+      busy = false;
+      struct thread *t;
+      while ((t = pick_terminated_thread(&busy)))
+        release_thread(t);
+
+      // exiting thread is still switching out on its cpu
+      if (busy)
+        sleep(1);
+    } while (busy);
+  }
+}
+
+void reaper_init()
+{
+  reaper = create_kernel_thread(current_process, (uint32_t)reaper_thread, THREAD_BLOCKED, 0);
+  update_thread(reaper, THREAD_READY);
+}
+
+// process which couldn't be set up completely (out of memory), it has never run and nobody waits for it
+void release_unstarted_process(struct process *p)
+{
+  for (uint32_t fd = 0; p->files && fd < MAX_FD; ++fd)
+  {
+    if (p->files->fd[fd])
+      fput(p->files->fd[fd]);
+  }
+  if (p->mm)
+    free_vmas(p->mm);
+  if (p->parent)
+    list_del(&p->sibling);
+  release_process_resources(p);
+  release_process(p);
+}
+
+static void exit_files(struct process *p)
+{
+  for (uint32_t fd = 0; fd < MAX_FD; ++fd)
+  {
+    if (p->files->fd[fd])
+      vfs_close(fd);
+  }
+}
+
+static void exit_notify(struct process *p)
+{
+  // orphans are not waited for by anybody
+  struct process *child, *next;
+  list_for_each_entry_safe(child, next, &p->children, sibling)
+  {
+    list_del(&child->sibling);
+    child->parent = NULL;
+    if (child->state == PROCESS_ZOMBIE)
+      release_zombie(child);
+  }
+
+  struct process *parent = p->parent;
+  if (!parent || is_kernel_process(parent) || parent->nocldwait)
+  {
+    if (parent)
+      list_del(&p->sibling);
+    p->parent = NULL;
+    p->state = PROCESS_DEAD;
+  }
+  else
+    p->state = PROCESS_ZOMBIE;
+
+  // waitpid of a nocldwait parent returns -ECHILD once its last child is gone
+  if (parent && parent->wait_thread)
+  {
+    update_thread(parent->wait_thread, THREAD_READY);
+    parent->wait_thread = NULL;
+  }
+}
+
+// The last thread of a process releases its user address space (frames, page tables and vmas)
+void do_exit(int32_t code)
+{
+  struct thread *t = current_thread;
+  struct process *p = current_process;
+  t->exit_code = code;
+
+  bool is_last_thread = true;
+  struct thread *iter;
+  list_for_each_entry(iter, &p->threads, sibling)
+  {
+    if (iter != t && iter->state != THREAD_TERMINATED)
+      is_last_thread = false;
+  }
+
+  if (is_last_thread)
+  {
+    exit_mmap(p->mm);
+    exit_files(p);
+    p->exit_code = code;
+    exit_notify(p);
+  }
+
+  update_thread(t, THREAD_TERMINATED);
+  wake_reaper();
+  schedule();
+}
+
+// exiting children are released right away, zombies which are already there too
+int32_t do_nocldwait(bool enable)
+{
+  struct process *p = current_process;
+  p->nocldwait = enable;
+  if (!enable)
+    return 0;
+
+  struct process *child, *next;
+  list_for_each_entry_safe(child, next, &p->children, sibling)
+  {
+    if (child->state != PROCESS_ZOMBIE)
+      continue;
+
+    list_del(&child->sibling);
+    child->parent = NULL;
+    release_zombie(child);
+  }
+  return 0;
+}
+
+int32_t do_waitpid(pid_t pid, int32_t *status, int32_t options)
+{
+  struct process *p = current_process;
+
+  while (true)
+  {
+    bool has_child = false;
+    struct process *child;
+    list_for_each_entry(child, &p->children, sibling)
+    {
+      if (pid != (pid_t)-1 && child->pid != pid)
+        continue;
+
+      has_child = true;
+      if (child->state != PROCESS_ZOMBIE)
+        continue;
+
+      pid_t child_pid = child->pid;
+      if (status)
+        *status = (child->exit_code & 0xff) << 8;
+
+      list_del(&child->sibling);
+      child->parent = NULL;
+      release_zombie(child);
+      return child_pid;
+    }
+
+    if (!has_child)
+      return -ECHILD;
+    if (options & WNOHANG)
+      return 0;
+
+    // exiting child wakes it up under the big kernel lock too -> wakeup can't be missed
+    p->wait_thread = current_thread;
+    update_thread(current_thread, THREAD_BLOCKED);
+    schedule();
+  }
+}
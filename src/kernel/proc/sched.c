@@ -1,204 +1,625 @@
 #include <include/limits.h>
 #include <kernel/cpu/hal.h>
+#include <kernel/cpu/fpu.h>
 #include <kernel/cpu/idt.h>
 #include <kernel/cpu/pic.h>
 #include <kernel/cpu/pit.h>
+#include <kernel/cpu/smp.h>
 #include <kernel/cpu/tss.h>
+#include <kernel/locking/spinlock.h>
 #include <kernel/memory/vmm.h>
+#include <kernel/system/time.h>
+#include <kernel/system/timer.h>
 #include "task.h"
 
 extern void irq_task_handler();
-extern void do_switch(uint32_t *addr_current_kernel_esp, uint32_t next_kernel_esp, uint32_t cr3);
-
-extern struct thread *current_thread;
-extern struct process *current_process;
+extern void do_switch(uint32_t *addr_current_kernel_esp, uint32_t next_kernel_esp, uint32_t cr3, volatile uint32_t *addr_current_on_cpu);
+
+/*
+  Each cpu has its own run queues, sched_lock protects all of them (and thread states)
+  + a woken thread goes back to the cpu it ran on unless that cpu is busy and another one is idle
+  + a cpu without ready threads steals one from another cpu before it goes idle
+  + thread which is still switching out on its cpu (on_cpu) can't be stolen, its kernel stack is in use
+  A thread is queued on an idle cpu -> reschedule ipi wakes that cpu up
+*/
+struct cpu_runqueue
+{
+  struct runqueue kernel, system;
+  struct cfs_runqueue app;
+};
 
 struct thread *idle_thread;
-struct plist_head terminated_list, waiting_list;
-struct plist_head kernel_ready_list, system_ready_list, app_ready_list;
+struct list_head terminated_list;
+static struct cpu_runqueue runqueues[MAX_CPUS];
+static spinlock_t sched_lock = SPINLOCK_INITIALIZER;
 
-static uint32_t scheduler_lock_counter = 0;
 void lock_scheduler()
 {
   disable_interrupts();
-  scheduler_lock_counter++;
+  this_cpu()->scheduler_lock_counter++;
 }
 
 void unlock_scheduler()
 {
-  scheduler_lock_counter--;
-  if (scheduler_lock_counter == 0)
+  struct cpu *cpu = this_cpu();
+  cpu->scheduler_lock_counter--;
+  if (cpu->scheduler_lock_counter == 0)
     enable_interrupts();
 }
 
-struct thread *pick_next_thread_from_list(struct plist_head *list)
+/*
+  O(1) run queues: one fifo per priority level (0 is the highest) per policy,
+  bit n of bitmap is set when queue[n] is not empty -> bsf gives the highest ready level
+  enqueue (tail), dequeue and pick next thread are constant time
+*/
+static inline uint32_t bsf(uint32_t word)
+{
+  uint32_t index;
+  __asm__ __volatile__("bsf %1, %0"
+                       : "=r"(index)
+                       : "rm"(word));
+  return index;
+}
+
+static void runqueue_init(struct runqueue *rq)
+{
+  rq->bitmap = 0;
+  for (uint32_t i = 0; i < MAX_PRIO; ++i)
+    INIT_LIST_HEAD(&rq->queue[i]);
+}
+
+static void runqueue_add(struct runqueue *rq, struct thread *t)
+{
+  list_add_tail(&t->sched_sibling, &rq->queue[t->priority]);
+  rq->bitmap |= 1 << t->priority;
+}
+
+static void runqueue_del(struct runqueue *rq, struct thread *t)
+{
+  list_del_init(&t->sched_sibling);
+  if (list_empty(&rq->queue[t->priority]))
+    rq->bitmap &= ~(1 << t->priority);
+}
+
+static struct runqueue *get_runqueue(uint32_t cpu, enum thread_policy policy)
+{
+  if (policy == THREAD_KERNEL_POLICY)
+    return &runqueues[cpu].kernel;
+  else
+    return &runqueues[cpu].system;
+}
+
+/*
+  Fair-share class for app threads (same idea as linux cfs), kernel and system policies stay strict-priority above it
+  + each cpu keeps its ready app threads in a tree ordered by vruntime, the leftmost one runs next
+  + vruntime grows with real runtime scaled by NICE_0_WEIGHT / weight, weight comes from priority
+  + running thread gives cpu up when it used its share of SCHED_LATENCY (at least SCHED_MIN_GRANULARITY),
+    the tick on bsp checks every cpu and kicks them by ipi, switch happens when thread returns to user mode
+  + waking thread is placed at most half of SCHED_LATENCY before min_vruntime (sleeper credit) -> interactive apps
+    run right after an input event, but sleeping for long doesn't bank more credit than that
+*/
+#define SCHED_LATENCY_NS 6000000ULL
+#define SCHED_MIN_GRANULARITY_NS 750000ULL
+#define SCHED_WAKEUP_GRANULARITY_NS 1000000ULL
+#define SCHED_NR_LATENCY (SCHED_LATENCY_NS / SCHED_MIN_GRANULARITY_NS)
+#define NICE_0_WEIGHT 1024
+
+// priority 0 -> 31 is nice -16 -> 15, one level is ~10% cpu more or less
+static const uint32_t prio_to_weight[MAX_PRIO] = {
+    36291, 29154, 23254, 18705, 14949, 11916, 9548, 7620,
+    6100, 4904, 3906, 3121, 2501, 1991, 1586, 1277,
+    1024, 820, 655, 526, 423, 335, 272, 215,
+    172, 137, 110, 87, 70, 56, 45, 36};
+
+// cached copy of get_tsc_khz() for the hot path
+static uint32_t tsc_khz;
+
+// pit has to be ticking (interrupts are enabled)
+static void sched_clock_init()
+{
+  tsc_khz = get_tsc_khz();
+}
+
+// nanoseconds, tsc is fine grained (pit is 1ms) and can be read on every cpu
+static uint64_t sched_clock()
+{
+  uint64_t cycles = rdtsc();
+  return cycles / tsc_khz * 1000000 + cycles % tsc_khz * 1000000 / tsc_khz;
+}
+
+static inline uint32_t thread_weight(struct thread *t)
+{
+  return prio_to_weight[t->priority];
+}
+
+static uint64_t calc_delta_fair(uint64_t delta, struct thread *t)
+{
+  uint32_t weight = thread_weight(t);
+  return weight == NICE_0_WEIGHT ? delta : delta * NICE_0_WEIGHT / weight;
+}
+
+static struct thread *cfs_first(struct cfs_runqueue *cfs)
+{
+  return rb_entry_safe(rb_first(&cfs->tasks), struct thread, cfs_node);
+}
+
+// min_vruntime follows the smallest vruntime (running or queued) but never goes backward
+static void cfs_update_min_vruntime(struct cfs_runqueue *cfs, struct thread *curr)
+{
+  struct thread *first = cfs_first(cfs);
+  if (!curr && !first)
+    return;
+
+  uint64_t vruntime = curr ? curr->vruntime : first->vruntime;
+  if (curr && first && (int64_t)(first->vruntime - vruntime) < 0)
+    vruntime = first->vruntime;
+
+  if ((int64_t)(vruntime - cfs->min_vruntime) > 0)
+    cfs->min_vruntime = vruntime;
+}
+
+static void cfs_enqueue(struct cfs_runqueue *cfs, struct thread *t)
+{
+  struct rb_node **link = &cfs->tasks.rb_node, *parent = NULL;
+
+  while (*link)
+  {
+    parent = *link;
+    struct thread *entry = rb_entry(parent, struct thread, cfs_node);
+    // same vruntime goes right -> fifo
+    if ((int64_t)(t->vruntime - entry->vruntime) < 0)
+      link = &parent->rb_left;
+    else
+      link = &parent->rb_right;
+  }
+
+  rb_link_node(&t->cfs_node, parent, link);
+  rb_insert_color(&t->cfs_node, &cfs->tasks, NULL);
+  cfs->nr_running++;
+  cfs->load += thread_weight(t);
+}
+
+static void cfs_dequeue(struct cfs_runqueue *cfs, struct thread *t)
 {
-  if (plist_head_empty(list))
+  rb_erase(&t->cfs_node, &cfs->tasks, NULL);
+  cfs->nr_running--;
+  cfs->load -= thread_weight(t);
+}
+
+// new thread starts at min_vruntime, waking thread gets the sleeper credit
+static void cfs_place_thread(struct cfs_runqueue *cfs, struct thread *t, bool wakeup)
+{
+  uint64_t vruntime = cfs->min_vruntime;
+  if (wakeup)
+    vruntime -= SCHED_LATENCY_NS / 2;
+
+  if ((int64_t)(t->vruntime - vruntime) < 0)
+    t->vruntime = vruntime;
+}
+
+// share of latency period for curr, period is stretched when there are too many threads
+static uint64_t cfs_slice(struct cfs_runqueue *cfs, struct thread *curr)
+{
+  uint32_t nr_running = cfs->nr_running + 1;
+  uint64_t period = nr_running > SCHED_NR_LATENCY ? nr_running * SCHED_MIN_GRANULARITY_NS : SCHED_LATENCY_NS;
+  uint32_t weight = thread_weight(curr);
+
+  return period * weight / (cfs->load + weight);
+}
+
+static bool cfs_check_preempt_tick(struct cfs_runqueue *cfs, struct thread *curr)
+{
+  if (!cfs->nr_running)
+    return false;
+
+  uint64_t ideal_runtime = cfs_slice(cfs, curr);
+  uint64_t delta_exec = curr->sum_exec_runtime - curr->prev_sum_exec_runtime;
+  if (delta_exec > ideal_runtime)
+    return true;
+  if (delta_exec < SCHED_MIN_GRANULARITY_NS)
+    return false;
+
+  return (int64_t)(curr->vruntime - cfs_first(cfs)->vruntime) > (int64_t)ideal_runtime;
+}
+
+// charge running thread for the time since exec_start, sched_lock is held
+static void update_curr(struct thread *curr)
+{
+  uint64_t now = sched_clock();
+  // tsc of other cpus can be slightly behind
+  uint64_t delta = now > curr->exec_start ? now - curr->exec_start : 0;
+
+  curr->exec_start = now;
+  curr->sum_exec_runtime += delta;
+  if (curr->policy == THREAD_APP_POLICY)
+  {
+    curr->vruntime += calc_delta_fair(delta, curr);
+    cfs_update_min_vruntime(&runqueues[curr->cpu].app, curr);
+  }
+}
+
+static void resched_cpu(uint32_t cpu)
+{
+  cpus[cpu].need_resched = true;
+  smp_send_reschedule(cpu);
+}
+
+// policy classes are ordered kernel > system > app (lower enum value wins)
+static bool has_higher_class_ready(struct cpu_runqueue *rq, enum thread_policy policy)
+{
+  return (policy > THREAD_KERNEL_POLICY && rq->kernel.bitmap) || (policy > THREAD_SYSTEM_POLICY && rq->system.bitmap);
+}
+
+// a thread of a higher class always wins, an app thread against an app thread only when it is clearly behind
+static void check_preempt_wakeup(uint32_t cpu, struct thread *t)
+{
+  struct thread *curr = cpus[cpu].thread;
+  if (!curr || curr == t || curr->state != THREAD_RUNNING)
+    return;
+
+  update_curr(curr);
+  if (t->policy < curr->policy)
+    resched_cpu(cpu);
+  else if (t->policy == THREAD_APP_POLICY && curr->policy == THREAD_APP_POLICY &&
+           (int64_t)(curr->vruntime - t->vruntime) > (int64_t)SCHED_WAKEUP_GRANULARITY_NS)
+    resched_cpu(cpu);
+}
+
+struct thread *pick_next_thread_from_runqueue(struct runqueue *rq)
+{
+  if (!rq->bitmap)
     return NULL;
 
-  struct thread *t = plist_first_entry(list, struct thread, sched_sibling);
-  plist_del(&t->sched_sibling, list);
+  struct thread *t = list_first_entry(&rq->queue[bsf(rq->bitmap)], struct thread, sched_sibling);
+  runqueue_del(rq, t);
   return t;
 }
 
-struct thread *pick_next_thread_to_run()
+static bool runqueues_empty(uint32_t cpu)
 {
-  struct thread *nt = pick_next_thread_from_list(&kernel_ready_list);
-  if (!nt)
-    nt = pick_next_thread_from_list(&system_ready_list);
+  return !runqueues[cpu].kernel.bitmap && !runqueues[cpu].system.bitmap && !runqueues[cpu].app.nr_running;
+}
+
+bool has_ready_thread()
+{
+  return !runqueues_empty(this_cpu()->id);
+}
+
+// Idle cpu lets idle thread (kzerod) refill pre-zeroed pool instead of halting
+struct thread *pick_idle_thread()
+{
+  if (!idle_thread || idle_thread == current_thread || idle_thread->on_cpu || idle_thread->state != THREAD_BLOCKED || !zpool_need_refill())
+    return NULL;
+
+  remove_thread(idle_thread);
+  return idle_thread;
+}
+
+static struct thread *pick_local_thread(uint32_t cpu)
+{
+  struct thread *nt = pick_next_thread_from_runqueue(&runqueues[cpu].kernel);
   if (!nt)
-    nt = pick_next_thread_from_list(&app_ready_list);
+    nt = pick_next_thread_from_runqueue(&runqueues[cpu].system);
+  if (!nt && (nt = cfs_first(&runqueues[cpu].app)))
+    cfs_dequeue(&runqueues[cpu].app, nt);
 
   return nt;
 }
 
-struct plist_head *get_list_from_thread(enum thread_state state, enum thread_policy policy)
+// highest priority thread of rq which is not running anywhere
+static struct thread *steal_from_runqueue(struct runqueue *rq)
 {
-  if (state == THREAD_READY)
+  for (uint32_t bitmap = rq->bitmap; bitmap; bitmap &= bitmap - 1)
   {
-    if (policy == THREAD_KERNEL_POLICY)
-      return &kernel_ready_list;
-    else if (policy == THREAD_SYSTEM_POLICY)
-      return &system_ready_list;
-    else
-      return &app_ready_list;
+    struct thread *t;
+    list_for_each_entry(t, &rq->queue[bsf(bitmap)], sched_sibling)
+    {
+      if (t->on_cpu)
+        continue;
+
+      runqueue_del(rq, t);
+      return t;
+    }
   }
-  else if (state == THREAD_WAITING)
-    return &waiting_list;
-  else if (state == THREAD_TERMINATED)
-    return &terminated_list;
   return NULL;
 }
 
-int get_top_priority_from_list(enum thread_state state, enum thread_policy policy)
+static struct thread *steal_from_cfs(struct cfs_runqueue *cfs)
 {
-  struct plist_head *h = get_list_from_thread(state, policy);
+  for (struct rb_node *node = rb_first(&cfs->tasks); node; node = rb_next(node))
+  {
+    struct thread *t = rb_entry(node, struct thread, cfs_node);
+    if (t->on_cpu)
+      continue;
+
+    cfs_dequeue(cfs, t);
+    return t;
+  }
+  return NULL;
+}
 
-  if (!plist_head_empty(h))
+static struct thread *steal_thread(uint32_t self)
+{
+  for (uint32_t i = 1; i < nr_cpus; ++i)
   {
-    struct plist_node *node = plist_first(h);
-    if (node)
-      return node->prio;
+    uint32_t cpu = (self + i) % nr_cpus;
+    if (runqueues_empty(cpu))
+      continue;
+
+    struct thread *t = steal_from_runqueue(&runqueues[cpu].kernel);
+    if (!t)
+      t = steal_from_runqueue(&runqueues[cpu].system);
+    // vruntime is relative to min_vruntime of the queue it is in
+    if (!t && (t = steal_from_cfs(&runqueues[cpu].app)))
+      t->vruntime = t->vruntime - runqueues[cpu].app.min_vruntime + runqueues[self].app.min_vruntime;
+    if (t)
+    {
+      t->cpu = self;
+      return t;
+    }
   }
-  return INT_MAX;
+  return NULL;
 }
 
-void queue_thread(struct thread *t)
+struct thread *pick_next_thread_to_run()
+{
+  uint32_t self = this_cpu()->id;
+  struct thread *nt = pick_local_thread(self);
+  if (!nt)
+    nt = steal_thread(self);
+
+  return nt;
+}
+
+int get_top_priority_from_list(enum thread_state state, enum thread_policy policy)
 {
-  struct plist_head *h = get_list_from_thread(t->state, t->policy);
+  // app threads are ordered by vruntime, not by priority
+  if (state != THREAD_READY || policy == THREAD_APP_POLICY)
+    return INT_MAX;
 
-  if (h)
-    plist_add(&t->sched_sibling, h);
+  struct runqueue *rq = get_runqueue(this_cpu()->id, policy);
+  return rq->bitmap ? (int)bsf(rq->bitmap) : INT_MAX;
+}
+
+// cpu the thread ran on if it is free (warm cache), otherwise any idle cpu
+static uint32_t select_cpu(struct thread *t)
+{
+  if (t->cpu < nr_cpus && cpus[t->cpu].idle)
+    return t->cpu;
+
+  for (uint32_t i = 0; i < nr_cpus; ++i)
+    if (cpus[i].online && cpus[i].idle)
+      return i;
+
+  return t->cpu < nr_cpus ? t->cpu : this_cpu()->id;
+}
+
+void queue_thread(struct thread *t, bool wakeup)
+{
+  // Waiting (timer) and blocked (semaphore, message queue) threads are not kept in any scheduler list
+  if (t->state == THREAD_READY)
+  {
+    // thread which is still on its cpu is picked up there (it might be that cpu's idle loop)
+    uint32_t cpu = t->on_cpu ? t->cpu : select_cpu(t);
+    if (t->policy == THREAD_APP_POLICY)
+    {
+      struct cfs_runqueue *cfs = &runqueues[cpu].app;
+      if (cpu != t->cpu)
+        t->vruntime = t->vruntime - runqueues[t->cpu].app.min_vruntime + cfs->min_vruntime;
+      cfs_place_thread(cfs, t, wakeup);
+      cfs_enqueue(cfs, t);
+    }
+    else
+      runqueue_add(get_runqueue(cpu, t->policy), t);
+    t->cpu = cpu;
+
+    if (cpus[cpu].idle)
+      smp_send_reschedule(cpu);
+    else
+      check_preempt_wakeup(cpu, t);
+  }
+  else if (t->state == THREAD_TERMINATED)
+    list_add_tail(&t->sched_sibling, &terminated_list);
 }
 
 void remove_thread(struct thread *t)
 {
-  struct plist_head *h = get_list_from_thread(t->state, t->policy);
+  if (t->state == THREAD_READY && t->policy == THREAD_APP_POLICY)
+    cfs_dequeue(&runqueues[t->cpu].app, t);
+  else if (t->state == THREAD_READY)
+    runqueue_del(get_runqueue(t->cpu, t->policy), t);
+  else if (t->state == THREAD_TERMINATED)
+    list_del_init(&t->sched_sibling);
+}
+
+// Terminated thread is only handed to reaper after its cpu has switched away from its kernel stack
+struct thread *pick_terminated_thread(bool *busy)
+{
+  lock_scheduler();
+  spin_lock(&sched_lock);
+
+  struct thread *t, *found = NULL;
+  list_for_each_entry(t, &terminated_list, sched_sibling)
+  {
+    if (t->on_cpu)
+    {
+      *busy = true;
+      continue;
+    }
+
+    list_del_init(&t->sched_sibling);
+    found = t;
+    break;
+  }
 
-  if (h)
-    plist_del(&t->sched_sibling, h);
+  spin_unlock(&sched_lock);
+  unlock_scheduler();
+  return found;
 }
 
 void update_thread(struct thread *thread, uint8_t state)
 {
   lock_scheduler();
+  spin_lock(&sched_lock);
+
+  bool wakeup = thread->state == THREAD_WAITING || thread->state == THREAD_BLOCKED;
+  if (thread->state == THREAD_RUNNING)
+    update_curr(thread);
 
   remove_thread(thread);
   thread->state = state;
-  queue_thread(thread);
+  queue_thread(thread, wakeup);
 
+  spin_unlock(&sched_lock);
   unlock_scheduler();
 }
 
+// sched_lock is held, it is released before the stack switch
 void switch_thread(struct thread *nt)
 {
-  if (current_thread == nt)
+  struct cpu *cpu = this_cpu();
+  struct thread *pt = cpu->thread;
+
+  cpu->need_resched = false;
+  nt->exec_start = sched_clock();
+  nt->prev_sum_exec_runtime = nt->sum_exec_runtime;
+
+  // woken up again before another thread got the cpu (idle loop)
+  if (pt == nt)
+  {
+    nt->state = THREAD_RUNNING;
+    spin_unlock(&sched_lock);
     return;
+  }
 
-  struct thread *pt = current_thread;
+  cpu->thread = nt;
+  cpu->process = nt->parent;
+  nt->state = THREAD_RUNNING;
+  nt->cpu = cpu->id;
+  nt->on_cpu = 1;
+  nt->parent->active_thread = nt;
 
-  current_thread = nt;
-  current_thread->time_slice = 0;
-  current_thread->state = THREAD_RUNNING;
-  current_process = current_thread->parent;
-  current_process->active_thread = current_thread;
+  // Same page directory (threads of a process, kernel threads) -> 0, do_switch keeps cr3 and TLB
+  uint32_t paddr_cr3 = pt->parent->pdir == nt->parent->pdir ? 0 : vmm_get_physical_address((uint32_t)nt->parent->pdir, true);
+  tss_set_stack(0x10, nt->kernel_stack);
+  fpu_switch_out(pt);
 
-  uint32_t paddr_cr3 = vmm_get_physical_address((uint32_t)current_thread->parent->pdir, true);
-  tss_set_stack(0x10, current_thread->kernel_stack);
-  do_switch(&pt->esp, current_thread->esp, paddr_cr3);
+  spin_unlock(&sched_lock);
+  do_switch(&pt->esp, nt->esp, paddr_cr3, &pt->on_cpu);
+}
+
+static void set_idle(struct cpu *cpu, bool idle)
+{
+  if (cpu->idle == idle)
+    return;
+
+  cpu->idle = idle;
+  // bsp's periodic tick might be stopped, it has to keep time for the busy cpu
+  if (!idle && cpu->id != 0 && cpus[0].idle)
+    smp_send_reschedule(0);
 }
 
 void schedule()
 {
   lock_scheduler();
 
-  if (current_thread->state == THREAD_RUNNING)
+  struct thread *t = current_thread;
+  if (t->state == THREAD_RUNNING)
     return;
 
+  uint32_t lock_depth = release_kernel_lock(t);
+  spin_lock(&sched_lock);
+
   struct thread *nt = pick_next_thread_to_run();
 
   if (!nt)
   {
-    // update_thread(current_thread, THREAD_RUNNING);
+    struct cpu *cpu = this_cpu();
     do
     {
+      nt = pick_idle_thread();
+      if (nt)
+        break;
+
+      set_idle(cpu, true);
+      spin_unlock(&sched_lock);
+
+      // Periodic tick is stopped while halting, lapic one-shot wakes cpu up for the next timer
+      timer_idle_enter();
       enable_interrupts();
       halt();
       disable_interrupts();
+      timer_idle_exit();
+
+      spin_lock(&sched_lock);
       nt = pick_next_thread_to_run();
     } while (!nt);
+    set_idle(cpu, false);
   }
 
   switch_thread(nt);
+  reacquire_kernel_lock(t, lock_depth);
   unlock_scheduler();
 }
 
+// Only called on the way back to user mode (no lock is held), kernel code is never preempted
+void preempt_schedule()
+{
+  struct cpu *cpu = this_cpu();
+  if (!cpu->need_resched)
+    return;
+
+  cpu->need_resched = false;
+  update_thread(current_thread, THREAD_READY);
+  schedule();
+}
+
+static void process_timeout(struct timer_list *timer)
+{
+  update_thread((struct thread *)timer->data, THREAD_READY);
+}
+
+// Sleeping thread is only referenced by its timer, tick handler doesn't scan sleepers anymore
 void sleep(uint32_t delay)
 {
   lock_scheduler();
 
-  uint32_t time = get_milliseconds_from_boot();
-  uint32_t when = time + delay;
-  if (when > time)
-  {
-    current_thread->expiry_when = when;
-    update_thread(current_thread, THREAD_WAITING);
-  }
+  struct timer_list timer;
+  timer_setup(&timer, process_timeout, (uint32_t)current_thread);
+  timer.expires = get_milliseconds_from_boot() + delay;
+
+  // waiting before the timer is armed, a timer which fires right away (other cpu) wakes it up instead of being lost
+  update_thread(current_thread, THREAD_WAITING);
+  timer_add(&timer);
   schedule();
+  timer_del(&timer);
 
   unlock_scheduler();
 }
 
-#define SLICE_THRESHOLD 50
+// Scheduler tick (pit, bsp only) charges running threads of every cpu and kicks the ones which used their slice
+// or have a thread of a higher class waiting
 int32_t irq_schedule_handler(struct interrupt_registers *regs)
 {
-  lock_scheduler();
-
-  bool is_schedulable = false;
-  uint32_t time = get_milliseconds_from_boot();
-  current_thread->time_slice++;
-
-  struct thread *t = NULL;
-  plist_for_each_entry(t, &waiting_list, sched_sibling)
-  {
-    if (t->expiry_when >= time)
-    {
-      update_thread(t, THREAD_READY);
-      is_schedulable = true;
-    }
-  }
+  uint32_t flags = irq_save();
+  spin_lock(&sched_lock);
 
-  if (current_thread->time_slice >= SLICE_THRESHOLD && current_thread->sched_sibling.prio == THREAD_APP_POLICY)
+  for (uint32_t i = 0; i < nr_cpus; ++i)
   {
-    update_thread(current_thread, THREAD_READY);
-    is_schedulable = true;
+    struct cpu *cpu = &cpus[i];
+    struct thread *curr = cpu->thread;
+    if (!cpu->online || cpu->idle || !curr || curr->state != THREAD_RUNNING)
+      continue;
+
+    update_curr(curr);
+    struct cpu_runqueue *rq = &runqueues[i];
+    if (has_higher_class_ready(rq, curr->policy) ||
+        (curr->policy == THREAD_APP_POLICY && cfs_check_preempt_tick(&rq->app, curr)))
+      resched_cpu(i);
   }
 
-  // NOTE: MQ 2019-10-15 If counter is 1, it means that there is not running scheduler
-  if (is_schedulable && scheduler_lock_counter == 1)
-    schedule();
-
-  unlock_scheduler();
+  spin_unlock(&sched_lock);
+  irq_restore(flags);
 
   return IRQ_HANDLER_CONTINUE;
 }
@@ -210,22 +631,40 @@ int32_t thread_page_fault(struct interrupt_registers *regs)
   __asm__ __volatile__("mov %%cr2, %0"
                        : "=r"(faultAddr));
 
+  lock_kernel();
+
+  int32_t ret = IRQ_HANDLER_CONTINUE;
   if (faultAddr == PROCESS_TRAPPED_PAGE_FAULT && regs->cs == 0x1B)
   {
-    update_thread(current_thread, THREAD_TERMINATED);
-    schedule();
+    do_exit(0);
 
-    return IRQ_HANDLER_STOP;
+    ret = IRQ_HANDLER_STOP;
   }
-
-  return IRQ_HANDLER_CONTINUE;
+  // Not-present page (error code: !present) inside an anonymous area is allocated on first touch
+  else if (!(regs->err_code & 0x1) && do_anonymous_page(faultAddr) == 0)
+    ret = IRQ_HANDLER_STOP;
+  // Not-present page inside a private file mapping (elf segments) is read from the file on first touch
+  else if (!(regs->err_code & 0x1) && do_file_page(faultAddr) == 0)
+    ret = IRQ_HANDLER_STOP;
+  // Write to a present page (error code: present | write) might be a copy-on-write page
+  else if ((regs->err_code & 0x3) == 0x3 && vmm_cow_page(faultAddr) == 0)
+    ret = IRQ_HANDLER_STOP;
+
+  unlock_kernel();
+  return ret;
 }
 
 void sched_init()
 {
-  plist_head_init(&kernel_ready_list);
-  plist_head_init(&system_ready_list);
-  plist_head_init(&app_ready_list);
-  plist_head_init(&waiting_list);
-  plist_head_init(&terminated_list);
+  for (uint32_t i = 0; i < MAX_CPUS; ++i)
+  {
+    runqueue_init(&runqueues[i].kernel);
+    runqueue_init(&runqueues[i].system);
+    runqueues[i].app.tasks = RB_ROOT;
+  }
+  INIT_LIST_HEAD(&terminated_list);
+
+  sched_clock_init();
+  // bsp takes threads from now on, aps when they are up
+  this_cpu()->online = true;
 }
\ No newline at end of file
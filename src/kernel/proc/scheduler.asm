@@ -8,8 +8,13 @@ do_switch:
 
   mov eax, [esp + (8 + 2) * 4]     ; load next task's kernel stack to esp
   mov ebx, [esp + (8 + 3) * 4]     ; load next task's page directory
+  mov ecx, [esp + (8 + 4) * 4]     ; load current task's on_cpu flag
   mov esp, eax
-  mov cr3, ebx     
+  test ebx, ebx    ; 0 -> next task shares page directory, skip reloading cr3 (TLB flush)
+  jz .keep_cr3
+  mov cr3, ebx
+.keep_cr3:
+  mov dword [ecx], 0 ; current task's stack is not used anymore, other cpus can run it
 
   popa
   sti
@@ -0,0 +1,83 @@
+#include <kernel/cpu/hal.h>
+#include <kernel/cpu/smp.h>
+#include <kernel/utils/string.h>
+#include "softirq.h"
+
+/*
+  Softirqs are the bottom half of an irq which can't wait for a thread (timer wheel)
+  + irq handler only acks the device and raises a vector, vectors of this cpu run on irq exit with interrupts enabled
+  + softirqs never nest on a cpu, an irq which comes in the middle only raises its vector, the running loop picks it up
+  + handlers must not sleep, allocate or take the big kernel lock, anything like that goes to a workqueue
+  Vectors which keep being raised are left to the next irq exit after MAX_SOFTIRQ_RESTART rounds
+*/
+
+#define MAX_SOFTIRQ_RESTART 10
+
+static void (*softirq_actions[NR_SOFTIRQS])();
+// per cpu -> counters are only touched with interrupts disabled on their own cpu
+static struct softirq_stat softirq_stats[MAX_CPUS][NR_SOFTIRQS];
+
+void open_softirq(enum softirq_vector nr, void (*action)())
+{
+  softirq_actions[nr] = action;
+}
+
+void raise_softirq(enum softirq_vector nr)
+{
+  uint32_t flags = irq_save();
+
+  struct cpu *cpu = this_cpu();
+  cpu->softirq_pending |= 1 << nr;
+  softirq_stats[cpu->id][nr].raised++;
+
+  irq_restore(flags);
+}
+
+// interrupts are disabled (irq exit)
+void do_softirq()
+{
+  struct cpu *cpu = this_cpu();
+  if (cpu->in_softirq || !cpu->softirq_pending)
+    return;
+
+  cpu->in_softirq = true;
+  for (uint32_t restart = 0; cpu->softirq_pending && restart < MAX_SOFTIRQ_RESTART; ++restart)
+  {
+    uint32_t pending = cpu->softirq_pending;
+    cpu->softirq_pending = 0;
+
+    enable_interrupts();
+    for (uint32_t nr = 0; nr < NR_SOFTIRQS; ++nr)
+    {
+      if (!(pending & (1 << nr)) || !softirq_actions[nr])
+        continue;
+
+      uint64_t start = rdtsc();
+      softirq_actions[nr]();
+      uint64_t cycles = rdtsc() - start;
+
+      struct softirq_stat *stat = &softirq_stats[cpu->id][nr];
+      disable_interrupts();
+      stat->handled++;
+      if (cycles > stat->max_cycles)
+        stat->max_cycles = cycles;
+      enable_interrupts();
+    }
+    disable_interrupts();
+  }
+  cpu->in_softirq = false;
+}
+
+void softirq_get_stat(enum softirq_vector nr, struct softirq_stat *stat)
+{
+  memset(stat, 0, sizeof(struct softirq_stat));
+
+  for (uint32_t i = 0; i < nr_cpus; ++i)
+  {
+    struct softirq_stat *cpu_stat = &softirq_stats[i][nr];
+    stat->raised += cpu_stat->raised;
+    stat->handled += cpu_stat->handled;
+    if (cpu_stat->max_cycles > stat->max_cycles)
+      stat->max_cycles = cpu_stat->max_cycles;
+  }
+}
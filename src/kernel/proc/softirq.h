@@ -0,0 +1,24 @@
+#ifndef PROC_SOFTIRQ_H
+#define PROC_SOFTIRQ_H
+
+#include <stdint.h>
+
+enum softirq_vector
+{
+  TIMER_SOFTIRQ,
+  NR_SOFTIRQS,
+};
+
+struct softirq_stat
+{
+  uint32_t raised;
+  uint32_t handled;
+  uint64_t max_cycles; /* longest single run of the handler */
+};
+
+void open_softirq(enum softirq_vector nr, void (*action)());
+void raise_softirq(enum softirq_vector nr);
+void do_softirq();
+void softirq_get_stat(enum softirq_vector nr, struct softirq_stat *stat);
+
+#endif
@@ -1,3 +1,4 @@
+#include <include/errno.h>
 #include <kernel/cpu/hal.h>
 #include <kernel/cpu/idt.h>
 #include <kernel/cpu/pic.h>
@@ -8,23 +9,26 @@
 #include <kernel/proc/elf.h>
 #include <kernel/fs/vfs.h>
 #include <kernel/system/time.h>
+#include <kernel/system/vdso.h>
 #include <kernel/utils/hashmap.h>
 #include "task.h"
 
 extern void enter_usermode(uint32_t eip, uint32_t esp, uint32_t failed_address);
 extern void return_usermode(struct interrupt_registers *regs);
-extern void irq_schedule_handler(struct interrupt_registers *regs);
+extern int32_t irq_schedule_handler(struct interrupt_registers *regs);
 extern int32_t thread_page_fault(struct interrupt_registers *regs);
 
-volatile struct thread *current_thread;
-volatile struct process *current_process;
 static uint32_t next_pid = 0;
 static uint32_t next_tid = 0;
 struct hashmap mprocess;
+struct kmem_cache *thread_cache;
+struct kmem_cache *vm_area_cache;
 
 struct files_struct *clone_file_descriptor_table(struct process *parent)
 {
   struct files_struct *files = kcalloc(1, sizeof(struct files_struct));
+  if (!files)
+    return NULL;
 
   if (parent)
   {
@@ -41,41 +45,81 @@ struct files_struct *clone_file_descriptor_table(struct process *parent)
 struct mm_struct *clone_mm_struct(struct process *parent)
 {
   struct mm_struct *mm = kcalloc(1, sizeof(struct mm_struct));
+  if (!mm)
+    return NULL;
+
   memcpy(mm, parent->mm, sizeof(struct mm_struct));
   INIT_LIST_HEAD(&mm->mmap);
+  mm->mm_rb = RB_ROOT;
+  mm->mmap_cache = NULL;
 
   struct vm_area_struct *iter = NULL;
   list_for_each_entry(iter, &parent->mm->mmap, vm_sibling)
   {
-    struct vm_area_struct *clone = kcalloc(1, sizeof(struct vm_area_struct));
+    struct vm_area_struct *clone = kmem_cache_zalloc(vm_area_cache);
+    if (!clone)
+    {
+      free_vmas(mm);
+      kfree(mm);
+      return NULL;
+    }
+
     clone->vm_start = iter->vm_start;
     clone->vm_end = iter->vm_end;
-    clone->vm_file = iter->vm_file;
+    clone->vm_file = iter->vm_file ? get_file(iter->vm_file) : NULL;
+    clone->vm_pgoff = iter->vm_pgoff;
+    clone->vm_file_end = iter->vm_file_end;
     clone->vm_flags = iter->vm_flags;
-    clone->vm_mm = mm;
-    list_add_tail(&clone->vm_sibling, &mm->mmap);
+    vma_link(mm, clone);
   }
 
   return mm;
 }
 
+// Priorities out of range (like top - 1 from posix_spawn) are pinned to the nearest level
+static int clamp_priority(int priority)
+{
+  if (priority < 0)
+    return 0;
+  if (priority >= MAX_PRIO)
+    return MAX_PRIO - 1;
+  return priority;
+}
+
 void kernel_thread_entry(struct thread *t, void *flow())
 {
+  lock_kernel();
   flow();
-  schedule();
+  // Kernel thread which returns is reaped like a user one
+  do_exit(0);
 }
 
 struct thread *create_kernel_thread(struct process *parent, uint32_t eip, enum thread_state state, int priority)
 {
   disable_interrupts();
 
-  struct thread *t = kcalloc(1, sizeof(struct thread));
+  uint32_t kernel_stack = alloc_kernel_stack();
+  if (!kernel_stack)
+  {
+    enable_interrupts();
+    return NULL;
+  }
+
+  struct thread *t = kmem_cache_zalloc(thread_cache);
+  if (!t)
+  {
+    free_kernel_stack(kernel_stack);
+    enable_interrupts();
+    return NULL;
+  }
+
   t->tid = next_tid++;
-  t->kernel_stack = (uint32_t)(kcalloc(STACK_SIZE, sizeof(char)) + STACK_SIZE);
+  t->kernel_stack = kernel_stack;
   t->parent = parent;
   t->state = state;
   t->esp = t->kernel_stack - sizeof(struct trap_frame);
-  plist_node_init(&t->sched_sibling, priority);
+  t->priority = clamp_priority(priority);
+  INIT_LIST_HEAD(&t->sched_sibling);
 
   struct trap_frame *frame = (struct trap_frame *)t->esp;
   memset(frame, 0, sizeof(struct trap_frame));
@@ -106,19 +150,34 @@ struct process *create_process(struct process *parent, const char *name, struct
   disable_interrupts();
 
   struct process *p = kcalloc(1, sizeof(struct process));
+  if (!p)
+  {
+    enable_interrupts();
+    return NULL;
+  }
+
   p->pid = next_pid++;
   p->name = strdup(name);
-  if (pdir)
-    p->pdir = vmm_create_address_space(pdir);
-  else
-    p->pdir = vmm_get_directory();
-  p->parent = parent;
   p->files = clone_file_descriptor_table(parent);
   p->fs = kcalloc(1, sizeof(struct fs_struct));
-
   p->mm = kcalloc(1, sizeof(struct mm_struct));
-  INIT_LIST_HEAD(&p->mm->mmap);
+  if (p->mm)
+  {
+    INIT_LIST_HEAD(&p->mm->mmap);
+    p->mm->mm_rb = RB_ROOT;
+  }
 
+  if (p->name && p->files && p->fs && p->mm)
+    p->pdir = pdir ? vmm_create_address_space(pdir) : vmm_get_directory();
+  // not linked to the parent yet
+  if (!p->pdir)
+  {
+    release_unstarted_process(p);
+    enable_interrupts();
+    return NULL;
+  }
+
+  p->parent = parent;
   if (parent)
   {
     memcpy(p->fs, parent->fs, sizeof(struct fs_struct));
@@ -146,8 +205,10 @@ void setup_swapper_process()
 void task_init(void *func)
 {
   hashmap_init(&mprocess, hashmap_hash_uint32, hashmap_compare_uint32, 0);
+  thread_cache = kmem_cache_create("thread", sizeof(struct thread), 0);
+  vm_area_cache = kmem_cache_create("vm_area_struct", sizeof(struct vm_area_struct), 0);
   sched_init();
-  // register_interrupt_handler(IRQ0, irq_schedule_handler);
+  register_interrupt_handler(IRQ0, irq_schedule_handler);
   register_interrupt_handler(14, thread_page_fault);
 
   setup_swapper_process();
@@ -162,39 +223,77 @@ void task_init(void *func)
 
 void user_thread_entry(struct thread *t)
 {
+  lock_kernel();
+  vdso_map_process();
+  unlock_kernel();
+
   tss_set_stack(0x10, t->kernel_stack);
   return_usermode(&t->uregs);
 }
 
 void user_thread_elf_entry(struct thread *t, const char *path, void (*setup)(struct Elf32_Layout *))
 {
-  char *buf = vfs_read(path);
-  struct Elf32_Layout *elf_layout = elf_load(buf);
+  lock_kernel();
+  // elf file stays open as backing of its segments (read on page fault)
+  struct vfs_file *file = filp_open(path);
+  kfree((void *)path);
+  struct Elf32_Layout *elf_layout = file ? elf_load(file) : NULL;
+  // segments hold their own references, the file is released when the last mapping goes away
+  if (file)
+    fput(file);
+  // missing or broken program, the process goes away before it reaches user mode
+  if (!elf_layout)
+    do_exit(-ENOEXEC);
   t->user_stack = elf_layout->stack;
+  vdso_map_process();
   tss_set_stack(0x10, t->kernel_stack);
   if (setup)
     setup(elf_layout);
-  enter_usermode(elf_layout->stack, elf_layout->entry, PROCESS_TRAPPED_PAGE_FAULT);
+
+  uint32_t stack = elf_layout->stack;
+  uint32_t entry = elf_layout->entry;
+  kfree(elf_layout);
+  unlock_kernel();
+  enter_usermode(stack, entry, PROCESS_TRAPPED_PAGE_FAULT);
 }
 
 struct thread *create_user_thread(struct process *parent, const char *path, enum thread_state state, enum thread_policy policy, int priority, void (*setup)(struct Elf32_Layout *))
 {
   disable_interrupts();
 
-  struct thread *t = kcalloc(1, sizeof(struct thread));
+  uint32_t kernel_stack = alloc_kernel_stack();
+  if (!kernel_stack)
+  {
+    enable_interrupts();
+    return NULL;
+  }
+
+  struct thread *t = kmem_cache_zalloc(thread_cache);
+  char *thread_path = strdup(path);
+  if (!t || !thread_path)
+  {
+    kfree(thread_path);
+    if (t)
+      kmem_cache_free(thread_cache, t);
+    free_kernel_stack(kernel_stack);
+    enable_interrupts();
+    return NULL;
+  }
+
   t->tid = next_tid++;
   t->parent = parent;
   t->state = state;
   t->policy = policy;
-  t->kernel_stack = (uint32_t)(kcalloc(STACK_SIZE, sizeof(char)) + STACK_SIZE);
+  t->kernel_stack = kernel_stack;
   t->esp = t->kernel_stack - sizeof(struct trap_frame);
-  plist_node_init(&t->sched_sibling, priority);
+  t->priority = clamp_priority(priority);
+  INIT_LIST_HEAD(&t->sched_sibling);
 
   struct trap_frame *frame = (struct trap_frame *)t->esp;
   memset(frame, 0, sizeof(struct trap_frame));
 
   frame->parameter3 = (uint32_t)setup;
-  frame->parameter2 = (uint32_t)strdup(path);
+  frame->parameter2 = (uint32_t)thread_path;
   frame->parameter1 = (uint32_t)t;
   frame->return_address = PROCESS_TRAPPED_PAGE_FAULT;
   frame->eip = (uint32_t)user_thread_elf_entry;
@@ -215,19 +314,58 @@ struct thread *create_user_thread(struct process *parent, const char *path, enum
   return t;
 }
 
-void process_load(const char *pname, const char *path, int priority, void (*setup)(struct Elf32_Layout *))
+int32_t process_load(const char *pname, const char *path, enum thread_policy policy, int priority, void (*setup)(struct Elf32_Layout *))
 {
   struct process *p = create_process(current_process, pname, current_process->pdir);
-  struct thread *t = create_user_thread(p, path, THREAD_READY, THREAD_SYSTEM_POLICY, priority, setup);
-  queue_thread(t);
+  if (!p)
+    return -ENOMEM;
+
+  struct thread *t = create_user_thread(p, path, THREAD_NEW, policy, priority, setup);
+  if (!t)
+  {
+    release_unstarted_process(p);
+    return -ENOMEM;
+  }
+
+  update_thread(t, THREAD_READY);
+  return 0;
 }
 
 struct process *process_fork(struct process *parent)
 {
   disable_interrupts();
 
+  // nothing is cloned yet when there is no kernel stack for the child
+  uint32_t kernel_stack = alloc_kernel_stack();
+  if (!kernel_stack)
+  {
+    enable_interrupts();
+    return NULL;
+  }
+
+  // copy active parent's thread
+  struct thread *parent_thread = parent->active_thread;
+  struct thread *t = kmem_cache_zalloc(thread_cache);
+  if (!t || fpu_fork(parent_thread, t) < 0)
+  {
+    if (t)
+      kmem_cache_free(thread_cache, t);
+    free_kernel_stack(kernel_stack);
+    enable_interrupts();
+    return NULL;
+  }
+
   // fork process
   struct process *p = kcalloc(1, sizeof(struct process));
+  if (!p)
+  {
+    fpu_release(t);
+    kmem_cache_free(thread_cache, t);
+    free_kernel_stack(kernel_stack);
+    enable_interrupts();
+    return NULL;
+  }
+
   p->pid = next_pid++;
   p->gid = parent->pid;
   p->name = strdup(parent->name);
@@ -240,26 +378,35 @@ struct process *process_fork(struct process *parent)
   list_add_tail(&p->sibling, &parent->children);
 
   p->fs = kcalloc(1, sizeof(struct fs_struct));
-  memcpy(p->fs, parent->fs, sizeof(struct fs_struct));
+  if (p->fs)
+    memcpy(p->fs, parent->fs, sizeof(struct fs_struct));
 
   p->files = clone_file_descriptor_table(parent);
-  p->pdir = vmm_fork(parent->pdir);
+  // address space goes last, it is the most expensive part to clone and to undo
+  if (p->name && p->mm && p->fs && p->files)
+    p->pdir = vmm_fork(parent->pdir, parent->mm);
+  if (!p->pdir)
+  {
+    release_unstarted_process(p);
+    fpu_release(t);
+    kmem_cache_free(thread_cache, t);
+    free_kernel_stack(kernel_stack);
+    enable_interrupts();
+    return NULL;
+  }
 
-  // copy active parent's thread
-  struct thread *parent_thread = parent->active_thread;
-  struct thread *t = kcalloc(1, sizeof(struct thread));
   t->tid = next_tid++;
-  t->state = THREAD_READY;
+  t->state = THREAD_NEW;
   t->policy = parent_thread->policy;
-  t->time_slice = 0;
   t->parent = p;
-  t->kernel_stack = (uint32_t)(kcalloc(STACK_SIZE, sizeof(char)) + STACK_SIZE);
+  t->kernel_stack = kernel_stack;
   t->user_stack = parent_thread->user_stack;
   // NOTE: MQ 2019-12-18 Setup trap frame
   t->esp = t->kernel_stack - sizeof(struct trap_frame);
-  plist_node_init(&t->sched_sibling, parent_thread->sched_sibling.prio);
+  t->priority = parent_thread->priority;
+  INIT_LIST_HEAD(&t->sched_sibling);
 
-  memcpy(&t->uregs, &parent_thread->uregs, sizeof(struct interrupt_registers));
+  memcpy(&t->uregs, parent_thread->syscall_regs, sizeof(struct interrupt_registers));
   t->uregs.eax = 0;
 
   struct trap_frame *frame = (struct trap_frame *)t->esp;
@@ -286,4 +433,4 @@ struct process *process_fork(struct process *parent)
 struct process *get_process(pid_t pid)
 {
   return hashmap_get(&mprocess, &pid);
-}
\ No newline at end of file
+}
@@ -4,8 +4,11 @@
 #include <stdint.h>
 #include <include/ctype.h>
 #include <include/list.h>
+#include <kernel/cpu/fpu.h>
 #include <kernel/cpu/idt.h>
-#include <kernel/utils/plist.h>
+#include <kernel/cpu/smp.h>
+#include <kernel/utils/rbtree.h>
+#include <kernel/locking/kernel_lock.h>
 #include <kernel/locking/semaphore.h>
 #include <kernel/memory/vmm.h>
 #include <kernel/proc/elf.h>
@@ -15,6 +18,8 @@
 #define MAX_THREADS 0x10000
 #define STACK_SIZE 0x2000
 #define UHEAP_SIZE 0x20000
+#define MAX_PRIO 32 /* priority levels per policy, 0 is the highest */
+#define DEFAULT_APP_PRIO 16 /* app thread weight 1024 (nice 0) */
 
 // vm_flags
 #define VM_READ 0x00000001 /* currently active flags */
@@ -31,7 +36,8 @@ enum thread_state
   THREAD_NEW,
   THREAD_READY,
   THREAD_RUNNING,
-  THREAD_WAITING,
+  THREAD_WAITING, /* sleeping, woken by its timer */
+  THREAD_BLOCKED, /* waiting for an event (semaphore, message queue), woken by whoever owns the event */
   THREAD_TERMINATED,
 } thread_state;
 
@@ -42,6 +48,14 @@ enum thread_policy
   THREAD_APP_POLICY,
 } thread_policy;
 
+// Zombie only keeps pid and exit code (resources are gone) until its parent collects it by waitpid
+enum process_state
+{
+  PROCESS_RUNNING,
+  PROCESS_ZOMBIE, /* exited, parent hasn't waited for it yet */
+  PROCESS_DEAD,   /* nobody waits for it, freed as soon as its threads are reaped */
+};
+
 struct files_struct
 {
   struct semaphore lock;
@@ -70,17 +84,25 @@ struct vm_area_struct
   uint32_t vm_flags;
 
   struct list_head vm_sibling;
+  struct rb_node vm_rb;
+  // largest free gap (before vma) in rb subtree, used by get_unmapped_area
+  uint32_t rb_subtree_gap;
   struct vfs_file *vm_file;
+  // private file mapping: file offset of vm_start, bytes from vm_file_end to vm_end are zero (elf's bss part)
+  uint32_t vm_pgoff;
+  uint32_t vm_file_end;
 };
 
 struct mm_struct
 {
+  // vmas are in both sorted list (iteration) and rbtree (lookup, gap search)
   struct list_head mmap;
-  uint32_t free_area_cache;
+  struct rb_root mm_rb;
+  struct vm_area_struct *mmap_cache; /* last find_vma result */
   uint32_t start_code, end_code, start_data, end_data;
   // NOTE: MQ 2020-01-30
   // end_brk is marked as the end of heap section, brk is end but in range start_brk<->end_brk and expand later
-  // better way is only mapping start_brk->brk and handling page fault brk->end_brk
+  // heap (as other anonymous areas) is demand paged, frames are only allocated on page fault
   uint32_t start_brk, brk, end_brk, start_stack;
 };
 
@@ -93,12 +115,38 @@ struct thread
   uint32_t esp;
   uint32_t kernel_stack;
   uint32_t user_stack;
-  uint32_t expiry_when;
-  uint32_t time_slice;
   int32_t exit_code;
-  struct interrupt_registers uregs;
+  struct interrupt_registers uregs;         /* user context a new thread starts with */
+  struct interrupt_registers *syscall_regs; /* frame of the running syscall (kernel stack) */
   struct list_head sibling;
-  struct plist_node sched_sibling;
+  int priority;
+  struct list_head sched_sibling;
+  uint32_t cpu;             /* run queue the thread is queued in (last cpu it ran on) */
+  volatile uint32_t on_cpu; /* kernel stack is in use, cleared by do_switch */
+  uint32_t lock_depth;      /* big kernel lock */
+  // fair-share class (app policy), times are in nanoseconds
+  struct rb_node cfs_node;
+  uint64_t vruntime;
+  uint64_t exec_start;
+  uint64_t sum_exec_runtime;
+  uint64_t prev_sum_exec_runtime; /* sum_exec_runtime when thread got cpu */
+  // allocated on first fpu/sse instruction
+  struct fpu_state *fpu;
+  uint32_t fpu_cpu; /* cpu which saved fpu state last time */
+};
+
+struct runqueue
+{
+  uint32_t bitmap;
+  struct list_head queue[MAX_PRIO];
+};
+
+struct cfs_runqueue
+{
+  struct rb_root tasks; /* ready app threads ordered by vruntime, running one is not in the tree */
+  uint64_t min_vruntime;
+  uint32_t nr_running;
+  uint32_t load; /* sum of weights in the tree */
 };
 
 struct process
@@ -116,6 +164,10 @@ struct process
   struct list_head sibling;
   struct list_head children;
   struct list_head threads;
+  enum process_state state;
+  int32_t exit_code;
+  struct thread *wait_thread; /* thread blocked in waitpid, woken by an exiting child */
+  bool nocldwait;             /* children are released when they exit instead of staying zombies (not inherited) */
 };
 
 void task_init();
@@ -125,13 +177,22 @@ struct thread *create_kernel_thread(struct process *parent, uint32_t eip, enum t
 struct thread *create_user_thread(struct process *parent, const char *path, enum thread_state state, enum thread_policy policy, int priority, void (*setup)(struct Elf32_Layout *));
 void update_thread(struct thread *thread, uint8_t state);
 struct process *create_process(struct process *parent, const char *name, struct pdirectory *pdir);
-void process_load(const char *pname, const char *path, int priority, void (*setup)(struct Elf32_Layout *));
+int32_t process_load(const char *pname, const char *path, enum thread_policy policy, int priority, void (*setup)(struct Elf32_Layout *));
 struct process *process_fork(struct process *parent);
-void queue_thread(struct thread *t);
+void queue_thread(struct thread *t, bool wakeup);
+void remove_thread(struct thread *t);
+bool has_ready_thread();
 void switch_thread(struct thread *nt);
 void schedule();
-struct plist_head *get_list_from_thread(enum thread_state state, enum thread_policy policy);
+void preempt_schedule();
+void sleep(uint32_t delay);
 int get_top_priority_from_list(enum thread_state state, enum thread_policy policy);
 struct process *get_process(pid_t pid);
+struct thread *pick_terminated_thread(bool *busy);
+void do_exit(int32_t code);
+int32_t do_waitpid(pid_t pid, int32_t *status, int32_t options);
+int32_t do_nocldwait(bool enable);
+void reaper_init();
+void release_unstarted_process(struct process *p);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,99 @@
+#include <kernel/cpu/hal.h>
+#include <kernel/locking/spinlock.h>
+#include "task.h"
+#include "workqueue.h"
+
+/*
+  Deferred work which needs a thread context (allocate, block, take the big kernel lock)
+  + irq handler calls queue_work, kworker (kernel thread) runs queued work in order and blocks when nothing is left
+  + work which is already queued is not added twice, it can be queued again as soon as kworker takes it
+    (func is called once for everything which happened before that)
+  Work runs under the big kernel lock like any other kernel thread, a work item never runs concurrently with itself
+*/
+
+static spinlock_t work_lock = SPINLOCK_INITIALIZER;
+static LIST_HEAD(work_list);
+static struct thread *kworker;
+static struct workqueue_stat work_stat;
+
+void work_setup(struct work_struct *work, void (*func)(struct work_struct *), uint32_t data)
+{
+  INIT_LIST_HEAD(&work->entry);
+  work->func = func;
+  work->pending = false;
+  work->data = data;
+}
+
+// can be called from irq
+bool queue_work(struct work_struct *work)
+{
+  uint32_t flags = irq_save();
+  spin_lock(&work_lock);
+
+  bool queued = !work->pending;
+  if (queued)
+  {
+    work->pending = true;
+    work->queued_at = rdtsc();
+    list_add_tail(&work->entry, &work_list);
+    work_stat.queued++;
+
+    // irqs before workqueue_init only queue, kworker takes them when it starts
+    if (kworker && kworker->state == THREAD_BLOCKED)
+      update_thread(kworker, THREAD_READY);
+  }
+
+  spin_unlock(&work_lock);
+  irq_restore(flags);
+  return queued;
+}
+
+static void worker_thread()
+{
+  while (true)
+  {
+    uint32_t flags = irq_save();
+    spin_lock(&work_lock);
+
+    // blocked under work_lock -> queue_work in between can't miss it
+    if (list_empty(&work_list))
+    {
+      update_thread(current_thread, THREAD_BLOCKED);
+      spin_unlock(&work_lock);
+      irq_restore(flags);
+      schedule();
+      continue;
+    }
+
+    struct work_struct *work = list_first_entry(&work_list, struct work_struct, entry);
+    list_del_init(&work->entry);
+    work->pending = false;
+
+    uint64_t latency = rdtsc() - work->queued_at;
+    if (latency > work_stat.max_latency_cycles)
+      work_stat.max_latency_cycles = latency;
+    work_stat.executed++;
+
+    spin_unlock(&work_lock);
+    irq_restore(flags);
+
+    work->func(work);
+  }
+}
+
+void workqueue_get_stat(struct workqueue_stat *stat)
+{
+  uint32_t flags = irq_save();
+  spin_lock(&work_lock);
+
+  *stat = work_stat;
+
+  spin_unlock(&work_lock);
+  irq_restore(flags);
+}
+
+void workqueue_init()
+{
+  kworker = create_kernel_thread(current_process, (uint32_t)worker_thread, THREAD_BLOCKED, 0);
+  update_thread(kworker, THREAD_READY);
+}
@@ -0,0 +1,36 @@
+#ifndef PROC_WORKQUEUE_H
+#define PROC_WORKQUEUE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <include/list.h>
+
+struct work_struct
+{
+  struct list_head entry;
+  void (*func)(struct work_struct *);
+  volatile bool pending;
+  uint64_t queued_at; /* tsc */
+  uint32_t data;
+};
+
+// work which can be queued before any init code runs (early irqs)
+#define WORK_INITIALIZER(name, fn)          \
+  {                                         \
+    .entry = LIST_HEAD_INIT(name.entry),    \
+    .func = fn,                             \
+  }
+
+struct workqueue_stat
+{
+  uint32_t queued;
+  uint32_t executed;
+  uint64_t max_latency_cycles; /* queue_work -> func starts */
+};
+
+void workqueue_init();
+void work_setup(struct work_struct *work, void (*func)(struct work_struct *), uint32_t data);
+bool queue_work(struct work_struct *work);
+void workqueue_get_stat(struct workqueue_stat *stat);
+
+#endif
@@ -0,0 +1,223 @@
+#include <kernel/cpu/hal.h>
+#include <kernel/cpu/pit.h>
+#include <kernel/fs/vfs.h>
+#include <kernel/memory/vmm.h>
+#include <kernel/proc/softirq.h>
+#include <kernel/proc/task.h>
+#include <kernel/proc/workqueue.h>
+#include "console.h"
+#include "uiserver.h"
+#include "benchmark.h"
+
+#define KMALLOC_BENCHMARK_OBJECTS 1024
+#define KMALLOC_BENCHMARK_ROUNDS 8
+#define KSTACK_BENCHMARK_STACKS 64 /* cached stacks are kept, threads reuse them later */
+#define THREAD_BENCHMARK_THREADS 64
+#define THREAD_BENCHMARK_ROUNDS 16
+#define TEARDOWN_CHECK_FILE "/bin/window_server"
+#define TEARDOWN_CHECK_OPENS 64
+#define TEARDOWN_CHECK_WAIT_MS 100
+#define DEFERRED_WORK_STATS_INTERVAL_MS 10000
+
+extern void *kmalloc_block(size_t size);
+extern void kfree_block(void *ptr);
+
+static void *objects[KMALLOC_BENCHMARK_OBJECTS];
+static const size_t object_sizes[] = {16, 24, 40, 64, 100, 200, 400, 1000};
+static uint32_t stacks[KSTACK_BENCHMARK_STACKS];
+static volatile uint32_t exited_threads;
+
+uint64_t cycles_to_ns(uint64_t cycles)
+{
+  uint32_t tsc_khz = get_tsc_khz();
+  return tsc_khz ? cycles * 1000000 / tsc_khz : 0;
+}
+
+static void kmalloc_benchmark_run(const char *name, void *(*alloc)(size_t), void (*release)(void *))
+{
+  uint32_t nsizes = sizeof(object_sizes) / sizeof(object_sizes[0]);
+  uint64_t alloc_cycles = 0, free_cycles = 0;
+
+  for (uint32_t round = 0; round < KMALLOC_BENCHMARK_ROUNDS; ++round)
+  {
+    uint64_t start = rdtsc();
+    for (uint32_t i = 0; i < KMALLOC_BENCHMARK_OBJECTS; ++i)
+      objects[i] = alloc(object_sizes[i % nsizes]);
+    alloc_cycles += rdtsc() - start;
+
+    // release every other object first to leave holes behind, then the rest
+    start = rdtsc();
+    for (uint32_t i = 0; i < KMALLOC_BENCHMARK_OBJECTS; i += 2)
+      release(objects[i]);
+    for (uint32_t i = 1; i < KMALLOC_BENCHMARK_OBJECTS; i += 2)
+      release(objects[i]);
+    free_cycles += rdtsc() - start;
+  }
+
+  uint32_t ops = KMALLOC_BENCHMARK_OBJECTS * KMALLOC_BENCHMARK_ROUNDS;
+  printf("%s: alloc %d ns/op, free %d ns/op\n",
+         name,
+         (uint32_t)(cycles_to_ns(alloc_cycles) / ops),
+         (uint32_t)(cycles_to_ns(free_cycles) / ops));
+}
+
+void kmalloc_benchmark()
+{
+  kmalloc_benchmark_run("kmalloc (block list)", kmalloc_block, kfree_block);
+  kmalloc_benchmark_run("kmalloc (slab)", kmalloc, kfree);
+}
+
+static void *alloc_heap_stack(size_t size)
+{
+  return kcalloc(size, sizeof(char));
+}
+
+static void *alloc_cached_stack(size_t size)
+{
+  return (void *)(alloc_kernel_stack() - size);
+}
+
+static void free_cached_stack(void *ptr)
+{
+  free_kernel_stack((uint32_t)ptr + STACK_SIZE);
+}
+
+static void kstack_benchmark_run(const char *name, void *(*alloc)(size_t), void (*release)(void *))
+{
+  uint64_t alloc_cycles = 0, free_cycles = 0;
+
+  for (uint32_t round = 0; round < KMALLOC_BENCHMARK_ROUNDS; ++round)
+  {
+    uint64_t start = rdtsc();
+    for (uint32_t i = 0; i < KSTACK_BENCHMARK_STACKS; ++i)
+      stacks[i] = (uint32_t)alloc(STACK_SIZE);
+    alloc_cycles += rdtsc() - start;
+
+    start = rdtsc();
+    for (uint32_t i = 0; i < KSTACK_BENCHMARK_STACKS; ++i)
+      release((void *)stacks[i]);
+    free_cycles += rdtsc() - start;
+  }
+
+  uint32_t ops = KSTACK_BENCHMARK_STACKS * KMALLOC_BENCHMARK_ROUNDS;
+  printf("%s: alloc %d ns/op, free %d ns/op\n",
+         name,
+         (uint32_t)(cycles_to_ns(alloc_cycles) / ops),
+         (uint32_t)(cycles_to_ns(free_cycles) / ops));
+}
+
+// heap and slab usage have to be back at the baseline once everything is released
+static void teardown_report(const char *name, size_t heap_used, uint32_t slab_active)
+{
+  int32_t heap_diff = kmalloc_block_used() - heap_used;
+  int32_t slab_diff = kmem_cache_active_objects() - slab_active;
+  printf("%s: %s (heap %d bytes, slab %d objects)\n",
+         name, heap_diff || slab_diff ? "LEAK" : "ok", heap_diff, slab_diff);
+}
+
+static void exit_right_away()
+{
+  exited_threads++;
+}
+
+/*
+  Kernel stack allocation (heap vs stack cache) and thread throughput,
+  batches of kernel threads which exit right away, from create_kernel_thread until the last one has exited
+  (reaper frees them in between, their stacks are reused by the next batch)
+*/
+void thread_benchmark()
+{
+  kstack_benchmark_run("kernel stack (heap)", alloc_heap_stack, kfree);
+  kstack_benchmark_run("kernel stack (cache)", alloc_cached_stack, free_cached_stack);
+
+  size_t heap_used = kmalloc_block_used();
+  uint32_t slab_active = kmem_cache_active_objects();
+
+  uint64_t start = rdtsc();
+  for (uint32_t round = 0; round < THREAD_BENCHMARK_ROUNDS; ++round)
+  {
+    exited_threads = 0;
+    for (uint32_t i = 0; i < THREAD_BENCHMARK_THREADS; ++i)
+    {
+      struct thread *t = create_kernel_thread(current_process, (uint32_t)exit_right_away, THREAD_BLOCKED, 0);
+      if (!t)
+      {
+        printf("thread spawn/exit: out of kernel stacks\n");
+        return;
+      }
+      update_thread(t, THREAD_READY);
+    }
+
+    // yield, threads of the same priority run before we come back
+    while (exited_threads < THREAD_BENCHMARK_THREADS)
+    {
+      update_thread(current_thread, THREAD_READY);
+      schedule();
+    }
+  }
+  uint64_t cycles = rdtsc() - start;
+
+  uint32_t threads = THREAD_BENCHMARK_THREADS * THREAD_BENCHMARK_ROUNDS;
+  printf("thread spawn/exit: %d ns/thread\n", (uint32_t)(cycles_to_ns(cycles) / threads));
+
+  // reaper runs after the last thread has switched out, give it some time
+  for (uint32_t ms = 0; ms < TEARDOWN_CHECK_WAIT_MS; ++ms)
+  {
+    if (kmalloc_block_used() == heap_used && kmem_cache_active_objects() == slab_active)
+      break;
+    sleep(1);
+  }
+  teardown_report("thread teardown", heap_used, slab_active);
+}
+
+// opened file (path walk, struct vfs_file) is given back by its last put
+void file_teardown_check()
+{
+  // first walk creates dentries, they are cached for good
+  struct vfs_file *file = filp_open(TEARDOWN_CHECK_FILE);
+  if (!file)
+    return;
+  fput(file);
+
+  size_t heap_used = kmalloc_block_used();
+  uint32_t slab_active = kmem_cache_active_objects();
+  for (uint32_t i = 0; i < TEARDOWN_CHECK_OPENS; ++i)
+    fput(filp_open(TEARDOWN_CHECK_FILE));
+  teardown_report("file teardown", heap_used, slab_active);
+}
+
+// Counters of deferred irq work since boot, max is the worst single run/wait
+static void deferred_work_stats()
+{
+  static const char *softirq_names[NR_SOFTIRQS] = {"timer"};
+
+  for (uint32_t nr = 0; nr < NR_SOFTIRQS; ++nr)
+  {
+    struct softirq_stat stat;
+    softirq_get_stat(nr, &stat);
+    printf("softirq %s: raised %d, handled %d, max %d ns\n",
+           softirq_names[nr], stat.raised, stat.handled, (uint32_t)cycles_to_ns(stat.max_cycles));
+  }
+
+  struct workqueue_stat stat;
+  workqueue_get_stat(&stat);
+  printf("workqueue: queued %d, executed %d, max latency %d ns, dropped input events %d\n",
+         stat.queued, stat.executed, (uint32_t)cycles_to_ns(stat.max_latency_cycles), uiserver_dropped_events());
+}
+
+// counters are only interesting once irqs (timer, network, input) had work to defer, they are printed periodically
+static void deferred_work_stats_thread()
+{
+  while (true)
+  {
+    sleep(DEFERRED_WORK_STATS_INTERVAL_MS);
+    deferred_work_stats();
+  }
+}
+
+void deferred_work_stats_init()
+{
+  struct thread *t = create_kernel_thread(current_process, (uint32_t)deferred_work_stats_thread, THREAD_BLOCKED, 0);
+  if (t)
+    update_thread(t, THREAD_READY);
+}
@@ -0,0 +1,12 @@
+#ifndef SYSTEM_BENCHMARK_H
+#define SYSTEM_BENCHMARK_H
+
+#include <stdint.h>
+
+uint64_t cycles_to_ns(uint64_t cycles);
+void kmalloc_benchmark();
+void thread_benchmark();
+void file_teardown_check();
+void deferred_work_stats_init();
+
+#endif
@@ -17,6 +17,13 @@ static struct framebuffer *current_fb;
 
 void print_char(const char c)
 {
+  if (c == '\n')
+  {
+    current_column = 0;
+    current_row += 1;
+    return;
+  }
+
   psf_putchar(c, current_column * 12, current_row * 16, TEXT_COLOR, BACKGROUND_COLOR, (char *)VIDEO_VADDR, current_fb->pitch);
 
   if (current_column >= current_fb->width)
@@ -121,6 +128,18 @@ int printf(const char *fmt, ...)
   return 0;
 }
 
+/*
+  Kernel's own mapping is not reachable from user space, vram past the screen is harmless there.
+  When the framebuffer is 4MB aligned the mapping is rounded up to whole 4MB pages (one tlb entry per 4MB)
+*/
+static uint32_t get_console_map_size(struct framebuffer *fb)
+{
+  uint32_t size = get_framebuffer_map_size(fb);
+  if (!(fb->addr & ~LARGE_PAGE_MASK))
+    size = LARGE_PAGE_ALIGN(size);
+  return size;
+}
+
 void console_init(struct multiboot_tag_framebuffer *multiboot_framebuffer)
 {
   current_fb = kcalloc(1, sizeof(struct framebuffer));
@@ -130,14 +149,7 @@ void console_init(struct multiboot_tag_framebuffer *multiboot_framebuffer)
   current_fb->width = multiboot_framebuffer->common.framebuffer_width;
   current_fb->height = multiboot_framebuffer->common.framebuffer_height;
 
-  uint32_t screen_size = current_fb->height * current_fb->pitch;
-  uint32_t blocks = div_ceil(screen_size, PMM_FRAME_SIZE);
-  for (uint32_t i = 0; i < blocks; ++i)
-    vmm_map_address(
-        vmm_get_directory(),
-        VIDEO_VADDR + i * PMM_FRAME_SIZE,
-        current_fb->addr + i * PMM_FRAME_SIZE,
-        I86_PTE_PRESENT | I86_PTE_WRITABLE);
+  vmm_map_range(vmm_get_directory(), VIDEO_VADDR, current_fb->addr, get_console_map_size(current_fb), I86_PTE_PRESENT | I86_PTE_WRITABLE);
 }
 
 void console_setup()
@@ -153,4 +165,14 @@ void console_setup()
 struct framebuffer *get_framebuffer()
 {
   return current_fb;
+}
+
+/*
+  Only the screen is mapped (not the whole vram behind it), user space (window server) must not reach past it.
+  vmm_map_range still uses 4MB pages for chunks which are fully covered, the tail is mapped by 4KB pages
+  -> a screen below 4MB (800x600x32 is ~1.9MB) is mapped by 4KB pages only
+*/
+uint32_t get_framebuffer_map_size(struct framebuffer *fb)
+{
+  return PAGE_ALIGN(fb->height * fb->pitch);
 }
\ No newline at end of file
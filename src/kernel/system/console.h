@@ -17,6 +17,7 @@ struct framebuffer
 void console_init(struct multiboot_tag_framebuffer *);
 void console_setup();
 struct framebuffer *get_framebuffer();
+uint32_t get_framebuffer_map_size(struct framebuffer *fb);
 int printf(const char *fmt, ...);
 
 #endif
\ No newline at end of file
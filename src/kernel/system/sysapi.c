@@ -8,26 +8,32 @@
 #include <kernel/fs/vfs.h>
 #include <kernel/fs/pipefs/pipe.h>
 #include <kernel/ipc/message_queue.h>
+#include <kernel/ipc/futex.h>
 #include "sysapi.h"
 
-extern struct thread *current_thread;
-extern struct process *current_process;
+#define IA32_SYSENTER_CS 0x174
+#define IA32_SYSENTER_ESP 0x175
+#define IA32_SYSENTER_EIP 0x176
+#define CPUID_SEP (1 << 11)
 
 typedef uint32_t (*SYSTEM_FUNC)(unsigned int, ...);
 
+extern void sysenter_entry();
+
 void sys_exit(int32_t code)
 {
-  current_thread->exit_code = code;
-  update_thread(current_thread, THREAD_TERMINATED);
-  schedule();
+  do_exit(code);
 }
 
 pid_t sys_fork()
 {
   struct process *child = process_fork(current_process);
+  if (!child)
+    return -ENOMEM;
+
   struct thread *t = list_first_entry(&child->threads, struct thread, sibling);
 
-  queue_thread(t);
+  update_thread(t, THREAD_READY);
 
   return child->pid;
 }
@@ -73,6 +79,11 @@ int32_t sys_mmap(uint32_t addr, size_t length, uint32_t prot, uint32_t flags,
   return do_mmap(addr, length, prot, flags, fd);
 }
 
+int32_t sys_munmap(uint32_t addr, size_t length)
+{
+  return do_munmap(current_process->mm, addr, length);
+}
+
 int32_t sys_truncate(const char *path, int32_t length)
 {
   return vfs_truncate(path, length);
@@ -123,11 +134,25 @@ int32_t sys_getpid()
   return current_process->pid;
 }
 
+int32_t sys_waitpid(pid_t pid, int32_t *status, int32_t options)
+{
+  return do_waitpid(pid, status, options);
+}
+
+int32_t sys_nocldwait(bool enable)
+{
+  return do_nocldwait(enable);
+}
+
+int32_t sys_futex(int32_t *uaddr, int32_t op, int32_t val)
+{
+  return do_futex(uaddr, op, val);
+}
+
+// Spawned programs are apps (fair-share class), system threads (window server) stay above them
 int32_t sys_posix_spawn(char *path)
 {
-  int top = get_top_priority_from_list(THREAD_READY, THREAD_SYSTEM_POLICY);
-  process_load(path, path, top - 1, NULL);
-  return 0;
+  return process_load(path, path, THREAD_APP_POLICY, DEFAULT_APP_PRIO, NULL);
 }
 
 #define __NR_exit 1
@@ -136,6 +161,7 @@ int32_t sys_posix_spawn(char *path)
 #define __NR_write 4
 #define __NR_open 5
 #define __NR_close 6
+#define __NR_waitpid 7
 #define __NR_brk 17
 #define __NR_sbrk 18
 #define __NR_getpid 20
@@ -156,10 +182,12 @@ int32_t sys_posix_spawn(char *path)
 #define __NR_listen 105
 #define __NR_stat 106
 #define __NR_fstat 108
+#define __NR_nocldwait 109
 #define __NR_msgopen 200
 #define __NR_msgclose 201
 #define __NR_msgrcv 202
 #define __NR_msgsnd 203
+#define __NR_futex 240
 
 static void *syscalls[] = {
     [__NR_exit] = sys_exit,
@@ -170,18 +198,22 @@ static void *syscalls[] = {
     [__NR_stat] = sys_stat,
     [__NR_fstat] = sys_fstat,
     [__NR_close] = sys_close,
+    [__NR_waitpid] = sys_waitpid,
+    [__NR_nocldwait] = sys_nocldwait,
     [__NR_brk] = sys_brk,
     [__NR_sbrk] = sys_sbrk,
     [__NR_getpid] = sys_getpid,
     [__NR_pipe] = sys_pipe,
     [__NR_posix_spawn] = sys_posix_spawn,
     [__NR_mmap] = sys_mmap,
+    [__NR_munmap] = sys_munmap,
     [__NR_truncate] = sys_truncate,
     [__NR_ftruncate] = sys_ftruncate,
     [__NR_msgopen] = sys_msgopen,
     [__NR_msgclose] = sys_msgclose,
     [__NR_msgsnd] = sys_msgsnd,
     [__NR_msgrcv] = sys_msgrcv,
+    [__NR_futex] = sys_futex,
 };
 
 int32_t syscall_dispatcher(struct interrupt_registers *regs)
@@ -193,15 +225,46 @@ int32_t syscall_dispatcher(struct interrupt_registers *regs)
   if (!func)
     return IRQ_HANDLER_STOP;
 
-  memcpy(&current_thread->uregs, regs, sizeof(struct interrupt_registers));
+  // Frame stays on kernel stack until syscall returns, only fork needs it (child's uregs)
+  current_thread->syscall_regs = regs;
 
+  lock_kernel();
   uint32_t ret = func(regs->ebx, regs->ecx, regs->edx, regs->esi, regs->edi);
+  unlock_kernel();
   regs->eax = ret;
 
   return IRQ_HANDLER_CONTINUE;
 }
 
+/*
+  Fast system call path, libc uses sysenter when cpu has it and int 0x7F otherwise
+  + ecx = user esp, edx = return address, arg2/arg3 are in ebp/edi (sysenter_entry moves them back), at most
+    four arguments -> kernel never reads user memory to build the frame
+  + sysenter_entry builds the same interrupt_registers frame as isr_common_stub (without reloading ds/es/fs)
+    and returns by sysexit -> no int/iret microcode, edx and ecx are clobbered
+  SYSENTER_ESP points at tss.esp0 of the cpu, stub loads the current thread's kernel stack from there
+*/
+void sysenter_handler(struct interrupt_registers *regs)
+{
+  syscall_dispatcher(regs);
+  preempt_schedule();
+}
+
+// each cpu has its own msrs
+void syscall_init_cpu()
+{
+  uint32_t eax, edx;
+  cpuid(1, &eax, &edx);
+  if (!(edx & CPUID_SEP))
+    return;
+
+  wrmsr(IA32_SYSENTER_CS, 0x08);
+  wrmsr(IA32_SYSENTER_ESP, (uint32_t)&this_cpu()->tss.esp0);
+  wrmsr(IA32_SYSENTER_EIP, (uint32_t)sysenter_entry);
+}
+
 void syscall_init()
 {
   register_interrupt_handler(DISPATCHER_ISR, syscall_dispatcher);
+  syscall_init_cpu();
 }
\ No newline at end of file
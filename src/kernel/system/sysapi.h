@@ -6,6 +6,7 @@
 
 int32_t syscall_dispatcher(struct interrupt_registers *registers);
 void syscall_init();
+void syscall_init_cpu();
 
 int sys_printf(char *);
 int sys_printg(uint32_t x, uint32_t y);
@@ -1,6 +1,7 @@
 #include <kernel/cpu/hal.h>
 #include <kernel/memory/vmm.h>
 #include "time.h"
+#include "vdso.h"
 
 #define CMOS_ADDRESS 0x70
 #define CMOS_DATA 0x71
@@ -17,10 +18,9 @@ uint8_t get_rtc_register(uint32_t reg)
   return inportb(CMOS_DATA);
 }
 
-struct time *get_current_time()
+static void read_current_time(struct time *t)
 {
   uint8_t second, minute, hour, day, month, year;
-  struct time *t = kcalloc(1, sizeof(struct time));
 
   while (get_update_flag())
     ;
@@ -55,7 +55,12 @@ struct time *get_current_time()
   t->day = day;
   t->month = month;
   t->year = (year >= 70 ? 1900 : 2000) + year;
+}
 
+struct time *get_current_time()
+{
+  struct time *t = kcalloc(1, sizeof(struct time));
+  read_current_time(t);
   return t;
 }
 
@@ -101,10 +106,19 @@ uint32_t get_days(struct time *t)
   return era * 146097 + (doe)-719468;
 }
 
+// cmos is only read until the vdso time page is set up, afterward wall clock comes from pit ticks
 uint32_t get_seconds(struct time *t)
 {
+  struct time now;
   if (t == NULL)
-    t = get_current_time();
+  {
+    uint32_t seconds = vdso_get_seconds();
+    if (seconds)
+      return seconds;
+
+    read_current_time(&now);
+    t = &now;
+  }
 
   return get_days(t) * 24 * 3600 + t->hour * 3600 + t->minute * 60 + t->second;
 }
@@ -0,0 +1,239 @@
+#include <kernel/cpu/hal.h>
+#include <kernel/cpu/idt.h>
+#include <kernel/cpu/lapic.h>
+#include <kernel/cpu/pic.h>
+#include <kernel/cpu/pit.h>
+#include <kernel/cpu/smp.h>
+#include <kernel/locking/spinlock.h>
+#include <kernel/proc/softirq.h>
+#include "timer.h"
+
+/*
+  Hierarchical timing wheel (same as linux before 4.8), one slot per pit tick (1ms)
+    tv1: 256 slots, timers which expire in the next 256 ticks
+    tv2 -> tv5: 64 slots each, a slot of tvN covers 2^(8 + 6 * (N - 2)) ticks
+  timer_add/timer_del are O(1). A tick only runs the current tv1 slot, every 256 ticks one tv2 slot is
+  cascaded (re-added) into tv1 and so on up, tick cost doesn't grow with the number of pending timers
+*/
+
+#define TVN_BITS 6
+#define TVR_BITS 8
+#define TVN_SIZE (1 << TVN_BITS)
+#define TVR_SIZE (1 << TVR_BITS)
+#define TVN_MASK (TVN_SIZE - 1)
+#define TVR_MASK (TVR_SIZE - 1)
+#define INDEX(n) ((timer_ticks >> (TVR_BITS + (n)*TVN_BITS)) & TVN_MASK)
+
+struct tvec
+{
+  struct list_head vec[TVN_SIZE];
+};
+
+struct tvec_root
+{
+  struct list_head vec[TVR_SIZE];
+};
+
+// Wheel is only run by bsp (pit tick), timers are added/removed from any cpu
+static spinlock_t timer_lock = SPINLOCK_INITIALIZER;
+static struct tvec_root tv1;
+static struct tvec tv2, tv3, tv4, tv5;
+// next tick to be processed
+static uint32_t timer_ticks;
+// periodic tick is stopped while cpu is idle, pit_ticks doesn't move
+static volatile bool tick_stopped = false;
+static uint32_t tick_stopped_us;
+
+static void internal_add_timer(struct timer_list *timer)
+{
+  uint32_t expires = timer->expires;
+  uint32_t idx = expires - timer_ticks;
+  struct list_head *vec;
+
+  if (idx < TVR_SIZE)
+    vec = tv1.vec + (expires & TVR_MASK);
+  else if (idx < 1 << (TVR_BITS + TVN_BITS))
+    vec = tv2.vec + ((expires >> TVR_BITS) & TVN_MASK);
+  else if (idx < 1 << (TVR_BITS + 2 * TVN_BITS))
+    vec = tv3.vec + ((expires >> (TVR_BITS + TVN_BITS)) & TVN_MASK);
+  else if (idx < 1 << (TVR_BITS + 3 * TVN_BITS))
+    vec = tv4.vec + ((expires >> (TVR_BITS + 2 * TVN_BITS)) & TVN_MASK);
+  else if ((int32_t)idx < 0)
+    // already expired, run it on the next tick
+    vec = tv1.vec + (timer_ticks & TVR_MASK);
+  else
+    vec = tv5.vec + ((expires >> (TVR_BITS + 3 * TVN_BITS)) & TVN_MASK);
+
+  list_add_tail(&timer->entry, vec);
+}
+
+static uint32_t cascade(struct tvec *tv, uint32_t index)
+{
+  struct timer_list *timer, *tmp;
+  LIST_HEAD(list);
+
+  list_splice_init(tv->vec + index, &list);
+  list_for_each_entry_safe(timer, tmp, &list, entry)
+  {
+    internal_add_timer(timer);
+  }
+
+  return index;
+}
+
+static void run_timers()
+{
+  uint32_t now = get_milliseconds_from_boot();
+
+  // softirq runs with interrupts enabled
+  uint32_t flags = irq_save();
+  spin_lock(&timer_lock);
+  while ((int32_t)(now - timer_ticks) >= 0)
+  {
+    uint32_t index = timer_ticks & TVR_MASK;
+    if (!index &&
+        !cascade(&tv2, INDEX(0)) &&
+        !cascade(&tv3, INDEX(1)) &&
+        !cascade(&tv4, INDEX(2)))
+      cascade(&tv5, INDEX(3));
+    timer_ticks++;
+
+    LIST_HEAD(work);
+    list_splice_init(tv1.vec + index, &work);
+    while (!list_empty(&work))
+    {
+      struct timer_list *timer = list_first_entry(&work, struct timer_list, entry);
+      list_del_init(&timer->entry);
+
+      // callback might add timers or wake threads up
+      spin_unlock(&timer_lock);
+      irq_restore(flags);
+      timer->function(timer);
+      flags = irq_save();
+      spin_lock(&timer_lock);
+    }
+  }
+
+  spin_unlock(&timer_lock);
+  irq_restore(flags);
+}
+
+// Callbacks (wake sleeping threads) run on irq exit with interrupts enabled
+static int32_t timer_interrupt_handler(struct interrupt_registers *regs)
+{
+  raise_softirq(TIMER_SOFTIRQ);
+
+  return IRQ_HANDLER_CONTINUE;
+}
+
+/*
+  Earliest tick which has work: first non-empty tv1 slot before tv1 wraps around,
+  otherwise the wrap itself (tv2 is cascaded there) -> idle cpu wakes up at least every 256ms
+*/
+static uint32_t timer_next_expiry()
+{
+  uint32_t next = timer_ticks;
+
+  do
+  {
+    if (!list_empty(tv1.vec + (next & TVR_MASK)))
+      return next;
+    next++;
+  } while (next & TVR_MASK);
+
+  return next;
+}
+
+// interrupts are disabled, cpu halts right after
+void timer_idle_enter()
+{
+  // only bsp keeps time, it can stop the tick when there is no busy cpu
+  if (!lapic_timer_available() || this_cpu()->id != 0 || !smp_others_idle())
+    return;
+
+  spin_lock(&timer_lock);
+  uint32_t next = timer_next_expiry();
+  spin_unlock(&timer_lock);
+
+  uint32_t now = get_milliseconds_from_boot();
+  int32_t delta = next - now;
+  // next tick has work anyway
+  if (delta <= 1)
+    return;
+
+  uint32_t partial_us = pit_stop();
+  lapic_timer_oneshot(delta * 1000 - partial_us);
+  tick_stopped = true;
+  tick_stopped_us = partial_us;
+}
+
+// woken up by lapic timer or any other irq, account idle time and run timers which are due
+void timer_idle_exit()
+{
+  if (!tick_stopped || this_cpu()->id != 0)
+    return;
+
+  pit_restart(tick_stopped_us + lapic_timer_stop());
+  tick_stopped = false;
+
+  run_timers();
+}
+
+void timer_setup(struct timer_list *timer, void (*function)(struct timer_list *), uint32_t data)
+{
+  INIT_LIST_HEAD(&timer->entry);
+  timer->function = function;
+  timer->data = data;
+  timer->expires = 0;
+}
+
+bool timer_pending(struct timer_list *timer)
+{
+  return !list_empty(&timer->entry);
+}
+
+void timer_add(struct timer_list *timer)
+{
+  uint32_t flags = irq_save();
+  spin_lock(&timer_lock);
+
+  if (timer_pending(timer))
+    list_del(&timer->entry);
+  internal_add_timer(timer);
+
+  spin_unlock(&timer_lock);
+  // lapic one-shot on bsp is armed for the previous earliest timer
+  if (tick_stopped)
+    smp_send_reschedule(0);
+  irq_restore(flags);
+}
+
+void timer_del(struct timer_list *timer)
+{
+  uint32_t flags = irq_save();
+  spin_lock(&timer_lock);
+
+  if (timer_pending(timer))
+    list_del_init(&timer->entry);
+
+  spin_unlock(&timer_lock);
+  irq_restore(flags);
+}
+
+void timer_init()
+{
+  for (uint32_t i = 0; i < TVR_SIZE; ++i)
+    INIT_LIST_HEAD(tv1.vec + i);
+  for (uint32_t i = 0; i < TVN_SIZE; ++i)
+  {
+    INIT_LIST_HEAD(tv2.vec + i);
+    INIT_LIST_HEAD(tv3.vec + i);
+    INIT_LIST_HEAD(tv4.vec + i);
+    INIT_LIST_HEAD(tv5.vec + i);
+  }
+  timer_ticks = get_milliseconds_from_boot();
+
+  // softirq runs after pit counted this tick, timers fire at most one tick late
+  open_softirq(TIMER_SOFTIRQ, run_timers);
+  register_interrupt_handler(IRQ0, timer_interrupt_handler);
+}
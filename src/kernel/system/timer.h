@@ -0,0 +1,24 @@
+#ifndef SYSTEM_TIMER_H
+#define SYSTEM_TIMER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <include/list.h>
+
+struct timer_list
+{
+  struct list_head entry;
+  uint32_t expires; /* milliseconds from boot */
+  void (*function)(struct timer_list *);
+  uint32_t data;
+};
+
+void timer_init();
+void timer_setup(struct timer_list *timer, void (*function)(struct timer_list *), uint32_t data);
+void timer_add(struct timer_list *timer);
+void timer_del(struct timer_list *timer);
+bool timer_pending(struct timer_list *timer);
+void timer_idle_enter();
+void timer_idle_exit();
+
+#endif
@@ -2,44 +2,97 @@
 #include <include/mman.h>
 #include <include/msgui.h>
 #include <kernel/ipc/message_queue.h>
+#include <kernel/locking/spinlock.h>
+#include <kernel/proc/workqueue.h>
 #include <kernel/utils/queue.h>
 #include "uiserver.h"
 
-extern struct thread *current_thread;
+/*
+  Keyboard/mouse irqs only put events into a fixed ring, kworker sends them to window server (allocates, might block)
+  Events are dropped when the ring is full (window server is far behind anyway)
+*/
+#define INPUT_RING_SIZE 64
+
 static struct thread *wsthread;
+static spinlock_t input_lock = SPINLOCK_INITIALIZER;
+static struct msgui_event input_ring[INPUT_RING_SIZE];
+static uint32_t input_head, input_tail;
+static uint32_t input_dropped;
 
-void uiserver_init(struct thread *t)
+static void enqueue_event(struct msgui_event *event)
 {
-  wsthread = t;
+  struct msgui msgui = {.type = MSGUI_EVENT};
+  memcpy(msgui.data, event, sizeof(struct msgui_event));
+  mq_send(WINDOW_SERVER_SHM, (char *)&msgui, 0, sizeof(struct msgui));
 }
 
-void enqueue_event(struct msgui_event *event)
+static void input_flush(struct work_struct *work)
 {
-  struct msgui *msgui = kcalloc(1, sizeof(struct msgui));
-  msgui->type = MSGUI_EVENT;
-  memcpy(msgui->data, event, sizeof(struct msgui_event));
-  if (current_thread == wsthread || current_thread->state == THREAD_WAITING)
-    mq_enqueue(WINDOW_SERVER_SHM, (char *)msgui, 0, sizeof(struct msgui));
-  else
+  while (true)
   {
-    mq_send(WINDOW_SERVER_SHM, (char *)msgui, 0, sizeof(struct msgui));
+    uint32_t flags = irq_save();
+    spin_lock(&input_lock);
+
+    bool empty = input_head == input_tail;
+    struct msgui_event event;
+    if (!empty)
+      event = input_ring[input_tail++ % INPUT_RING_SIZE];
+
+    spin_unlock(&input_lock);
+    irq_restore(flags);
+
+    if (empty)
+      break;
+    // window server is not up yet
+    if (wsthread)
+      enqueue_event(&event);
   }
 }
 
+static struct work_struct input_work = WORK_INITIALIZER(input_work, input_flush);
+
+static void push_input_event(struct msgui_event *event)
+{
+  uint32_t flags = irq_save();
+  spin_lock(&input_lock);
+
+  if (input_head - input_tail < INPUT_RING_SIZE)
+    input_ring[input_head++ % INPUT_RING_SIZE] = *event;
+  else
+    input_dropped++;
+
+  spin_unlock(&input_lock);
+  irq_restore(flags);
+
+  queue_work(&input_work);
+}
+
+void uiserver_init(struct thread *t)
+{
+  wsthread = t;
+}
+
 void enqueue_mouse_event(struct mouse_device *md)
 {
-  struct msgui_event *event = kcalloc(1, sizeof(struct msgui_event));
-  event->mouse_x = md->x;
-  event->mouse_y = md->y;
-  event->mouse_state = md->state;
-  event->type = MSGUI_MOUSE;
-  enqueue_event(event);
+  struct msgui_event event = {
+      .type = MSGUI_MOUSE,
+      .mouse_x = md->x,
+      .mouse_y = md->y,
+      .mouse_state = md->state,
+  };
+  push_input_event(&event);
 }
 
 void enqueue_keyboard_event(int32_t key)
 {
-  struct msgui_event *event = kcalloc(1, sizeof(struct msgui_event));
-  event->key = key;
-  event->type = MSGUI_KEYBOARD;
-  enqueue_event(event);
-}
\ No newline at end of file
+  struct msgui_event event = {
+      .type = MSGUI_KEYBOARD,
+      .key = key,
+  };
+  push_input_event(&event);
+}
+
+uint32_t uiserver_dropped_events()
+{
+  return input_dropped;
+}
@@ -8,5 +8,6 @@
 void uiserver_init(struct thread *t);
 void enqueue_mouse_event(struct mouse_device *md);
 void enqueue_keyboard_event(int32_t key);
+uint32_t uiserver_dropped_events();
 
 #endif
\ No newline at end of file
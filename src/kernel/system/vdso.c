@@ -0,0 +1,75 @@
+#include <include/vdso.h>
+#include <kernel/cpu/pit.h>
+#include <kernel/cpu/smp.h>
+#include <kernel/locking/spinlock.h>
+#include <kernel/memory/pmm.h>
+#include <kernel/memory/vmm.h>
+#include <kernel/proc/task.h>
+#include "time.h"
+#include "vdso.h"
+
+/*
+  Only the bsp pit tick writes the time page, it is a seqlock with a single writer (no lock needed)
+  + writer: seq becomes odd -> update fields -> seq becomes even
+  + reader (libc): read seq, copy fields, retry if seq was odd or has changed
+  x86 doesn't reorder stores with stores or loads with loads, compiler barriers are enough on both sides
+  Wall clock is read from cmos once, afterward it advances with pit ticks
+*/
+static struct page vdso_time_page;
+static struct vdso_time *vdso_time;
+static uint32_t vdso_boot_seconds;
+
+void vdso_update_time()
+{
+  if (!vdso_time)
+    return;
+
+  uint32_t ms = get_milliseconds_from_boot();
+
+  vdso_time->seq++;
+  barrier();
+  vdso_time->monotonic_ms = ms;
+  vdso_time->realtime_seconds = vdso_boot_seconds + ms / 1000;
+  barrier();
+  vdso_time->seq++;
+}
+
+// 0 until vdso_init
+uint32_t vdso_get_seconds()
+{
+  return vdso_time ? vdso_time->realtime_seconds : 0;
+}
+
+// the time page is kmapped for the kernel's whole lifetime, its frame is never freed
+void vdso_init()
+{
+  vdso_time_page.frame = (uint32_t)alloc_page(GFP_ZERO);
+  kmap(&vdso_time_page);
+  vdso_boot_seconds = get_seconds(NULL) - get_milliseconds_from_boot() / 1000;
+  vdso_time = (struct vdso_time *)vdso_time_page.virtual;
+
+  vdso_update_time();
+}
+
+/*
+  Map vdso pages into current address space, called from the process's first thread before entering usermode
+  Forked child inherits both ptes (vmm_fork shares read-only frames), only the process page is replaced
+*/
+void vdso_map_process()
+{
+  if (!vmm_is_page_present(VDSO_TIME_ADDRESS))
+  {
+    pmm_ref_block((void *)vdso_time_page.frame);
+    vmm_map_address(current_process->pdir, VDSO_TIME_ADDRESS, vdso_time_page.frame, I86_PTE_PRESENT | I86_PTE_USER);
+  }
+
+  if (vmm_is_page_present(VDSO_PROCESS_ADDRESS))
+    pmm_free_block((void *)vmm_get_physical_address(VDSO_PROCESS_ADDRESS, false));
+
+  struct page process_page = {.frame = (uint32_t)alloc_page(GFP_ZERO)};
+  kmap(&process_page);
+  ((struct vdso_process *)process_page.virtual)->pid = current_process->pid;
+  kunmap(&process_page);
+
+  vmm_map_address(current_process->pdir, VDSO_PROCESS_ADDRESS, process_page.frame, I86_PTE_PRESENT | I86_PTE_USER);
+}
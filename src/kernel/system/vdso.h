@@ -0,0 +1,11 @@
+#ifndef SYSTEM_VDSO_H
+#define SYSTEM_VDSO_H
+
+#include <stdint.h>
+
+void vdso_init();
+void vdso_update_time();
+uint32_t vdso_get_seconds();
+void vdso_map_process();
+
+#endif
@@ -0,0 +1,341 @@
+#include "rbtree.h"
+
+/*
+  Red-black tree (CLRS) with parent pointers, users embed struct rb_node and do their own search/link (same as linux)
+  Augmented trees pass `augment` which keeps per-subtree data (like the largest gap in vma tree) up to date:
+    + rotation: recompute the node which went down, then the node which went up
+    + insert/erase: recompute from the lowest changed node up to root (rb_augment_path)
+*/
+
+static inline void rb_augment(struct rb_node *node, rb_augment_f augment)
+{
+  if (augment && node)
+    augment(node);
+}
+
+static void rb_rotate_left(struct rb_node *node, struct rb_root *root, rb_augment_f augment)
+{
+  struct rb_node *right = node->rb_right;
+  struct rb_node *parent = node->rb_parent;
+
+  node->rb_right = right->rb_left;
+  if (right->rb_left)
+    right->rb_left->rb_parent = node;
+
+  right->rb_left = node;
+  right->rb_parent = parent;
+
+  if (!parent)
+    root->rb_node = right;
+  else if (node == parent->rb_left)
+    parent->rb_left = right;
+  else
+    parent->rb_right = right;
+  node->rb_parent = right;
+
+  rb_augment(node, augment);
+  rb_augment(right, augment);
+}
+
+static void rb_rotate_right(struct rb_node *node, struct rb_root *root, rb_augment_f augment)
+{
+  struct rb_node *left = node->rb_left;
+  struct rb_node *parent = node->rb_parent;
+
+  node->rb_left = left->rb_right;
+  if (left->rb_right)
+    left->rb_right->rb_parent = node;
+
+  left->rb_right = node;
+  left->rb_parent = parent;
+
+  if (!parent)
+    root->rb_node = left;
+  else if (node == parent->rb_right)
+    parent->rb_right = left;
+  else
+    parent->rb_left = left;
+  node->rb_parent = left;
+
+  rb_augment(node, augment);
+  rb_augment(left, augment);
+}
+
+void rb_augment_path(struct rb_node *node, rb_augment_f augment)
+{
+  if (!augment)
+    return;
+
+  for (; node; node = node->rb_parent)
+    augment(node);
+}
+
+void rb_insert_color(struct rb_node *node, struct rb_root *root, rb_augment_f augment)
+{
+  struct rb_node *parent, *gparent;
+
+  rb_augment_path(node, augment);
+
+  while ((parent = node->rb_parent) && parent->rb_color == RB_RED)
+  {
+    gparent = parent->rb_parent;
+
+    if (parent == gparent->rb_left)
+    {
+      struct rb_node *uncle = gparent->rb_right;
+      if (uncle && uncle->rb_color == RB_RED)
+      {
+        uncle->rb_color = RB_BLACK;
+        parent->rb_color = RB_BLACK;
+        gparent->rb_color = RB_RED;
+        node = gparent;
+        continue;
+      }
+
+      if (parent->rb_right == node)
+      {
+        rb_rotate_left(parent, root, augment);
+        struct rb_node *tmp = parent;
+        parent = node;
+        node = tmp;
+      }
+
+      parent->rb_color = RB_BLACK;
+      gparent->rb_color = RB_RED;
+      rb_rotate_right(gparent, root, augment);
+    }
+    else
+    {
+      struct rb_node *uncle = gparent->rb_left;
+      if (uncle && uncle->rb_color == RB_RED)
+      {
+        uncle->rb_color = RB_BLACK;
+        parent->rb_color = RB_BLACK;
+        gparent->rb_color = RB_RED;
+        node = gparent;
+        continue;
+      }
+
+      if (parent->rb_left == node)
+      {
+        rb_rotate_right(parent, root, augment);
+        struct rb_node *tmp = parent;
+        parent = node;
+        node = tmp;
+      }
+
+      parent->rb_color = RB_BLACK;
+      gparent->rb_color = RB_RED;
+      rb_rotate_left(gparent, root, augment);
+    }
+  }
+
+  root->rb_node->rb_color = RB_BLACK;
+}
+
+static void rb_erase_color(struct rb_node *node, struct rb_node *parent, struct rb_root *root, rb_augment_f augment)
+{
+  struct rb_node *other;
+
+  while ((!node || node->rb_color == RB_BLACK) && node != root->rb_node)
+  {
+    if (parent->rb_left == node)
+    {
+      other = parent->rb_right;
+      if (other->rb_color == RB_RED)
+      {
+        other->rb_color = RB_BLACK;
+        parent->rb_color = RB_RED;
+        rb_rotate_left(parent, root, augment);
+        other = parent->rb_right;
+      }
+      if ((!other->rb_left || other->rb_left->rb_color == RB_BLACK) &&
+          (!other->rb_right || other->rb_right->rb_color == RB_BLACK))
+      {
+        other->rb_color = RB_RED;
+        node = parent;
+        parent = node->rb_parent;
+      }
+      else
+      {
+        if (!other->rb_right || other->rb_right->rb_color == RB_BLACK)
+        {
+          other->rb_left->rb_color = RB_BLACK;
+          other->rb_color = RB_RED;
+          rb_rotate_right(other, root, augment);
+          other = parent->rb_right;
+        }
+        other->rb_color = parent->rb_color;
+        parent->rb_color = RB_BLACK;
+        other->rb_right->rb_color = RB_BLACK;
+        rb_rotate_left(parent, root, augment);
+        node = root->rb_node;
+        break;
+      }
+    }
+    else
+    {
+      other = parent->rb_left;
+      if (other->rb_color == RB_RED)
+      {
+        other->rb_color = RB_BLACK;
+        parent->rb_color = RB_RED;
+        rb_rotate_right(parent, root, augment);
+        other = parent->rb_left;
+      }
+      if ((!other->rb_left || other->rb_left->rb_color == RB_BLACK) &&
+          (!other->rb_right || other->rb_right->rb_color == RB_BLACK))
+      {
+        other->rb_color = RB_RED;
+        node = parent;
+        parent = node->rb_parent;
+      }
+      else
+      {
+        if (!other->rb_left || other->rb_left->rb_color == RB_BLACK)
+        {
+          other->rb_right->rb_color = RB_BLACK;
+          other->rb_color = RB_RED;
+          rb_rotate_left(other, root, augment);
+          other = parent->rb_left;
+        }
+        other->rb_color = parent->rb_color;
+        parent->rb_color = RB_BLACK;
+        other->rb_left->rb_color = RB_BLACK;
+        rb_rotate_right(parent, root, augment);
+        node = root->rb_node;
+        break;
+      }
+    }
+  }
+
+  if (node)
+    node->rb_color = RB_BLACK;
+}
+
+static void rb_change_child(struct rb_node *old, struct rb_node *new, struct rb_node *parent, struct rb_root *root)
+{
+  if (!parent)
+    root->rb_node = new;
+  else if (parent->rb_left == old)
+    parent->rb_left = new;
+  else
+    parent->rb_right = new;
+}
+
+void rb_erase(struct rb_node *node, struct rb_root *root, rb_augment_f augment)
+{
+  struct rb_node *child, *parent;
+  uint32_t color;
+
+  if (!node->rb_left)
+    child = node->rb_right;
+  else if (!node->rb_right)
+    child = node->rb_left;
+  else
+  {
+    // node has two children, its successor (leftmost of right subtree) takes its place
+    struct rb_node *old = node;
+    node = node->rb_right;
+    while (node->rb_left)
+      node = node->rb_left;
+
+    child = node->rb_right;
+    parent = node->rb_parent;
+    color = node->rb_color;
+
+    if (child)
+      child->rb_parent = parent;
+    if (parent == old)
+    {
+      parent->rb_right = child;
+      parent = node;
+    }
+    else
+      parent->rb_left = child;
+
+    node->rb_parent = old->rb_parent;
+    node->rb_color = old->rb_color;
+    node->rb_right = old->rb_right;
+    node->rb_left = old->rb_left;
+
+    rb_change_child(old, node, old->rb_parent, root);
+    old->rb_left->rb_parent = node;
+    if (old->rb_right)
+      old->rb_right->rb_parent = node;
+
+    rb_augment_path(parent, augment);
+    if (color == RB_BLACK)
+      rb_erase_color(child, parent, root, augment);
+    return;
+  }
+
+  parent = node->rb_parent;
+  color = node->rb_color;
+
+  if (child)
+    child->rb_parent = parent;
+  rb_change_child(node, child, parent, root);
+
+  rb_augment_path(parent, augment);
+  if (color == RB_BLACK)
+    rb_erase_color(child, parent, root, augment);
+}
+
+struct rb_node *rb_first(const struct rb_root *root)
+{
+  struct rb_node *n = root->rb_node;
+  if (!n)
+    return NULL;
+
+  while (n->rb_left)
+    n = n->rb_left;
+  return n;
+}
+
+struct rb_node *rb_last(const struct rb_root *root)
+{
+  struct rb_node *n = root->rb_node;
+  if (!n)
+    return NULL;
+
+  while (n->rb_right)
+    n = n->rb_right;
+  return n;
+}
+
+struct rb_node *rb_next(const struct rb_node *node)
+{
+  struct rb_node *parent;
+
+  if (node->rb_right)
+  {
+    node = node->rb_right;
+    while (node->rb_left)
+      node = node->rb_left;
+    return (struct rb_node *)node;
+  }
+
+  while ((parent = node->rb_parent) && node == parent->rb_right)
+    node = parent;
+
+  return parent;
+}
+
+struct rb_node *rb_prev(const struct rb_node *node)
+{
+  struct rb_node *parent;
+
+  if (node->rb_left)
+  {
+    node = node->rb_left;
+    while (node->rb_right)
+      node = node->rb_right;
+    return (struct rb_node *)node;
+  }
+
+  while ((parent = node->rb_parent) && node == parent->rb_left)
+    node = parent;
+
+  return parent;
+}
@@ -0,0 +1,69 @@
+#ifndef UTILS_RBTREE_H
+#define UTILS_RBTREE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <include/list.h>
+
+#define RB_RED 0
+#define RB_BLACK 1
+
+struct rb_node
+{
+  struct rb_node *rb_parent;
+  struct rb_node *rb_left;
+  struct rb_node *rb_right;
+  uint32_t rb_color;
+};
+
+struct rb_root
+{
+  struct rb_node *rb_node;
+};
+
+/**
+ * rb_augment_f - recompute augmented data of @node from its own data and its children
+ *
+ * Called by rbtree for every node which subtree is changed (insert, erase, rotation).
+ * Pass NULL when the tree is not augmented.
+ */
+typedef void (*rb_augment_f)(struct rb_node *node);
+
+#define RB_ROOT \
+  (struct rb_root) { NULL, }
+
+#define rb_entry(ptr, type, member) container_of(ptr, type, member)
+
+#define rb_entry_safe(ptr, type, member) \
+  ({ typeof(ptr) ____ptr = (ptr); \
+     ____ptr ? rb_entry(____ptr, type, member) : NULL; })
+
+#define RB_EMPTY_ROOT(root) ((root)->rb_node == NULL)
+
+/**
+ * rb_link_node - attach @node as a leaf at @rb_link (left/right slot of @parent)
+ * @node:	new node
+ * @parent:	node which @rb_link belongs to, NULL when @node is root
+ * @rb_link:	&parent->rb_left, &parent->rb_right or &root->rb_node
+ *
+ * The caller has to call rb_insert_color right after to rebalance the tree.
+ */
+static inline void rb_link_node(struct rb_node *node, struct rb_node *parent, struct rb_node **rb_link)
+{
+  node->rb_parent = parent;
+  node->rb_color = RB_RED;
+  node->rb_left = node->rb_right = NULL;
+
+  *rb_link = node;
+}
+
+void rb_insert_color(struct rb_node *node, struct rb_root *root, rb_augment_f augment);
+void rb_erase(struct rb_node *node, struct rb_root *root, rb_augment_f augment);
+void rb_augment_path(struct rb_node *node, rb_augment_f augment);
+
+struct rb_node *rb_first(const struct rb_root *root);
+struct rb_node *rb_last(const struct rb_root *root);
+struct rb_node *rb_next(const struct rb_node *node);
+struct rb_node *rb_prev(const struct rb_node *node);
+
+#endif
@@ -7,8 +7,14 @@
 #include <libc/gui/psf.h>
 #include "layout.h"
 
+// Fonts are only loaded once per process, child forked from zygote already has them
 void init_fonts()
 {
+  static bool loaded = false;
+  if (loaded)
+    return;
+  loaded = true;
+
   uint32_t fd = open("/usr/share/fonts/ter-powerline-v16n.psf", 0, 0);
   struct stat *stat = calloc(1, sizeof(struct stat));
   fstat(fd, stat);
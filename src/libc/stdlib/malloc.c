@@ -1,160 +1,366 @@
 #include <include/errno.h>
+#include <include/mman.h>
 #include <libc/string.h>
 #include <libc/unistd.h>
 #include <libc/stdlib.h>
 
-#define BLOCK_MAGIC 0x464E
+/*
+  Segregated-fit allocator with boundary tags (same idea as dlmalloc)
 
-static uint32_t remaining_from_last_used = 0;
-static uint32_t heap_current = 0;
+  chunk -> +-----------+----------------+
+           | prev_size | size | flags   |  prev_size is the size of the chunk right before (0 for the first chunk)
+  mem ---> +-----------+----------------+
+           | payload (next/prev links   |
+           | when chunk is free)        |
+           +----------------------------+
 
-struct block_meta
+  + free chunks are kept in size-class bins: exact bins (8 bytes step) below 256 bytes, power-of-two bins above,
+    non-empty bins are marked in binmap so the next larger class is found without walking empty bins
+  + free merges a chunk with its free neighbours right away, two free chunks are never adjacent
+  + top is the free chunk at the end of heap, it is grown by sbrk and never kept in a bin
+  + realloc grows in place into top or a free neighbour, shrinking gives the tail back
+  + requests >= MMAP_THRESHOLD get their own anonymous mapping which is unmapped on free
+*/
+
+#define CHUNK_INUSE 0x1
+#define CHUNK_MMAPPED 0x2
+#define CHUNK_FLAGS (CHUNK_INUSE | CHUNK_MMAPPED)
+#define CHUNK_OVERHEAD (2 * sizeof(size_t))
+#define CHUNK_ALIGN 8
+#define MIN_CHUNK_SIZE 16
+
+#define SMALL_BINS 32
+#define LARGE_BINS 24
+#define NBINS (SMALL_BINS + LARGE_BINS)
+#define SMALL_LIMIT (SMALL_BINS * CHUNK_ALIGN)
+
+#define MMAP_THRESHOLD (128 * 1024)
+#define HEAP_GROW_SIZE (64 * 1024)
+#define PAGE_SIZE 4096
+
+#define align_up(x, a) (((x) + (a)-1) & ~((a)-1))
+
+struct chunk
 {
+  size_t prev_size;
   size_t size;
-  struct block_meta *next;
-  bool free;
-  uint32_t magic;
+  struct chunk *next;
+  struct chunk *prev;
 };
 
-static struct block_meta *blocklist = NULL;
+static struct chunk *bins[NBINS];
+static uint32_t binmap[(NBINS + 31) / 32];
+static struct chunk *top = NULL;
+static uint32_t heap_end = 0;
 
-void validate_block(struct block_meta *block)
+static inline size_t chunk_size(struct chunk *c)
 {
-  if (block->magic != BLOCK_MAGIC)
-  {
-  }
+  return c->size & ~CHUNK_FLAGS;
+}
+
+static inline struct chunk *next_chunk(struct chunk *c)
+{
+  return (struct chunk *)((char *)c + chunk_size(c));
+}
+
+static inline struct chunk *prev_chunk(struct chunk *c)
+{
+  return (struct chunk *)((char *)c - c->prev_size);
+}
+
+static inline void *chunk2mem(struct chunk *c)
+{
+  return (char *)c + CHUNK_OVERHEAD;
+}
+
+static inline struct chunk *mem2chunk(void *mem)
+{
+  return (struct chunk *)((char *)mem - CHUNK_OVERHEAD);
+}
+
+static inline size_t request2size(size_t n)
+{
+  size_t size = align_up(n + CHUNK_OVERHEAD, CHUNK_ALIGN);
+  return size < MIN_CHUNK_SIZE ? MIN_CHUNK_SIZE : size;
+}
+
+static uint32_t bin_index(size_t size)
+{
+  if (size < SMALL_LIMIT)
+    return size / CHUNK_ALIGN;
+
+  // 256 -> 511 is the first large bin, each next bin doubles
+  uint32_t index = SMALL_BINS + (31 - __builtin_clz(size)) - 8;
+  return index < NBINS ? index : NBINS - 1;
 }
 
-struct block_meta *find_free_block(struct block_meta **last, size_t size)
+static void bin_insert(struct chunk *c)
 {
-  uint32_t bcount = 0;
-  struct block_meta *current = (struct block_meta *)blocklist;
-  while (current && !(current->free && current->size >= size))
+  uint32_t index = bin_index(chunk_size(c));
+
+  c->prev = NULL;
+  c->next = bins[index];
+  if (bins[index])
+    bins[index]->prev = c;
+  bins[index] = c;
+  binmap[index / 32] |= 1 << (index % 32);
+}
+
+static void bin_unlink(struct chunk *c)
+{
+  uint32_t index = bin_index(chunk_size(c));
+
+  if (c->prev)
+    c->prev->next = c->next;
+  else
+    bins[index] = c->next;
+  if (c->next)
+    c->next->prev = c->prev;
+
+  if (!bins[index])
+    binmap[index / 32] &= ~(1 << (index % 32));
+}
+
+static struct chunk *bin_find(size_t size)
+{
+  uint32_t index = bin_index(size);
+
+  // small bins are exact, large bins mix sizes of one class -> first fit inside
+  for (struct chunk *c = bins[index]; c; c = c->next)
+    if (chunk_size(c) >= size)
+      return c;
+
+  // any chunk of a larger class fits
+  for (++index; index < NBINS;)
   {
-    bcount++;
-    validate_block(current);
-    *last = current;
-    current = current->next;
-    if (current)
-      validate_block(current);
+    uint32_t bits = binmap[index / 32] & (~0u << (index % 32));
+    if (bits)
+      return bins[(index & ~31) + __builtin_ctz(bits)];
+    index = (index & ~31) + 32;
   }
-  return current;
+
+  return NULL;
 }
 
-void split_block(struct block_meta *block, size_t size)
+// c is not in use and not in a bin, merge it with free neighbours then put it into a bin (or top)
+static void free_chunk(struct chunk *c)
 {
-  if (block->size > size + sizeof(struct block_meta))
+  size_t size = chunk_size(c);
+
+  if (c->prev_size && !(prev_chunk(c)->size & CHUNK_INUSE))
+  {
+    c = prev_chunk(c);
+    bin_unlink(c);
+    size += chunk_size(c);
+  }
+
+  struct chunk *next = (struct chunk *)((char *)c + size);
+  if (next == top)
+  {
+    c->size = size + chunk_size(top);
+    top = c;
+    return;
+  }
+
+  if (!(next->size & CHUNK_INUSE))
   {
-    struct block_meta *splited_block = (struct block_meta *)((char *)block + size + sizeof(struct block_meta));
-    splited_block->free = true;
-    splited_block->magic = BLOCK_MAGIC;
-    splited_block->size = block->size - size - sizeof(struct block_meta);
-    splited_block->next = block->next;
-
-    block->size = size;
-    block->next = splited_block;
+    bin_unlink(next);
+    size += chunk_size(next);
   }
+
+  c->size = size;
+  next_chunk(c)->prev_size = size;
+  bin_insert(c);
 }
 
-void *get_heap(uint32_t size)
+// cut c (in use) down to size, the tail becomes a free chunk
+static void split_chunk(struct chunk *c, size_t size)
 {
-  if (!heap_current)
-    heap_current = sbrk(0);
+  size_t remainder = chunk_size(c) - size;
+  if (remainder < MIN_CHUNK_SIZE)
+    return;
+
+  c->size = size | (c->size & CHUNK_FLAGS);
 
-  uint32_t heap_base = heap_current;
-  if (size <= remaining_from_last_used)
-    remaining_from_last_used -= size;
+  struct chunk *r = next_chunk(c);
+  r->prev_size = size;
+  r->size = remainder;
+  free_chunk(r);
+}
+
+// top always keeps at least MIN_CHUNK_SIZE, the chunk before it has a valid next header
+static bool grow_heap(size_t size)
+{
+  // kernel rounds the break up to a page, slack between heap_end and the break is already ours
+  uint32_t current = sbrk(0);
+  if (!heap_end)
+    heap_end = align_up(current, CHUNK_ALIGN);
+  current = align_up(current, PAGE_SIZE);
+
+  size_t top_size = top ? chunk_size(top) : 0;
+  uint32_t needed = heap_end + size + MIN_CHUNK_SIZE - top_size;
+
+  uint32_t increment = needed > current ? align_up(needed - current, HEAP_GROW_SIZE) : 0;
+  if (increment && (uint32_t)sbrk(increment) != current + increment)
+    return false;
+
+  uint32_t new_end = current + increment;
+  if (top)
+    top->size = top_size + (new_end - heap_end);
   else
   {
-    uint32_t new_brk = sbrk(size);
-    remaining_from_last_used = new_brk - (heap_current + size);
+    top = (struct chunk *)heap_end;
+    top->prev_size = 0;
+    top->size = new_end - heap_end;
   }
-
-  heap_current += size;
-  return (void *)heap_base;
+  heap_end = new_end;
+  return true;
 }
 
-struct block_meta *request_space(struct block_meta *last, size_t size)
+static void *mmap_chunk(size_t size)
 {
+  size_t len = align_up(size, PAGE_SIZE);
+  uint32_t addr = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1);
+  if (addr > (uint32_t)-PAGE_SIZE)
+    return NULL;
+
+  struct chunk *c = (struct chunk *)addr;
+  c->prev_size = 0;
+  c->size = len | CHUNK_INUSE | CHUNK_MMAPPED;
+  return chunk2mem(c);
+}
 
-  struct block_meta *block = get_heap(size + sizeof(struct block_meta));
+static struct chunk *split_top(size_t size)
+{
+  struct chunk *c = top;
+  size_t total = chunk_size(top);
 
-  if (last)
-    last->next = block;
+  top = (struct chunk *)((char *)c + size);
+  top->prev_size = size;
+  top->size = total - size;
 
-  block->size = size;
-  block->next = NULL;
-  block->free = false;
-  block->magic = BLOCK_MAGIC;
-  return block;
+  c->size = size | CHUNK_INUSE;
+  return c;
 }
 
 void *malloc(size_t size)
 {
-  if (size <= 0)
+  if (size == 0 || size > INT32_MAX)
     return NULL;
 
-  struct block_meta *block, *last;
+  size_t csize = request2size(size);
+  if (csize >= MMAP_THRESHOLD)
+    return mmap_chunk(csize);
 
-  if (blocklist)
+  struct chunk *c = bin_find(csize);
+  if (c)
   {
-    block = find_free_block(&last, size);
-    if (block)
-    {
-      block->free = false;
-      split_block(block, size);
-    }
-    else
-      block = request_space(last, size);
+    bin_unlink(c);
+    c->size |= CHUNK_INUSE;
+    split_chunk(c, csize);
+    return chunk2mem(c);
   }
-  else
-  {
-    block = request_space(NULL, size);
-    blocklist = block;
-  }
-
-  validate_block(block);
 
-  if (block)
-    return block + 1;
-  else
+  if ((!top || chunk_size(top) < csize + MIN_CHUNK_SIZE) && !grow_heap(csize))
     return NULL;
+
+  return chunk2mem(split_top(csize));
 }
 
 void *calloc(size_t n, size_t size)
 {
+  if (size && n > INT32_MAX / size)
+    return NULL;
+
   void *block = malloc(n * size);
-  if (block)
+  // fresh anonymous mapping is zero-filled by kernel
+  if (block && !(mem2chunk(block)->size & CHUNK_MMAPPED))
     memset(block, 0, n * size);
   return block;
 }
 
-struct block_meta *get_block_ptr(void *ptr)
-{
-  return ((struct block_meta *)ptr) - 1;
-}
-
 void free(void *ptr)
 {
   if (!ptr)
     return;
 
-  struct block_meta *block = get_block_ptr(ptr);
-  validate_block(block);
-  block->free = true;
+  struct chunk *c = mem2chunk(ptr);
+  if (c->size & CHUNK_MMAPPED)
+  {
+    munmap(c, chunk_size(c));
+    return;
+  }
+
+  c->size &= ~CHUNK_INUSE;
+  free_chunk(c);
+}
+
+// grow c (in use) to size without moving it
+static bool extend_chunk(struct chunk *c, size_t size)
+{
+  size_t csize = chunk_size(c);
+  struct chunk *next = next_chunk(c);
+
+  if (next == top)
+  {
+    if (chunk_size(top) < size - csize + MIN_CHUNK_SIZE && !grow_heap(size - csize))
+      return false;
+
+    // c and top become one chunk which is cut at size again
+    size_t total = csize + chunk_size(top);
+    top = c;
+    top->size = total;
+    split_top(size);
+    return true;
+  }
+
+  if (!(next->size & CHUNK_INUSE) && csize + chunk_size(next) >= size)
+  {
+    bin_unlink(next);
+    c->size = (csize + chunk_size(next)) | CHUNK_INUSE;
+    next_chunk(c)->prev_size = chunk_size(c);
+    split_chunk(c, size);
+    return true;
+  }
+
+  return false;
 }
 
 void *realloc(void *ptr, size_t size)
 {
-  if (!ptr && size == 0)
+  if (!ptr)
+    return malloc(size);
+  if (size == 0)
   {
     free(ptr);
     return NULL;
   }
-  else if (!ptr)
-    return calloc(size, sizeof(char));
+  if (size > INT32_MAX)
+    return NULL;
+
+  struct chunk *c = mem2chunk(ptr);
+  size_t csize = request2size(size);
+  size_t old_size = chunk_size(c);
+
+  if (c->size & CHUNK_MMAPPED)
+  {
+    if (csize <= old_size)
+      return ptr;
+  }
+  else if (csize <= old_size)
+  {
+    split_chunk(c, csize);
+    return ptr;
+  }
+  else if (extend_chunk(c, csize))
+    return ptr;
 
-  void *newptr = calloc(size, sizeof(char));
-  memcpy(newptr, ptr, size);
+  void *newptr = malloc(size);
+  if (!newptr)
+    return NULL;
+
+  size_t old_payload = old_size - CHUNK_OVERHEAD;
+  memcpy(newptr, ptr, old_payload < size ? old_payload : size);
+  free(ptr);
   return newptr;
-}
\ No newline at end of file
+}
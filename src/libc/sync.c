@@ -0,0 +1,147 @@
+#include <include/errno.h>
+#include <include/futex.h>
+#include <include/limits.h>
+#include <libc/unistd.h>
+#include <libc/sync.h>
+
+static inline int32_t atomic_cmpxchg(int32_t *ptr, int32_t old, int32_t new)
+{
+  int32_t prev;
+  __asm__ __volatile__("lock cmpxchgl %2, %1"
+                       : "=a"(prev), "+m"(*ptr)
+                       : "r"(new), "0"(old)
+                       : "memory");
+  return prev;
+}
+
+static inline int32_t atomic_xchg(int32_t *ptr, int32_t val)
+{
+  __asm__ __volatile__("xchgl %0, %1"
+                       : "+r"(val), "+m"(*ptr)
+                       :
+                       : "memory");
+  return val;
+}
+
+// returns the value before adding
+static inline int32_t atomic_add(int32_t *ptr, int32_t val)
+{
+  __asm__ __volatile__("lock xaddl %0, %1"
+                       : "+r"(val), "+m"(*ptr)
+                       :
+                       : "memory");
+  return val;
+}
+
+static inline int32_t atomic_read(int32_t *ptr)
+{
+  return *(volatile int32_t *)ptr;
+}
+
+void mutex_init(struct mutex *m)
+{
+  m->state = 0;
+}
+
+// "Futexes Are Tricky" (Ulrich Drepper), mutex take 3
+void mutex_lock(struct mutex *m)
+{
+  int32_t c = atomic_cmpxchg(&m->state, 0, 1);
+  if (c == 0)
+    return;
+
+  // mark contended, unlocker has to go through the kernel from now on
+  if (c != 2)
+    c = atomic_xchg(&m->state, 2);
+  while (c != 0)
+  {
+    futex(&m->state, FUTEX_WAIT, 2);
+    c = atomic_xchg(&m->state, 2);
+  }
+}
+
+// 0 -> lock is taken, otherwise it is busy
+int32_t mutex_trylock(struct mutex *m)
+{
+  return atomic_cmpxchg(&m->state, 0, 1) == 0 ? 0 : -EBUSY;
+}
+
+void mutex_unlock(struct mutex *m)
+{
+  if (atomic_xchg(&m->state, 0) == 2)
+    futex(&m->state, FUTEX_WAKE, 1);
+}
+
+void cond_init(struct cond *c)
+{
+  c->seq = 0;
+  c->waiters = 0;
+}
+
+/*
+  Waiter sleeps on the sequence it has seen before unlocking the mutex,
+  a signal in between bumps seq and futex_wait returns immediately (no lost wakeup)
+  Woken waiter takes the mutex as contended, other waiters might still be asleep on it
+*/
+void cond_wait(struct cond *c, struct mutex *m)
+{
+  int32_t seq = atomic_read(&c->seq);
+
+  atomic_add(&c->waiters, 1);
+  mutex_unlock(m);
+  futex(&c->seq, FUTEX_WAIT, seq);
+  atomic_add(&c->waiters, -1);
+
+  while (atomic_xchg(&m->state, 2) != 0)
+    futex(&m->state, FUTEX_WAIT, 2);
+}
+
+void cond_signal(struct cond *c)
+{
+  atomic_add(&c->seq, 1);
+  if (atomic_read(&c->waiters))
+    futex(&c->seq, FUTEX_WAKE, 1);
+}
+
+void cond_broadcast(struct cond *c)
+{
+  atomic_add(&c->seq, 1);
+  if (atomic_read(&c->waiters))
+    futex(&c->seq, FUTEX_WAKE, INT_MAX);
+}
+
+void sem_init(struct semaphore *sem, int32_t value)
+{
+  sem->count = value;
+  sem->waiters = 0;
+}
+
+// 0 -> decremented, otherwise count is zero
+int32_t sem_trywait(struct semaphore *sem)
+{
+  int32_t count;
+  while ((count = atomic_read(&sem->count)) > 0)
+  {
+    if (atomic_cmpxchg(&sem->count, count, count - 1) == count)
+      return 0;
+  }
+  return -EAGAIN;
+}
+
+// a post which comes before futex_wait makes count non-zero, futex_wait returns and the loop tries again
+void sem_wait(struct semaphore *sem)
+{
+  while (sem_trywait(sem) != 0)
+  {
+    atomic_add(&sem->waiters, 1);
+    futex(&sem->count, FUTEX_WAIT, 0);
+    atomic_add(&sem->waiters, -1);
+  }
+}
+
+void sem_post(struct semaphore *sem)
+{
+  atomic_add(&sem->count, 1);
+  if (atomic_read(&sem->waiters))
+    futex(&sem->count, FUTEX_WAKE, 1);
+}
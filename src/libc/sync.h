@@ -0,0 +1,56 @@
+#ifndef LIBC_SYNC_H
+#define LIBC_SYNC_H
+
+#include <stdint.h>
+
+/*
+  Userspace blocking primitives on top of futex, uncontended lock/unlock, signal without waiters
+  and post without waiters are a single atomic instruction (no syscall)
+  They can be placed in MAP_SHARED memory to synchronize processes (futex is keyed by physical address)
+*/
+
+// 0: unlocked, 1: locked, 2: locked and someone might be waiting
+struct mutex
+{
+  int32_t state;
+};
+
+struct cond
+{
+  int32_t seq;
+  int32_t waiters;
+};
+
+struct semaphore
+{
+  int32_t count;
+  int32_t waiters;
+};
+
+#define MUTEX_INITIALIZER \
+  {                       \
+    .state = 0            \
+  }
+
+#define COND_INITIALIZER \
+  {                      \
+    .seq = 0,            \
+    .waiters = 0         \
+  }
+
+void mutex_init(struct mutex *m);
+void mutex_lock(struct mutex *m);
+int32_t mutex_trylock(struct mutex *m);
+void mutex_unlock(struct mutex *m);
+
+void cond_init(struct cond *c);
+void cond_wait(struct cond *c, struct mutex *m);
+void cond_signal(struct cond *c);
+void cond_broadcast(struct cond *c);
+
+void sem_init(struct semaphore *sem, int32_t value);
+void sem_wait(struct semaphore *sem);
+int32_t sem_trywait(struct semaphore *sem);
+void sem_post(struct semaphore *sem);
+
+#endif
@@ -0,0 +1,16 @@
+#include <libc/unistd.h>
+
+#define CPUID_SEP (1 << 11)
+
+// -1: not checked yet
+int32_t __sysenter_enabled = -1;
+
+int32_t __sysenter_probe()
+{
+  uint32_t eax = 1, ebx, ecx, edx;
+  __asm__ __volatile__("cpuid"
+                       : "+a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx));
+
+  __sysenter_enabled = (edx & CPUID_SEP) ? 1 : 0;
+  return __sysenter_enabled;
+}
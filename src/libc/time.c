@@ -0,0 +1,56 @@
+#include <include/errno.h>
+#include <include/vdso.h>
+#include <libc/time.h>
+
+#define barrier() __asm__ __volatile__("" \
+                                       :  \
+                                       :  \
+                                       : "memory")
+
+// kernel updates the time page on every pit tick, retry if a tick happens in the middle of reading
+static void read_vdso_time(struct vdso_time *snapshot)
+{
+  struct vdso_time *vt = (struct vdso_time *)VDSO_TIME_ADDRESS;
+  uint32_t seq;
+
+  do
+  {
+    while ((seq = vt->seq) & 1)
+      __asm__ __volatile__("pause");
+    barrier();
+    snapshot->monotonic_ms = vt->monotonic_ms;
+    snapshot->realtime_seconds = vt->realtime_seconds;
+    barrier();
+  } while (vt->seq != seq);
+}
+
+int32_t clock_gettime(clockid_t clk_id, struct timespec *tp)
+{
+  struct vdso_time snapshot;
+  read_vdso_time(&snapshot);
+
+  if (clk_id == CLOCK_MONOTONIC)
+  {
+    tp->tv_sec = snapshot.monotonic_ms / 1000;
+    tp->tv_nsec = (snapshot.monotonic_ms % 1000) * 1000000;
+  }
+  else if (clk_id == CLOCK_REALTIME)
+  {
+    tp->tv_sec = snapshot.realtime_seconds;
+    tp->tv_nsec = (snapshot.monotonic_ms % 1000) * 1000000;
+  }
+  else
+    return -EINVAL;
+
+  return 0;
+}
+
+time_t time(time_t *tloc)
+{
+  struct vdso_time snapshot;
+  read_vdso_time(&snapshot);
+
+  if (tloc)
+    *tloc = snapshot.realtime_seconds;
+  return snapshot.realtime_seconds;
+}
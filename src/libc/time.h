@@ -0,0 +1,13 @@
+#ifndef LIBC_TIME_H
+#define LIBC_TIME_H
+
+#include <stdint.h>
+#include <include/ctype.h>
+
+#define CLOCK_REALTIME 0
+#define CLOCK_MONOTONIC 1
+
+int32_t clock_gettime(clockid_t clk_id, struct timespec *tp);
+time_t time(time_t *tloc);
+
+#endif
@@ -5,6 +5,8 @@
 #include <stdint.h>
 #include <include/fcntl.h>
 #include <include/ctype.h>
+#include <include/vdso.h>
+#include <include/wait.h>
 
 // FIXME MQ 2020-05-12 copy define constants from linux/include/asm-x86_64/unistd.h
 #define __NR_exit 1
@@ -13,6 +15,7 @@
 #define __NR_write 4
 #define __NR_open 5
 #define __NR_close 6
+#define __NR_waitpid 7
 #define __NR_brk 17
 #define __NR_sbrk 18
 #define __NR_getpid 20
@@ -33,68 +36,87 @@
 #define __NR_listen 105
 #define __NR_stat 106
 #define __NR_fstat 108
+#define __NR_nocldwait 109
 #define __NR_msgopen 200
 #define __NR_msgclose 201
 #define __NR_msgrcv 202
 #define __NR_msgsnd 203
+#define __NR_futex 240
 
-#define _syscall0(name)                       \
-  static inline int32_t syscall_##name()      \
-  {                                           \
-    int32_t ret;                              \
-    __asm__ __volatile__("int $0x7F"          \
-                         : "=a"(ret)          \
-                         : "0"(__NR_##name)); \
-    return ret;                               \
+/*
+  System calls go through sysenter when cpu supports it (checked once), int 0x7F is the fallback
+  sysenter: ecx = user esp and edx = return address (what sysexit takes back), arg2 and arg3 move to ebp and edi
+  -> only four arguments fit, five-argument calls (mmap) always use int 0x7F
+*/
+extern int32_t __sysenter_enabled;
+int32_t __sysenter_probe();
+
+static inline int32_t __syscall_int(int32_t nr, uint32_t arg1, uint32_t arg2, uint32_t arg3, uint32_t arg4, uint32_t arg5)
+{
+  int32_t ret;
+  __asm__ __volatile__("int $0x7F"
+                       : "=a"(ret)
+                       : "0"(nr), "b"(arg1), "c"(arg2), "d"(arg3), "S"(arg4), "D"(arg5)
+                       : "memory");
+  return ret;
+}
+
+static inline int32_t __syscall_sysenter(int32_t nr, uint32_t arg1, uint32_t arg2, uint32_t arg3, uint32_t arg4)
+{
+  int32_t ret;
+  uint32_t eip;
+  __asm__ __volatile__("push %%ebp        \n"
+                       "mov %%ecx, %%ebp  \n"
+                       "mov %%esp, %%ecx  \n"
+                       "mov $1f, %%edx    \n"
+                       "sysenter          \n"
+                       "1: pop %%ebp      \n"
+                       : "=a"(ret), "+c"(arg2), "=d"(eip), "+D"(arg3)
+                       : "0"(nr), "b"(arg1), "S"(arg4)
+                       : "memory");
+  return ret;
+}
+
+static inline int32_t __syscall(int32_t nr, uint32_t arg1, uint32_t arg2, uint32_t arg3, uint32_t arg4)
+{
+  if (__sysenter_enabled > 0 || (__sysenter_enabled < 0 && __sysenter_probe()))
+    return __syscall_sysenter(nr, arg1, arg2, arg3, arg4);
+  return __syscall_int(nr, arg1, arg2, arg3, arg4, 0);
+}
+
+#define _syscall0(name)                        \
+  static inline int32_t syscall_##name()       \
+  {                                            \
+    return __syscall(__NR_##name, 0, 0, 0, 0); \
   }
-#define _syscall1(name, type1)                           \
-  static inline int32_t syscall_##name(type1 arg1)       \
-  {                                                      \
-    int32_t ret;                                         \
-    __asm__ __volatile__("int $0x7F"                     \
-                         : "=a"(ret)                     \
-                         : "0"(__NR_##name), "b"(arg1)); \
-    return ret;                                          \
+#define _syscall1(name, type1)                              \
+  static inline int32_t syscall_##name(type1 arg1)          \
+  {                                                         \
+    return __syscall(__NR_##name, (uint32_t)arg1, 0, 0, 0); \
   }
 
-#define _syscall2(name, type1, type2)                               \
-  static inline int32_t syscall_##name(type1 arg1, type2 arg2)      \
-  {                                                                 \
-    int32_t ret;                                                    \
-    __asm__ __volatile__("int $0x7F"                                \
-                         : "=a"(ret)                                \
-                         : "0"(__NR_##name), "b"(arg1), "c"(arg2)); \
-    return ret;                                                     \
+#define _syscall2(name, type1, type2)                                    \
+  static inline int32_t syscall_##name(type1 arg1, type2 arg2)           \
+  {                                                                      \
+    return __syscall(__NR_##name, (uint32_t)arg1, (uint32_t)arg2, 0, 0); \
   }
 
-#define _syscall3(name, type1, type2, type3)                                   \
-  static inline int32_t syscall_##name(type1 arg1, type2 arg2, type3 arg3)     \
-  {                                                                            \
-    int32_t ret;                                                               \
-    __asm__ __volatile__("int $0x7F"                                           \
-                         : "=a"(ret)                                           \
-                         : "0"(__NR_##name), "b"(arg1), "c"(arg2), "d"(arg3)); \
-    return ret;                                                                \
+#define _syscall3(name, type1, type2, type3)                                          \
+  static inline int32_t syscall_##name(type1 arg1, type2 arg2, type3 arg3)            \
+  {                                                                                   \
+    return __syscall(__NR_##name, (uint32_t)arg1, (uint32_t)arg2, (uint32_t)arg3, 0); \
   }
 
-#define _syscall4(name, type1, type2, type3, type4)                                       \
-  static inline int32_t syscall_##name(type1 arg1, type2 arg2, type3 arg3, type4 arg4)    \
-  {                                                                                       \
-    int32_t ret;                                                                          \
-    __asm__ __volatile__("int $0x7F"                                                      \
-                         : "=a"(ret)                                                      \
-                         : "0"(__NR_##name), "b"(arg1), "c"(arg2), "d"(arg3), "S"(arg4)); \
-    return ret;                                                                           \
+#define _syscall4(name, type1, type2, type3, type4)                                                \
+  static inline int32_t syscall_##name(type1 arg1, type2 arg2, type3 arg3, type4 arg4)             \
+  {                                                                                                \
+    return __syscall(__NR_##name, (uint32_t)arg1, (uint32_t)arg2, (uint32_t)arg3, (uint32_t)arg4); \
   }
 
-#define _syscall5(name, type1, type2, type3, type4, type5)                                           \
-  static inline int32_t syscall_##name(type1 arg1, type2 arg2, type3 arg3, type4 arg4, type5 arg5)   \
-  {                                                                                                  \
-    int32_t ret;                                                                                     \
-    __asm__ __volatile__("int $0x7F"                                                                 \
-                         : "=a"(ret)                                                                 \
-                         : "0"(__NR_##name), "b"(arg1), "c"(arg2), "d"(arg3), "S"(arg4), "D"(arg5)); \
-    return ret;                                                                                      \
+#define _syscall5(name, type1, type2, type3, type4, type5)                                                             \
+  static inline int32_t syscall_##name(type1 arg1, type2 arg2, type3 arg3, type4 arg4, type5 arg5)                     \
+  {                                                                                                                    \
+    return __syscall_int(__NR_##name, (uint32_t)arg1, (uint32_t)arg2, (uint32_t)arg3, (uint32_t)arg4, (uint32_t)arg5); \
   }
 
 _syscall0(fork);
@@ -109,6 +131,19 @@ static inline void exit(int32_t code)
   syscall_exit(code);
 }
 
+_syscall3(waitpid, pid_t, int32_t *, int32_t);
+static inline int32_t waitpid(pid_t pid, int32_t *status, int32_t options)
+{
+  return syscall_waitpid(pid, status, options);
+}
+
+// children are released when they exit, nobody has to waitpid for them (like ignoring SIGCHLD)
+_syscall1(nocldwait, int32_t);
+static inline int32_t nocldwait(int32_t enable)
+{
+  return syscall_nocldwait(enable);
+}
+
 _syscall3(read, uint32_t, char *, uint32_t);
 static inline int32_t read(uint32_t fd, char *buf, uint32_t size)
 {
@@ -213,9 +248,10 @@ static inline int32_t munmap(void *addr, size_t length)
 }
 
 _syscall0(getpid);
+// pid is read from the per-process vdso page, syscall_getpid still traps
 static inline int32_t getpid()
 {
-  return syscall_getpid();
+  return ((struct vdso_process *)VDSO_PROCESS_ADDRESS)->pid;
 }
 
 _syscall1(posix_spawn, char *);
@@ -224,6 +260,12 @@ static inline int32_t posix_spawn(char *path)
   return syscall_posix_spawn(path);
 }
 
+_syscall3(futex, int32_t *, int32_t, int32_t);
+static inline int32_t futex(int32_t *uaddr, int32_t op, int32_t val)
+{
+  return syscall_futex(uaddr, op, val);
+}
+
 int32_t shm_open(const char *name, int32_t flags, int32_t mode);
 
 #endif
\ No newline at end of file